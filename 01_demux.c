@@ -1,5 +1,226 @@
 #include "libavformat/avformat.h"
+#include "libavutil/time.h"
+#include <dirent.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// 快速探测时avformat_open_input/avformat_find_stream_info最多读取的字节数和时长
+#define FAST_PROBE_SIZE (64 * 1024)
+#define FAST_ANALYZE_DURATION_US (500 * 1000)
+
+// 快速探测的方式
+enum {
+  PROBE_FULL = 0, // 和上面一样完整调用avformat_find_stream_info
+  PROBE_HEADER,   // mp4/flv的头里参数已经完整, 不调用avformat_find_stream_info
+  PROBE_LIMITED,  // 参数不完整, 限制probesize/analyzeduration调用avformat_find_stream_info
+};
+
+static const char *probe_names[] = {"full", "header", "limited"};
+
+// 容器头里是否已经有输出摘要需要的所有参数
+static int stream_params_complete(AVFormatContext *ifmt_ctx) {
+  if (ifmt_ctx->nb_streams == 0)
+    return 0; // 比如flv, 读packet时才创建流
+  for (unsigned int i = 0; i < ifmt_ctx->nb_streams; i++) {
+    AVCodecParameters *par = ifmt_ctx->streams[i]->codecpar;
+    if (par->codec_id == AV_CODEC_ID_NONE)
+      return 0;
+    if (par->codec_type == AVMEDIA_TYPE_VIDEO &&
+        (par->width <= 0 || par->height <= 0))
+      return 0;
+    if (par->codec_type == AVMEDIA_TYPE_AUDIO &&
+        (par->sample_rate <= 0 || par->ch_layout.nb_channels <= 0))
+      return 0;
+  }
+  return 1;
+}
+
+// 只信任mp4/flv的头, 其他格式(ts等)头里的参数不可靠
+static int trust_container_header(AVFormatContext *ifmt_ctx) {
+  const char *name = ifmt_ctx->iformat ? ifmt_ctx->iformat->name : "";
+  return strstr(name, "mp4") != NULL || strcmp(name, "flv") == 0;
+}
+
+// 打开文件并获取流信息, fast为0时和main里的流程一样
+static int probe_open(AVFormatContext **ifmt_ctx, const char *in_filename,
+                      int fast, int *probe_mode) {
+  AVDictionary *opts = NULL;
+  if (fast) {
+    av_dict_set_int(&opts, "probesize", FAST_PROBE_SIZE, 0);
+    av_dict_set_int(&opts, "analyzeduration", FAST_ANALYZE_DURATION_US, 0);
+  }
+  int ret = avformat_open_input(ifmt_ctx, in_filename, NULL, &opts);
+  av_dict_free(&opts);
+  if (ret < 0)
+    return ret;
+  *probe_mode = PROBE_FULL;
+  if (fast) {
+    if (trust_container_header(*ifmt_ctx) && stream_params_complete(*ifmt_ctx)) {
+      *probe_mode = PROBE_HEADER;
+      return 0;
+    }
+    *probe_mode = PROBE_LIMITED;
+  }
+  return avformat_find_stream_info(*ifmt_ctx, NULL);
+}
+
+static void print_json_string(const char *str) {
+  putchar('"');
+  for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+    if (*p == '"' || *p == '\\')
+      printf("\\%c", *p);
+    else if (*p < 0x20)
+      printf("\\u%04x", *p);
+    else
+      putchar(*p);
+  }
+  putchar('"');
+}
+
+// 没有调用avformat_find_stream_info时总时长和码率可能没有计算, 用流的时长和文件大小估算
+static void print_json_summary(AVFormatContext *ifmt_ctx,
+                               const char *in_filename, int probe_mode,
+                               int64_t open_us) {
+  double duration = -1;
+  if (ifmt_ctx->duration != AV_NOPTS_VALUE && ifmt_ctx->duration > 0) {
+    duration = ifmt_ctx->duration / (double)AV_TIME_BASE;
+  } else {
+    for (unsigned int i = 0; i < ifmt_ctx->nb_streams; i++) {
+      AVStream *st = ifmt_ctx->streams[i];
+      if (st->duration != AV_NOPTS_VALUE && st->duration > 0 &&
+          st->duration * av_q2d(st->time_base) > duration)
+        duration = st->duration * av_q2d(st->time_base);
+    }
+  }
+  int64_t bit_rate = ifmt_ctx->bit_rate;
+  if (bit_rate <= 0 && duration > 0 && ifmt_ctx->pb) {
+    int64_t size = avio_size(ifmt_ctx->pb);
+    if (size > 0)
+      bit_rate = (int64_t)(size * 8 / duration);
+  }
+
+  printf("{\"file\":");
+  print_json_string(in_filename);
+  printf(",\"format\":");
+  print_json_string(ifmt_ctx->iformat ? ifmt_ctx->iformat->name : "");
+  printf(",\"probe\":\"%s\",\"open_ms\":%.3f,\"duration\":%.3f,"
+         "\"bit_rate\":%" PRId64 ",\"streams\":[",
+         probe_names[probe_mode], open_us / 1000.0, duration, bit_rate);
+  for (unsigned int i = 0; i < ifmt_ctx->nb_streams; i++) {
+    AVStream *st = ifmt_ctx->streams[i];
+    AVCodecParameters *par = st->codecpar;
+    const char *type = av_get_media_type_string(par->codec_type);
+    printf("%s{\"index\":%d,\"type\":\"%s\",\"codec\":\"%s\"", i ? "," : "",
+           st->index, type ? type : "unknown", avcodec_get_name(par->codec_id));
+    if (par->codec_type == AVMEDIA_TYPE_VIDEO) {
+      AVRational fps = st->avg_frame_rate.num ? st->avg_frame_rate
+                                              : st->r_frame_rate;
+      printf(",\"width\":%d,\"height\":%d,\"fps\":%.3f", par->width,
+             par->height, fps.den ? av_q2d(fps) : 0);
+    } else if (par->codec_type == AVMEDIA_TYPE_AUDIO) {
+      printf(",\"sample_rate\":%d,\"channels\":%d", par->sample_rate,
+             par->ch_layout.nb_channels);
+    }
+    double st_duration = st->duration != AV_NOPTS_VALUE
+                             ? st->duration * av_q2d(st->time_base)
+                             : -1;
+    printf(",\"duration\":%.3f,\"bit_rate\":%" PRId64 "}", st_duration,
+           par->bit_rate);
+  }
+  printf("]}\n");
+}
+
+// 输入可以是文件或者目录(不递归)
+static int collect_files(char ***files, int *nb_files, const char *path) {
+  struct stat st;
+  if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+      printf("opendir %s failed\n", path);
+      return -1;
+    }
+    struct dirent *entry;
+    char full[1024];
+    while ((entry = readdir(dir)) != NULL) {
+      if (entry->d_name[0] == '.')
+        continue;
+      snprintf(full, sizeof(full), "%s/%s", path, entry->d_name);
+      if (stat(full, &st) == 0 && S_ISREG(st.st_mode) &&
+          collect_files(files, nb_files, full) < 0) {
+        closedir(dir);
+        return -1;
+      }
+    }
+    closedir(dir);
+    return 0;
+  }
+  char **tmp = av_realloc(*files, (*nb_files + 1) * sizeof(char *));
+  if (!tmp)
+    return AVERROR(ENOMEM);
+  *files = tmp;
+  (*files)[(*nb_files)++] = av_strdup(path);
+  return 0;
+}
+
+// 01_demux -probe [-full] [-bench] file_or_dir...
+// 每个文件输出一行json; -full使用完整的avformat_find_stream_info对比;
+// -bench不输出json, 只统计每秒探测的文件数
+static int run_probe(int argc, char **argv) {
+  int fast = 1;
+  int bench = 0;
+  char **files = NULL;
+  int nb_files = 0;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "-full") == 0)
+      fast = 0;
+    else if (strcmp(argv[i], "-bench") == 0)
+      bench = 1;
+    else if (collect_files(&files, &nb_files, argv[i]) < 0)
+      return -1;
+  }
+  if (nb_files == 0) {
+    printf("usage: %s -probe [-full] [-bench] file_or_dir...\n", argv[0]);
+    return -1;
+  }
+  av_log_set_level(AV_LOG_ERROR);
+
+  int failed = 0;
+  int mode_count[3] = {0};
+  int64_t start = av_gettime_relative();
+  for (int i = 0; i < nb_files; i++) {
+    AVFormatContext *ifmt_ctx = NULL;
+    int probe_mode = PROBE_FULL;
+    int64_t open_start = av_gettime_relative();
+    int ret = probe_open(&ifmt_ctx, files[i], fast, &probe_mode);
+    int64_t open_us = av_gettime_relative() - open_start;
+    if (ret < 0) {
+      char buf[1024] = {0};
+      av_strerror(ret, buf, sizeof(buf) - 1);
+      fprintf(stderr, "probe %s failed:%s\n", files[i], buf);
+      failed++;
+    } else {
+      mode_count[probe_mode]++;
+      if (!bench)
+        print_json_summary(ifmt_ctx, files[i], probe_mode, open_us);
+    }
+    if (ifmt_ctx)
+      avformat_close_input(&ifmt_ctx);
+    av_free(files[i]);
+  }
+  int64_t elapsed_us = av_gettime_relative() - start;
+  av_free(files);
+  // 统计输出到stderr, 不影响stdout的json
+  fprintf(stderr,
+          "%s probe files:%d failed:%d header:%d limited:%d full:%d "
+          "elapsed:%.2fs %.1ffiles/s\n",
+          fast ? "fast" : "full", nb_files, failed, mode_count[PROBE_HEADER],
+          mode_count[PROBE_LIMITED], mode_count[PROBE_FULL],
+          elapsed_us / 1000000.0,
+          elapsed_us > 0 ? nb_files * 1000000.0 / elapsed_us : 0);
+  return failed ? -1 : 0;
+}
 
 int main(int argc, char **argv) {
   // 打开网络流。这里如果只需要读取本地媒体文件，不需要用到网络功能，可以不用加上这一句
@@ -7,6 +228,9 @@ int main(int argc, char **argv) {
 
   char *in_filename = NULL;
 
+  if (argc > 1 && strcmp(argv[1], "-probe") == 0)
+    return run_probe(argc, argv);
+
   if (argv[1] == NULL) {
     return -1;
   } else {
@@ -3,79 +3,7 @@
 #include <libavutil/log.h>
 #include <stdio.h>
 
-
-#define ADTS_HEADER_LEN 7;
-
-const int sampling_frequencies[] = {
-    96000, // 0x0
-    88200, // 0x1
-    64000, // 0x2
-    48000, // 0x3
-    44100, // 0x4
-    32000, // 0x5
-    24000, // 0x6
-    22050, // 0x7
-    16000, // 0x8
-    12000, // 0x9
-    11025, // 0xa
-    8000   // 0xb
-           // 0xc d e f是保留的
-};
-
-int adts_header(char *const p_adts_header, const int data_length,
-                const int profile, const int samplerate, const int channels) {
-
-  int sampling_frequency_index = 3; // 默认使用48000hz
-  int adtsLen = data_length + 7;
-
-  int frequencies_size =
-      sizeof(sampling_frequencies) / sizeof(sampling_frequencies[0]);
-  int i = 0;
-  for (i = 0; i < frequencies_size; i++) {
-    if (sampling_frequencies[i] == samplerate) {
-      sampling_frequency_index = i;
-      break;
-    }
-  }
-  if (i >= frequencies_size) {
-    printf("unsupport samplerate:%d\n", samplerate);
-    return -1;
-  }
-
-  p_adts_header[0] = 0xff; // syncword:0xfff                          高8bits
-  p_adts_header[1] = 0xf0; // syncword:0xfff                          低4bits
-  p_adts_header[1] |= (0 << 3); // MPEG Version:0 for MPEG-4,1 for MPEG-2  1bit
-  p_adts_header[1] |= (0 << 1); // Layer:0                                 2bits
-  p_adts_header[1] |= 1;        // protection absent:1                     1bit
-
-  p_adts_header[2] = (profile) << 6; // profile:profile               2bits
-  p_adts_header[2] |=
-      (sampling_frequency_index & 0x0f)
-      << 2; // sampling frequency index:sampling_frequency_index  4bits
-  p_adts_header[2] |= (0 << 1); // private bit:0                   1bit
-  p_adts_header[2] |=
-      (channels & 0x04) >> 2; // channel configuration:channels  高1bit
-
-  p_adts_header[3] = (channels & 0x03)
-                     << 6;      // channel configuration:channels 低2bits
-  p_adts_header[3] |= (0 << 5); // original：0                1bit
-  p_adts_header[3] |= (0 << 4); // home：0                    1bit
-  p_adts_header[3] |= (0 << 3); // copyright id bit：0        1bit
-  p_adts_header[3] |= (0 << 2); // copyright id start：0      1bit
-  p_adts_header[3] |= ((adtsLen & 0x1800) >> 11); // frame length：value 高2bits
-
-  p_adts_header[4] =
-      (uint8_t)((adtsLen & 0x7f8) >> 3); // frame length:value    中间8bits
-  p_adts_header[5] =
-      (uint8_t)((adtsLen & 0x7) << 5); // frame length:value    低3bits
-  p_adts_header[5] |= 0x1f;            // buffer fullness:0x7ff 高5bits
-  p_adts_header[6] =
-      0xfc; // ‭11111100‬       //buffer fullness:0x7ff 低6bits
-  // number_of_raw_data_blocks_in_frame：
-  //    表示ADTS帧中有number_of_raw_data_blocks_in_frame + 1个AAC原始帧。
-
-  return 0;
-}
+#include "eswriter.h"
 
 int main(int argc, char *argv[]) {
   int ret = -1;
@@ -84,10 +12,10 @@ int main(int argc, char *argv[]) {
   char *in_filename = NULL;
   char *aac_filename = NULL;
 
-  FILE *aac_fd = NULL;
+  EsWriter aac_writer = {.fd = -1};
+  AdtsContext adts;
 
   int audio_index = -1;
-  int len = 0;
 
   AVFormatContext *ifmt_ctx = NULL;
   AVPacket pkt;
@@ -109,10 +37,10 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  aac_fd = fopen(aac_filename, "wb");
-  if (!aac_fd) {
+  if (es_writer_open(&aac_writer, aac_filename) < 0) {
     av_log(NULL, AV_LOG_DEBUG, "Could not open destination file %s\n",
            aac_filename);
+    es_writer_close(&aac_writer);
     return -1;
   }
 
@@ -155,36 +83,35 @@ int main(int argc, char *argv[]) {
            ifmt_ctx->streams[audio_index]->codecpar->codec_id);
     goto failed;
   }
+  // ADTS头的固定字段只计算一次
+  if (adts_context_init(
+          &adts, ifmt_ctx->streams[audio_index]->codecpar->profile,
+          ifmt_ctx->streams[audio_index]->codecpar->sample_rate,
+          ifmt_ctx->streams[audio_index]->codecpar->ch_layout.nb_channels) <
+      0) {
+    goto failed;
+  }
   // 读取媒体文件，并把aac数据帧写入到本地文件
+  // ts流不适用，ts流分离出来的packet带了adts header
   while (av_read_frame(ifmt_ctx, &pkt) >= 0) {
     if (pkt.stream_index == audio_index) {
-      char adts_header_buf[7] = {0};
-      adts_header(
-          adts_header_buf, pkt.size,
-          ifmt_ctx->streams[audio_index]->codecpar->profile,
-          ifmt_ctx->streams[audio_index]->codecpar->sample_rate,
-          ifmt_ctx->streams[audio_index]->codecpar->ch_layout.nb_channels);
-      fwrite(adts_header_buf, 1, 7,
-             aac_fd); // 写adts header ,
-                      // ts流不适用，ts流分离出来的packet带了adts header
-      len = fwrite(pkt.data, 1, pkt.size, aac_fd); // 写adts data
-      if (len != pkt.size) {
-        av_log(NULL, AV_LOG_DEBUG,
-               "warning, length of writed data isn't equal pkt.size(%d, %d)\n",
-               len, pkt.size);
+      // 头和数据攒到一批再writev, pkt的数据由writer持有到写完
+      if (es_writer_write_adts(&aac_writer, &adts, &pkt) < 0) {
+        av_log(NULL, AV_LOG_DEBUG, "write adts frame failed\n");
+        break;
       }
     }
     av_packet_unref(&pkt);
   }
+  es_writer_flush(&aac_writer);
+  es_writer_dump_stats(&aac_writer, "aac");
 
 failed:
   // 关闭输入文件
   if (ifmt_ctx) {
     avformat_close_input(&ifmt_ctx);
   }
-  if (aac_fd) {
-    fclose(aac_fd);
-  }
+  es_writer_close(&aac_writer);
 
   return 0;
 }
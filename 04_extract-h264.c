@@ -1,8 +1,13 @@
 ﻿#include "libavcodec/bsf.h"
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
+#include <libavutil/intreadwrite.h>
 #include <libavutil/log.h>
+#include <libavutil/time.h>
 #include <stdio.h>
+#include <string.h>
+
+#include "eswriter.h"
 
 static char err_buf[128] = {0};
 static char *av_get_err(int errnum) {
@@ -18,6 +23,83 @@ AvCodecContext->extradata[]中为nalu长度
 *   1, [0, 5],68, e9, 78, bc, b0, 0,
 */
 
+// 提取方式
+enum {
+  EXTRACT_COPY = 0,    // 已经是start code格式(比如TS), 直接写入
+  EXTRACT_IN_PLACE,    // avcC并且nalu长度为4字节, 在packet里原地把长度改成start code
+  EXTRACT_BSF,         // 其他情况使用h264_mp4toannexb
+};
+
+// 从avcC格式的extradata解析出nalu长度字节数, 并生成带start code的SPS/PPS
+// 返回<0表示不是avcC格式
+static int parse_avcc_extradata(const uint8_t *extradata, int extradata_size,
+                                int *nal_length_size, uint8_t **sps_pps,
+                                int *sps_pps_size) {
+  if (!extradata || extradata_size < 7 || extradata[0] != 1)
+    return -1;
+  *nal_length_size = (extradata[4] & 0x03) + 1;
+  // 每个参数集的2字节长度换成4字节start code, 输出不会超过输入的2倍
+  uint8_t *out = av_malloc(extradata_size * 2 + 64);
+  if (!out)
+    return AVERROR(ENOMEM);
+  int out_size = 0;
+  int pos = 5;
+  // 先是SPS, 数量在低5bit; 然后是PPS, 数量为1个字节
+  for (int type = 0; type < 2; type++) {
+    if (pos >= extradata_size)
+      goto invalid;
+    int count = type == 0 ? (extradata[pos] & 0x1f) : extradata[pos];
+    pos++;
+    for (int i = 0; i < count; i++) {
+      if (pos + 2 > extradata_size)
+        goto invalid;
+      int size = AV_RB16(extradata + pos);
+      pos += 2;
+      if (pos + size > extradata_size)
+        goto invalid;
+      AV_WB32(out + out_size, 1);
+      memcpy(out + out_size + 4, extradata + pos, size);
+      out_size += 4 + size;
+      pos += size;
+    }
+  }
+  *sps_pps = out;
+  *sps_pps_size = out_size;
+  return 0;
+invalid:
+  printf("invalid avcC extradata\n");
+  av_free(out);
+  return AVERROR_INVALIDDATA;
+}
+
+// 原地把4字节的nalu长度改成00 00 00 01
+// 先检查整个packet的长度都合法再修改, has_idr/has_sps返回packet里是否有IDR和SPS
+static int annexb_convert_in_place(uint8_t *data, int size, int *has_idr,
+                                   int *has_sps) {
+  int pos = 0;
+  *has_idr = 0;
+  *has_sps = 0;
+  while (pos < size) {
+    if (pos + 4 > size)
+      return AVERROR_INVALIDDATA;
+    uint32_t nal_size = AV_RB32(data + pos);
+    if (nal_size == 0 || nal_size > (uint32_t)(size - pos - 4))
+      return AVERROR_INVALIDDATA;
+    int nal_type = data[pos + 4] & 0x1f;
+    if (nal_type == 5)
+      *has_idr = 1;
+    else if (nal_type == 7)
+      *has_sps = 1;
+    pos += 4 + nal_size;
+  }
+  for (pos = 0; pos < size;) {
+    uint32_t nal_size = AV_RB32(data + pos);
+    AV_WB32(data + pos, 1);
+    pos += 4 + nal_size;
+  }
+  return 0;
+}
+
 // ffmpeg -i 2018.mp4 -codec copy -bsf:h264_mp4toannexb -f h264 tmp.h264
 // ffmpeg 从mp4上提取H264的nalu h
 int main(int argc, char **argv) {
@@ -26,18 +108,32 @@ int main(int argc, char **argv) {
   AVPacket *pkt = NULL;
   int ret = -1;
   int file_end = 0; // 文件是否读取结束
+  EsWriter writer = {.fd = -1};
+  AVBSFContext *bsf_ctx = NULL;
+  int mode = EXTRACT_COPY;
+  int nal_length_size = 0;
+  uint8_t *sps_pps = NULL; // 带start code的SPS/PPS, 只在IDR前插入
+  int sps_pps_size = 0;
+  int64_t in_place_count = 0;
+  int64_t sps_pps_count = 0;
+  int write_error = 0;
 
   if (argc < 3) {
-    printf("usage inputfile outfile\n");
+    printf("usage inputfile outfile [bsf]\n");
+    return -1;
+  }
+  // 输出攒成大批量writev写入, 不再每个packet一次fwrite
+  if (es_writer_open(&writer, argv[2]) < 0) {
+    es_writer_close(&writer);
     return -1;
   }
-  FILE *outfp = fopen(argv[2], "wb");
   printf("in:%s out:%s\n", argv[1], argv[2]);
 
   // 分配解复用器的内存，使用avformat_close_input释放
   ifmt_ctx = avformat_alloc_context();
   if (!ifmt_ctx) {
     printf("[error] Could not allocate context.\n");
+    es_writer_close(&writer);
     return -1;
   }
 
@@ -45,6 +141,7 @@ int main(int argc, char **argv) {
   ret = avformat_open_input(&ifmt_ctx, argv[1], NULL, NULL);
   if (ret != 0) {
     printf("[error]avformat_open_input: %s\n", av_get_err(ret));
+    es_writer_close(&writer);
     return -1;
   }
 
@@ -53,6 +150,7 @@ int main(int argc, char **argv) {
   if (ret < 0) {
     printf("[error]avformat_find_stream_info: %s\n", av_get_err(ret));
     avformat_close_input(&ifmt_ctx);
+    es_writer_close(&writer);
     return -1;
   }
 
@@ -64,78 +162,126 @@ int main(int argc, char **argv) {
   if (videoindex == -1) {
     printf("Didn't find a video stream.\n");
     avformat_close_input(&ifmt_ctx);
+    es_writer_close(&writer);
     return -1;
   }
 
   // 分配数据包
   pkt = av_packet_alloc();
 
-  // 1 获取相应的比特流过滤器
-  // FLV/MP4/MKV等结构中，h264需要h264_mp4toannexb处理。添加SPS/PPS等信息。
+  // FLV/MP4/MKV等结构中，h264是avcC格式, extradata里是SPS/PPS
   // FLV封装时，可以把多个NALU放在一个VIDEO TAG中,结构为4B NALU长度+NALU1+4B
   // NALU长度+NALU2+..., 需要做的处理把4B长度换成00000001或者000001
-  const AVBitStreamFilter *bsfilter = av_bsf_get_by_name("h264_mp4toannexb");
-  AVBSFContext *bsf_ctx = NULL;
-  // 2 初始化过滤器上下文
-  av_bsf_alloc(bsfilter, &bsf_ctx); // AVBSFContext;
-  // 3 添加解码器属性
-  avcodec_parameters_copy(bsf_ctx->par_in,
-                          ifmt_ctx->streams[videoindex]->codecpar);
-  av_bsf_init(bsf_ctx);
+  // 4B长度时直接在packet里原地替换, 只在IDR前面插入缓存的SPS/PPS;
+  // 其他长度(1/2B)换成start code后数据会变长, 交给h264_mp4toannexb处理
+  AVCodecParameters *codecpar = ifmt_ctx->streams[videoindex]->codecpar;
+  // hvcC等其他格式的extradata也以0x01开头, 只能按H264的规则处理H264
+  if (codecpar->codec_id != AV_CODEC_ID_H264) {
+    printf("video codec %s is not h264\n",
+           avcodec_get_name(codecpar->codec_id));
+    av_packet_free(&pkt);
+    avformat_close_input(&ifmt_ctx);
+    es_writer_close(&writer);
+    return -1;
+  }
+  if (parse_avcc_extradata(codecpar->extradata, codecpar->extradata_size,
+                           &nal_length_size, &sps_pps, &sps_pps_size) == 0) {
+    mode = (nal_length_size == 4 && !(argc > 3 && !strcmp(argv[3], "bsf")))
+               ? EXTRACT_IN_PLACE
+               : EXTRACT_BSF;
+  }
+  if (mode == EXTRACT_BSF) {
+    // 1 获取相应的比特流过滤器
+    const AVBitStreamFilter *bsfilter = av_bsf_get_by_name("h264_mp4toannexb");
+    // 2 初始化过滤器上下文
+    av_bsf_alloc(bsfilter, &bsf_ctx); // AVBSFContext;
+    // 3 添加解码器属性
+    avcodec_parameters_copy(bsf_ctx->par_in, codecpar);
+    av_bsf_init(bsf_ctx);
+  }
+  printf("extract mode:%s nal_length_size:%d\n",
+         mode == EXTRACT_IN_PLACE ? "in-place"
+         : mode == EXTRACT_BSF    ? "bsf"
+                                  : "copy",
+         nal_length_size);
 
+  int64_t start = av_gettime_relative();
   file_end = 0;
-  while (0 == file_end) {
+  while (0 == file_end && !write_error) {
     if ((ret = av_read_frame(ifmt_ctx, pkt)) < 0) {
       // 没有更多包可读
       file_end = 1;
       printf("read file end: ret:%d\n", ret);
     }
     if (ret == 0 && pkt->stream_index == videoindex) {
-#if 0
-            int input_size = pkt->size;
-            int out_pkt_count = 0;
-            if (av_bsf_send_packet(bsf_ctx, pkt) != 0) // bitstreamfilter内部去维护内存空间
-            {
-                av_packet_unref(pkt);   // 你不用了就把资源释放掉
-                continue;       // 继续送
-            }
-            av_packet_unref(pkt);   // 释放资源
-            while(av_bsf_receive_packet(bsf_ctx, pkt) == 0)
-            {
-                out_pkt_count++;
-                // printf("fwrite size:%d\n", pkt->size);
-                size_t size = fwrite(pkt->data, 1, pkt->size, outfp);
-                if(size != pkt->size)
-                {
-                    printf("fwrite failed-> write:%u, pkt_size:%u\n", size, pkt->size);
-                }
-                av_packet_unref(pkt);
-            }
-            if(out_pkt_count >= 2) 
-            {
-                printf("cur pkt(size:%d) only get 1 out pkt, it get %d pkts\n",
-                       input_size, out_pkt_count);
-            }
-#else // TS流可以直接写入
-      size_t size = fwrite(pkt->data, 1, pkt->size, outfp);
-      if (size != pkt->size) {
-        printf("fwrite failed-> write:%lu, pkt_size:%u\n", size, pkt->size);
+      if (mode == EXTRACT_IN_PLACE) {
+        int has_idr = 0;
+        int has_sps = 0;
+        // av_read_frame出来的packet一般只有一个引用, 不会发生拷贝
+        if (av_packet_make_writable(pkt) < 0 ||
+            annexb_convert_in_place(pkt->data, pkt->size, &has_idr,
+                                    &has_sps) < 0) {
+          printf("invalid packet size:%d, skip\n", pkt->size);
+          av_packet_unref(pkt);
+          continue;
+        }
+        in_place_count++;
+        // IDR并且packet里没有带SPS时, 插入extradata里的SPS/PPS
+        if (has_idr && !has_sps) {
+          if (es_writer_write_static(&writer, sps_pps, sps_pps_size) < 0) {
+            av_packet_unref(pkt);
+            write_error = 1;
+            break;
+          }
+          sps_pps_count++;
+        }
+        if (es_writer_write_packet(&writer, NULL, 0, pkt) < 0)
+          write_error = 1;
+      } else if (mode == EXTRACT_BSF) {
+        if (av_bsf_send_packet(bsf_ctx, pkt) !=
+            0) // bitstreamfilter内部去维护内存空间
+        {
+          av_packet_unref(pkt); // 你不用了就把资源释放掉
+          continue;             // 继续送
+        }
+        while (av_bsf_receive_packet(bsf_ctx, pkt) == 0) {
+          if (es_writer_write_packet(&writer, NULL, 0, pkt) < 0) {
+            write_error = 1;
+            break;
+          }
+        }
+      } else { // TS流可以直接写入
+        if (es_writer_write_packet(&writer, NULL, 0, pkt) < 0)
+          write_error = 1;
       }
-      av_packet_unref(pkt);
-#endif
     } else {
       if (ret == 0)
         av_packet_unref(pkt); // 释放内存
     }
   }
-  if (outfp)
-    fclose(outfp);
+  if (es_writer_flush(&writer) < 0)
+    write_error = 1;
+  int64_t elapsed_us = av_gettime_relative() - start;
+  es_writer_dump_stats(&writer, "h264");
+  printf("in-place packets:%" PRId64 " sps/pps inserted:%" PRId64
+         " elapsed:%.1fms %.1fMB/s\n",
+         in_place_count, sps_pps_count, elapsed_us / 1000.0,
+         elapsed_us > 0 ? writer.total_bytes / (double)elapsed_us : 0);
+
+  // 写完之后才能释放sps_pps, writer里可能引用了它
+  if (es_writer_close(&writer) < 0)
+    write_error = 1;
+  av_freep(&sps_pps);
   if (bsf_ctx)
     av_bsf_free(&bsf_ctx);
   if (pkt)
     av_packet_free(&pkt);
   if (ifmt_ctx)
     avformat_close_input(&ifmt_ctx);
+  if (write_error) {
+    printf("write %s failed\n", argv[2]);
+    return -1;
+  }
   printf("finish\n");
 
   return 0;
@@ -22,6 +22,12 @@
 #include <libavutil/opt.h>
 #include <libavutil/samplefmt.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 /* 检测该编码器是否支持该采样格式 */
 static int check_sample_fmt(const AVCodec *codec,
                             enum AVSampleFormat sample_fmt) {
@@ -179,11 +185,28 @@ static int encode(AVCodecContext *ctx, AVFrame *frame, AVPacket *pkt,
 
 /*
  * 这里只支持2通道的转换
+ * 和12_mp4muxer/sampleconvert.cpp的F32ToFltp是同一个实现: SSE2每次4个采样点,
+ * NEON用vld2q直接分离左右声道, 剩余的采样点逐个处理
  */
 void f32le_convert_to_fltp(float *f32le, float *fltp, int nb_samples) {
   float *fltp_l = fltp;              // 左通道
   float *fltp_r = fltp + nb_samples; // 右通道
-  for (int i = 0; i < nb_samples; i++) {
+  int i = 0;
+#if defined(__SSE2__)
+  for (; i + 4 <= nb_samples; i += 4) {
+    __m128 a = _mm_loadu_ps(f32le + i * 2);     // L0 R0 L1 R1
+    __m128 b = _mm_loadu_ps(f32le + i * 2 + 4); // L2 R2 L3 R3
+    _mm_storeu_ps(fltp_l + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(fltp_r + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 4 <= nb_samples; i += 4) {
+    float32x4x2_t lr = vld2q_f32(f32le + i * 2);
+    vst1q_f32(fltp_l + i, lr.val[0]);
+    vst1q_f32(fltp_r + i, lr.val[1]);
+  }
+#endif
+  for (; i < nb_samples; i++) {
     fltp_l[i] = f32le[i * 2];     // 0 1   - 2 3
     fltp_r[i] = f32le[i * 2 + 1]; // 可以尝试注释左声道或者右声道听听声音
   }
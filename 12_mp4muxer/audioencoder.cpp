@@ -18,12 +18,46 @@ int AudioEncoder::InitAAC(int channels, int sample_rate, int bit_rate)
     sample_rate_ = sample_rate;
     bit_rate_ = bit_rate;
 
-    AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
-    if(!codec) {
+    codec_ = avcodec_find_encoder(AV_CODEC_ID_AAC);
+    if(!codec_) {
         printf("avcodec_find_encoder AV_CODEC_ID_AAC failed\n");
         return -1;
     }
-    codec_ctx_ = avcodec_alloc_context3(codec);
+    if(CreateContext() < 0) {
+        return -1;
+    }
+    printf("InitAAC success\n");
+    return 0;
+}
+
+int AudioEncoder::Reset()
+{
+    if(!codec_ctx_) {
+        printf("codec_ctx_ null\n");
+        return -1;
+    }
+#ifdef AV_CODEC_CAP_ENCODER_FLUSH
+    if(codec_ctx_->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH) {
+        avcodec_flush_buffers(codec_ctx_);
+        return 0;
+    }
+#endif
+    return Reopen() < 0 ? -1 : 1;
+}
+
+int AudioEncoder::Reopen()
+{
+    if(!codec_) {
+        printf("encoder not init\n");
+        return -1;
+    }
+    avcodec_free_context(&codec_ctx_);
+    return CreateContext();
+}
+
+int AudioEncoder::CreateContext()
+{
+    codec_ctx_ = avcodec_alloc_context3(codec_);
     if(!codec_ctx_) {
         printf("avcodec_alloc_context3 AV_CODEC_ID_AAC failed\n");
         return -1;
@@ -33,6 +67,7 @@ int AudioEncoder::InitAAC(int channels, int sample_rate, int bit_rate)
     codec_ctx_->bit_rate = bit_rate_;
     codec_ctx_->sample_rate = sample_rate_;
     codec_ctx_->sample_fmt = AV_SAMPLE_FMT_FLTP;
+    codec_ctx_->time_base = {1, sample_rate_};   // 以采样点为单位
     codec_ctx_->channels = channels_;
     codec_ctx_->channel_layout = av_get_default_channel_layout(codec_ctx_->channels);
 
@@ -43,7 +78,6 @@ int AudioEncoder::InitAAC(int channels, int sample_rate, int bit_rate)
         printf("avcodec_open2 failed:%s\n", errbuf);
         return -1;
     }
-    printf("InitAAC success\n");
     return 0;
 }
 
@@ -53,6 +87,7 @@ void AudioEncoder::DeInit()
         avcodec_free_context(&codec_ctx_);  // codec_ctx_被设置为NULL
 //        codec_ctx_ = NULL;  // 不需要再写
     }
+    codec_ = NULL;
 }
 
 AVPacket *AudioEncoder::Encode(AVFrame *frame, int stream_index, int64_t pts, int64_t time_base)
@@ -61,7 +96,7 @@ AVPacket *AudioEncoder::Encode(AVFrame *frame, int stream_index, int64_t pts, in
         printf("codec_ctx_ null\n");
         return NULL;
     }
-    pts = av_rescale_q(pts, AVRational{1, (int)time_base}, codec_ctx_->time_base);
+    pts = RescalePts(pts, time_base);
     if(frame) {
         frame->pts = pts;
     }
@@ -72,13 +107,13 @@ AVPacket *AudioEncoder::Encode(AVFrame *frame, int stream_index, int64_t pts, in
         printf("avcodec_send_frame failed:%s\n", errbuf);
         return NULL;
     }
-    AVPacket *packet = av_packet_alloc();
+    AVPacket *packet = AllocPacket(packet_pool_);
     ret = avcodec_receive_packet(codec_ctx_, packet);
     if(ret != 0) {
         char errbuf[1024] = {0};
         av_strerror(ret, errbuf, sizeof(errbuf) - 1);
         printf("aac avcodec_receive_packet failed:%s\n", errbuf);
-        av_packet_free(&packet);
+        FreePacket(packet_pool_, &packet);
         return NULL;
     }
     packet->stream_index = stream_index;
@@ -92,7 +127,7 @@ int AudioEncoder::Encode(AVFrame *frame, int stream_index, int64_t pts, int64_t
         printf("codec_ctx_ null\n");
         return NULL;
     }
-    pts = av_rescale_q(pts, AVRational{1, (int)time_base}, codec_ctx_->time_base);
+    pts = RescalePts(pts, time_base);
     if(frame) {
         frame->pts = pts;
     }
@@ -105,19 +140,20 @@ int AudioEncoder::Encode(AVFrame *frame, int stream_index, int64_t pts, int64_t
     }
     while(1)
     {
-        AVPacket *packet = av_packet_alloc();
+        AVPacket *packet = AllocPacket(packet_pool_);
         ret = avcodec_receive_packet(codec_ctx_, packet);
         packet->stream_index = stream_index;
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
             ret = 0;
-            av_packet_free(&packet);
+            FreePacket(packet_pool_, &packet);
             break;
         } else if (ret < 0) {
             char errbuf[1024] = {0};
             av_strerror(ret, errbuf, sizeof(errbuf) - 1);
             printf("aac avcodec_receive_packet failed:%s\n", errbuf);
-            av_packet_free(&packet);
+            FreePacket(packet_pool_, &packet);
             ret = -1;
+            break;
         }
         packets.push_back(packet);
     }
@@ -160,3 +196,16 @@ int AudioEncoder::GetSampleRate()
 
     return -1;
 }
+
+void AudioEncoder::SetPacketPool(PacketPool *pool)
+{
+    packet_pool_ = pool;
+}
+
+int64_t AudioEncoder::RescalePts(int64_t pts, int64_t time_base)
+{
+    // 调用者已经按编码器的time_base计算好pts时不需要再转换
+    if(codec_ctx_->time_base.num == 1 && codec_ctx_->time_base.den == time_base)
+        return pts;
+    return av_rescale_q(pts, AVRational{1, (int)time_base}, codec_ctx_->time_base);
+}
@@ -1,6 +1,7 @@
 #ifndef AUDIOENCODER_H
 #define AUDIOENCODER_H
 #include <vector>
+#include "packetpool.h"
 extern "C"
 {
 #include "libavformat/avformat.h"
@@ -13,19 +14,32 @@ public:
     int InitAAC(int channels, int sample_rate, int bit_rate);
 //    int InitMP3(/*int channels, int sample_rate, int bit_rate*/);
     void DeInit();  // 释放资源
+    // 冲刷后用相同的参数开始新的输出, 编码器不支持AV_CODEC_CAP_ENCODER_FLUSH时Reopen
+    // 原地冲刷返回0, 重新打开了codec context返回1, 失败返回<0
+    int Reset();
+    // 不重新查找编码器, 重新创建并打开codec context, 之后需要重新GetCodecContext
+    int Reopen();
     AVPacket *Encode(AVFrame *frame, int stream_index, int64_t pts, int64_t time_base);
     int Encode(AVFrame *farme, int stream_index, int64_t pts, int64_t time_base,
                std::vector<AVPacket *> &packets);
     int GetFrameSize(); // 获取一帧数据 每个通道需要多少个采样点
     int GetSampleFormat();  // 编码器需要的采样格式
     AVCodecContext *GetCodecContext();
+    // 设置后packet从对象池分配/回收, 不设置则直接av_packet_alloc/av_packet_free
+    void SetPacketPool(PacketPool *pool);
     int GetChannels();
     int GetSampleRate();
 private:
+    // pts从{1, time_base}转换到编码器的time_base
+    int64_t RescalePts(int64_t pts, int64_t time_base);
+    // 按保存的参数分配codec context并打开
+    int CreateContext();
+    PacketPool *packet_pool_ = NULL;
     int channels_ = 2;
     int sample_rate_ = 44100;
     int bit_rate_ = 128*1024;
     int64_t pts_ = 0;
+    AVCodec *codec_ = NULL;
     AVCodecContext * codec_ctx_ = NULL;
 };
 
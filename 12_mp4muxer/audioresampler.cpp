@@ -7,9 +7,7 @@ AudioResampler::AudioResampler()
 
 AudioResampler::~AudioResampler()
 {
-    if(ctx_) {
-        DeInit();
-    }
+    DeInit();
 }
 
 int AudioResampler::InitFromS16ToFLTP(int in_channels, int in_sample_rate, int out_channels, int out_sample_rate)
@@ -19,6 +17,16 @@ int AudioResampler::InitFromS16ToFLTP(int in_channels, int in_sample_rate, int o
     out_channels_ = out_channels;
     out_sample_rate_ = out_sample_rate;
 
+    convert_ = NULL;
+    if(fast_path_ && in_channels_ == out_channels_ && in_sample_rate_ == out_sample_rate_) {
+        simd_level_ = GetBestSimdLevel();
+        convert_ = GetS16ToFltpFunc(simd_level_);
+        if(convert_) {
+            printf("s16 to fltp use %s\n", GetSimdName(simd_level_));
+            return 0;
+        }
+    }
+
     ctx_ = swr_alloc_set_opts(ctx_,
                               av_get_default_channel_layout(out_channels_),
                               AV_SAMPLE_FMT_FLTP,
@@ -44,6 +52,10 @@ int AudioResampler::InitFromS16ToFLTP(int in_channels, int in_sample_rate, int o
 
 int AudioResampler::ResampleFromS16ToFLTP(uint8_t *in_data, AVFrame *out_frame)
 {
+    if(convert_) {
+        convert_((const int16_t *)in_data, (float **)out_frame->data, out_channels_, out_frame->nb_samples);
+        return out_frame->nb_samples;
+    }
     const uint8_t *indata[AV_NUM_DATA_POINTERS] = {0};
     indata[0] = in_data;
     int samples = swr_convert(ctx_, out_frame->data, out_frame->nb_samples,
@@ -59,6 +71,156 @@ void AudioResampler::DeInit()
     if(ctx_) {
         swr_free(&ctx_);
     }
+    convert_ = NULL;
+    if(fifo_) {
+        av_audio_fifo_free(fifo_);
+        fifo_ = NULL;
+    }
+    if(convert_data_) {
+        av_freep(&convert_data_[0]);
+        av_freep(&convert_data_);
+    }
+    convert_capacity_ = 0;
+    frame_size_ = 0;
+    flushed_ = 0;
+}
+
+int AudioResampler::InitStream(int in_channels, int in_sample_rate, int out_channels, int out_sample_rate,
+                               int frame_size)
+{
+    if(frame_size <= 0) {
+        printf("invalid frame_size:%d\n", frame_size);
+        return -1;
+    }
+    if(InitFromS16ToFLTP(in_channels, in_sample_rate, out_channels, out_sample_rate) < 0) {
+        return -1;
+    }
+    frame_size_ = frame_size;
+    flushed_ = 0;
+    fifo_ = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, out_channels_, frame_size_ * 2);
+    if(!fifo_) {
+        printf("av_audio_fifo_alloc failed\n");
+        return -1;
+    }
+    printf("resample stream %dHz %dch -> %dHz %dch, frame_size:%d, path:%s\n",
+           in_sample_rate_, in_channels_, out_sample_rate_, out_channels_, frame_size_, GetPathName());
+    return 0;
+}
+
+int AudioResampler::SendS16(const uint8_t *in_data, int nb_samples)
+{
+    if(!fifo_) {
+        printf("resample stream not init\n");
+        return -1;
+    }
+    if(flushed_) {
+        printf("resample stream already flushed\n");
+        return -1;
+    }
+    int samples = 0;
+    if(convert_) {
+        // 采样率相同, 没有延迟, 直接转换
+        if(!in_data) {
+            flushed_ = 1;
+            return 0;
+        }
+        if(EnsureConvertBuffer(nb_samples) < 0)
+            return -1;
+        convert_((const int16_t *)in_data, (float **)convert_data_, out_channels_, nb_samples);
+        samples = nb_samples;
+    } else {
+        // 输出数量要加上swr内部缓存的延迟, 否则多出来的数据留在swr里, 越积越多
+        int64_t out_samples = 0;
+        if(in_data) {
+            int64_t delay = swr_get_delay(ctx_, in_sample_rate_);
+            out_samples = av_rescale_rnd(delay + nb_samples, out_sample_rate_, in_sample_rate_, AV_ROUND_UP);
+        } else {
+            out_samples = swr_get_out_samples(ctx_, 0);
+        }
+        if(out_samples > 0 && EnsureConvertBuffer((int)out_samples) < 0)
+            return -1;
+        const uint8_t *indata[AV_NUM_DATA_POINTERS] = {0};
+        indata[0] = in_data;
+        samples = swr_convert(ctx_, convert_data_, (int)out_samples,
+                              in_data ? indata : NULL, in_data ? nb_samples : 0);
+        if(samples < 0) {
+            char errbuf[1024] = {0};
+            av_strerror(samples, errbuf, sizeof(errbuf) - 1);
+            printf("swr_convert failed:%s\n", errbuf);
+            return -1;
+        }
+        if(!in_data)
+            flushed_ = 1;
+    }
+    if(samples > 0 && av_audio_fifo_write(fifo_, (void **)convert_data_, samples) < samples) {
+        printf("av_audio_fifo_write %d samples failed\n", samples);
+        return -1;
+    }
+    return samples;
+}
+
+int AudioResampler::ReceiveFrame(AVFrame *out_frame)
+{
+    if(!fifo_) {
+        printf("resample stream not init\n");
+        return -1;
+    }
+    int available = av_audio_fifo_size(fifo_);
+    if(available < frame_size_ && !(flushed_ && available > 0)) {
+        return 0;
+    }
+    int samples = available < frame_size_ ? available : frame_size_;
+    if(av_audio_fifo_read(fifo_, (void **)out_frame->data, samples) < samples) {
+        printf("av_audio_fifo_read %d samples failed\n", samples);
+        return -1;
+    }
+    out_frame->nb_samples = samples;
+    return 1;
+}
+
+int AudioResampler::GetFifoSamples()
+{
+    return fifo_ ? av_audio_fifo_size(fifo_) : 0;
+}
+
+int64_t AudioResampler::GetDelay()
+{
+    int64_t delay = GetFifoSamples();
+    if(ctx_)
+        delay += swr_get_delay(ctx_, out_sample_rate_);
+    return delay;
+}
+
+int AudioResampler::EnsureConvertBuffer(int nb_samples)
+{
+    if(nb_samples <= convert_capacity_)
+        return 0;
+    if(convert_data_) {
+        av_freep(&convert_data_[0]);
+        av_freep(&convert_data_);
+    }
+    convert_capacity_ = 0;
+    int ret = av_samples_alloc_array_and_samples(&convert_data_, &convert_linesize_, out_channels_,
+                                                 nb_samples, AV_SAMPLE_FMT_FLTP, 0);
+    if(ret < 0) {
+        char errbuf[1024] = {0};
+        av_strerror(ret, errbuf, sizeof(errbuf) - 1);
+        printf("av_samples_alloc_array_and_samples failed:%s\n", errbuf);
+        convert_data_ = NULL;
+        return -1;
+    }
+    convert_capacity_ = nb_samples;
+    return 0;
+}
+
+void AudioResampler::SetFastPath(int enable)
+{
+    fast_path_ = enable;
+}
+
+const char *AudioResampler::GetPathName()
+{
+    return convert_ ? GetSimdName(simd_level_) : "swr";
 }
 
 AVFrame *AllocFltpPcmFrame(int channels, int nb_samples)
@@ -5,7 +5,9 @@ extern "C"
 #include "libavcodec/avcodec.h"
 #include "libswresample/swresample.h"
 #include "libavformat/avformat.h"
+#include "libavutil/audio_fifo.h"
 }
+#include "sampleconvert.h"
 
 AVFrame *AllocFltpPcmFrame(int channels, int nb_samples);
 void FreePcmFrame(AVFrame *frame);
@@ -15,15 +17,47 @@ class AudioResampler
 public:
     AudioResampler();
     ~AudioResampler();
+    // 采样率和通道数相同时只需要转换格式和分离声道, 使用sampleconvert里的SIMD实现, 不创建swr
     int InitFromS16ToFLTP(int in_channels, int in_sample_rate, int out_channels, int out_sample_rate);
+    // 输入和输出的采样点数都是out_frame->nb_samples, 只适用于输入输出采样率相同的情况
     int ResampleFromS16ToFLTP(uint8_t *in_data, AVFrame *out_frame);
     void DeInit();
+
+    // 流式重采样: 输入任意采样点数的s16交错数据, 输出固定frame_size采样点的fltp帧
+    // 重采样的结果先进入fifo, 按swr_get_delay计算每次的输出数量, swr内部缓存的数据不会丢失
+    int InitStream(int in_channels, int in_sample_rate, int out_channels, int out_sample_rate,
+                   int frame_size);
+    // in_data为NULL表示输入结束, 冲刷swr内部剩余的数据; 返回写入fifo的采样点数
+    int SendS16(const uint8_t *in_data, int nb_samples);
+    // 1: out_frame得到frame_size个采样点(输入结束后最后一帧可能不满), 0: 需要更多输入, <0: 失败
+    // out_frame至少要能容纳frame_size个采样点
+    int ReceiveFrame(AVFrame *out_frame);
+    // fifo中的采样点数
+    int GetFifoSamples();
+    // 已经输入但还没有ReceiveFrame取走的数据, 单位为输出采样点
+    int64_t GetDelay();
+    // 需要在Init之前调用, enable为0时总是使用swr(用于对比测试)
+    void SetFastPath(int enable);
+    // 当前使用的转换实现: "swr"或者SIMD的名称
+    const char *GetPathName();
 private:
+    // 保证转换缓冲区至少能放nb_samples个输出采样点
+    int EnsureConvertBuffer(int nb_samples);
+    int fast_path_ = 1;
+    S16ToFltpFunc convert_ = NULL;
+    int simd_level_ = SIMD_C;
     int in_channels_;
     int in_sample_rate_;
     int out_channels_;
     int out_sample_rate_;
     SwrContext *ctx_ = NULL;
+    // 流式接口
+    AVAudioFifo *fifo_ = NULL;
+    int frame_size_ = 0;
+    int flushed_ = 0;
+    uint8_t **convert_data_ = NULL;
+    int convert_linesize_ = 0;
+    int convert_capacity_ = 0;
 };
 
 #endif // AUDIORESAMPLER_H
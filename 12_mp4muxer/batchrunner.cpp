@@ -0,0 +1,321 @@
+#include "batchrunner.h"
+#include "muxer.h"
+#include "yuvmmapreader.h"
+#include "streamclock.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <sys/stat.h>
+extern "C"
+{
+#include "libavutil/time.h"
+}
+
+// 每种参数的空闲编码器最多和工作线程数一样多, 不需要再限制
+BatchRunner::BatchRunner()
+    : encoder_cache_(256)
+{
+
+}
+
+BatchRunner::~BatchRunner()
+{
+
+}
+
+int BatchRunner::LoadManifest(const char *manifest_name, const Job &defaults)
+{
+    FILE *fp = fopen(manifest_name, "r");
+    if(!fp) {
+        printf("Failed to open %s file\n", manifest_name);
+        return -1;
+    }
+    char line[4096] = {0};
+    int line_no = 0;
+    int ret = 0;
+    while(fgets(line, sizeof(line), fp)) {
+        line_no++;
+        char *fields[16] = {0};
+        int count = 0;
+        for(char *token = strtok(line, " \t\r\n"); token && count < 16; token = strtok(NULL, " \t\r\n")) {
+            fields[count++] = token;
+        }
+        if(count == 0 || fields[0][0] == '#')
+            continue;
+        if(count < 3) {
+            printf("%s:%d need yuv pcm out\n", manifest_name, line_no);
+            ret = -1;
+            continue;
+        }
+        Job job = defaults;
+        job.yuv_name = fields[0];
+        job.pcm_name = fields[1];
+        job.out_name = fields[2];
+        for(int i = 3; i < count; i++) {
+            int value = 0;
+            if(sscanf(fields[i], "%dx%d", &job.width, &job.height) == 2) {
+            } else if(sscanf(fields[i], "fps=%d", &value) == 1) {
+                job.fps = value;
+            } else if(sscanf(fields[i], "vbr=%d", &value) == 1) {
+                job.video_bit_rate = value * 1000;
+            } else if(sscanf(fields[i], "ar=%d", &value) == 1) {
+                job.pcm_sample_rate = value;
+            } else if(sscanf(fields[i], "ac=%d", &value) == 1) {
+                job.pcm_channels = value;
+            } else if(sscanf(fields[i], "abr=%d", &value) == 1) {
+                job.audio_bit_rate = value * 1000;
+            } else {
+                printf("%s:%d unknown param:%s\n", manifest_name, line_no, fields[i]);
+                ret = -1;
+            }
+        }
+        if(job.width <= 0 || job.height <= 0 || job.fps <= 0 || job.pcm_channels <= 0
+                || job.pcm_sample_rate <= 0) {
+            printf("%s:%d invalid params\n", manifest_name, line_no);
+            ret = -1;
+            continue;
+        }
+        jobs_.push_back(job);
+    }
+    fclose(fp);
+    printf("load %d jobs from %s\n", (int)jobs_.size(), manifest_name);
+    return ret;
+}
+
+void BatchRunner::AddJob(const Job &job)
+{
+    jobs_.push_back(job);
+}
+
+int BatchRunner::Run(int workers)
+{
+    int cpus = (int)std::thread::hardware_concurrency();
+    if(cpus <= 0)
+        cpus = 1;
+    if(workers <= 0)
+        workers = cpus;
+    if(workers > (int)jobs_.size())
+        workers = (int)jobs_.size();
+    results_.assign(jobs_.size(), Result());
+    next_job_ = 0;
+    if(workers <= 0) {
+        printf("no batch job\n");
+        return 0;
+    }
+    // 多个编码器同时运行, 每个编码器只分到一部分核, 避免线程数远超核数
+    int encoder_threads = cpus / workers > 0 ? cpus / workers : 1;
+    printf("batch %d jobs, %d workers, %d encoder threads each\n",
+           (int)jobs_.size(), workers, encoder_threads);
+
+    int64_t begin = av_gettime_relative();
+    std::vector<Worker *> pool;
+    std::vector<std::thread> threads;
+    for(int i = 0; i < workers; i++) {
+        Worker *worker = new Worker();
+        worker->id = i;
+        worker->encoder_threads = encoder_threads;
+        pool.push_back(worker);
+        threads.push_back(std::thread(&BatchRunner::WorkerLoop, this, worker));
+    }
+    for(size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+        delete pool[i];
+    }
+    elapsed_ms_ = (av_gettime_relative() - begin) / 1000.0;
+
+    int ret = 0;
+    for(size_t i = 0; i < results_.size(); i++) {
+        if(results_[i].ret < 0)
+            ret = -1;
+    }
+    return ret;
+}
+
+const std::vector<BatchRunner::Job> &BatchRunner::GetJobs()
+{
+    return jobs_;
+}
+
+const std::vector<BatchRunner::Result> &BatchRunner::GetResults()
+{
+    return results_;
+}
+
+double BatchRunner::GetElapsedMs()
+{
+    return elapsed_ms_;
+}
+
+void BatchRunner::WorkerLoop(Worker *worker)
+{
+    while(1) {
+        size_t index = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(next_job_ >= jobs_.size())
+                break;
+            index = next_job_++;
+        }
+        Result result;
+        result.worker = worker->id;
+        int64_t begin = av_gettime_relative();
+        result.ret = RunJob(worker, jobs_[index], result);
+        ReleaseEncoders(worker);
+        result.elapsed_ms = (av_gettime_relative() - begin) / 1000.0;
+        // results_已经按任务数分配好, 每个下标只有一个线程写
+        results_[index] = result;
+        if(result.ret < 0)
+            printf("batch job %d %s failed\n", (int)index, jobs_[index].out_name.c_str());
+    }
+    worker->audio_resampler.DeInit();
+    worker->fltp_frame_pool.DeInit();
+}
+
+int BatchRunner::PrepareEncoders(Worker *worker, const Job &job, Result &result)
+{
+    VideoThreadConfig thread_config;
+    thread_config.thread_count = worker->encoder_threads;
+    worker->video_encoder = encoder_cache_.GetVideo(job.width, job.height, job.fps, job.video_bit_rate,
+                                                    thread_config, &result.video_reused);
+    if(!worker->video_encoder) {
+        printf("get video encoder %dx%d failed\n", job.width, job.height);
+        return -1;
+    }
+    worker->video_encoder->SetPacketPool(&worker->packet_pool);
+    worker->audio_encoder = encoder_cache_.GetAudio(job.pcm_channels, job.pcm_sample_rate,
+                                                    job.audio_bit_rate, &result.audio_reused);
+    if(!worker->audio_encoder) {
+        printf("get audio encoder failed\n");
+        return -1;
+    }
+    worker->audio_encoder->SetPacketPool(&worker->packet_pool);
+    if(!worker->audio_ready || !SameAudioParams(worker->audio_params, job)) {
+        worker->audio_ready = 0;
+        worker->audio_resampler.DeInit();
+        worker->fltp_frame_pool.DeInit();
+        if(worker->fltp_frame_pool.InitAudio(AV_SAMPLE_FMT_FLTP, worker->audio_encoder->GetChannels(),
+                                             worker->audio_encoder->GetFrameSize()) < 0
+                || worker->audio_resampler.InitFromS16ToFLTP(job.pcm_channels, job.pcm_sample_rate,
+                                                             worker->audio_encoder->GetChannels(),
+                                                             worker->audio_encoder->GetSampleRate()) < 0) {
+            printf("init audio resampler failed\n");
+            return -1;
+        }
+        worker->audio_params = job;
+        worker->audio_ready = 1;
+    }
+    return 0;
+}
+
+void BatchRunner::ReleaseEncoders(Worker *worker)
+{
+    encoder_cache_.ReleaseVideo(worker->video_encoder);
+    worker->video_encoder = NULL;
+    encoder_cache_.ReleaseAudio(worker->audio_encoder);
+    worker->audio_encoder = NULL;
+}
+
+int BatchRunner::RunJob(Worker *worker, const Job &job, Result &result)
+{
+    if(PrepareEncoders(worker, job, result) < 0)
+        return -1;
+    VideoEncoder &video_encoder = *worker->video_encoder;
+    AudioEncoder &audio_encoder = *worker->audio_encoder;
+
+    YuvMmapReader yuv_reader;
+    if(yuv_reader.Open(job.yuv_name.c_str(), job.width, job.height) < 0) {
+        printf("Failed to open %s file\n", job.yuv_name.c_str());
+        return -1;
+    }
+    FILE *in_pcm_fd = fopen(job.pcm_name.c_str(), "rb");
+    if(!in_pcm_fd) {
+        printf("Failed to open %s file\n", job.pcm_name.c_str());
+        return -1;
+    }
+    Muxer muxer;
+    muxer.SetPacketPool(&worker->packet_pool);
+    if(muxer.Init(job.out_name.c_str()) < 0
+            || muxer.AddStream(video_encoder.GetCodecContext()) < 0
+            || muxer.AddStream(audio_encoder.GetCodecContext()) < 0
+            || muxer.Open() < 0
+            || muxer.SendHeader() < 0) {
+        printf("init muxer %s failed\n", job.out_name.c_str());
+        muxer.DeInit();
+        fclose(in_pcm_fd);
+        return -1;
+    }
+
+    int frame_samples = audio_encoder.GetFrameSize();
+    int pcm_frame_size = av_get_bytes_per_sample(AV_SAMPLE_FMT_S16) * job.pcm_channels * frame_samples;
+    std::vector<uint8_t> pcm_frame_buf(pcm_frame_size);
+    AVFrame *yuv_frame = av_frame_alloc();
+    StreamClock audio_clock;
+    StreamClock video_clock;
+    audio_clock.Init(AVRational{1, audio_encoder.GetSampleRate()}, audio_encoder.GetCodecContext()->time_base);
+    video_clock.Init(AVRational{1, job.fps}, video_encoder.GetCodecContext()->time_base);
+
+    int ret = yuv_frame ? 0 : -1;
+    int audio_finish = 0;
+    int video_finish = 0;
+    int first_video_packet = 1;
+    std::vector<AVPacket *> packets;
+    while(yuv_frame && (!audio_finish || !video_finish)) {
+        if(!video_finish && (audio_finish || av_compare_ts(audio_clock.GetPts(), audio_clock.GetTimeBase(),
+                                                           video_clock.GetPts(), video_clock.GetTimeBase()) > 0)) {
+            AVFrame *frame = NULL;
+            if(yuv_reader.ReadFrame(yuv_frame) < 0) {
+                video_finish = 1;
+            } else {
+                frame = yuv_frame;
+                result.frames++;
+            }
+            ret |= video_encoder.Encode(frame, muxer.GetVideoStreamIndex(), video_clock.GetPts(),
+                                        video_clock.GetTimeBase().den, packets);
+            av_frame_unref(yuv_frame);
+            video_clock.Advance(1);
+        } else {
+            AVFrame *fltp_frame = NULL;
+            if(fread(pcm_frame_buf.data(), 1, pcm_frame_size, in_pcm_fd) < (size_t)pcm_frame_size) {
+                audio_finish = 1;
+            } else {
+                fltp_frame = worker->fltp_frame_pool.Get();
+                if(!fltp_frame || worker->audio_resampler.ResampleFromS16ToFLTP(pcm_frame_buf.data(), fltp_frame) < 0)
+                    printf("ResampleFromS16ToFLTP error\n");
+            }
+            ret |= audio_encoder.Encode(fltp_frame, muxer.GetAudioStreamIndex(), audio_clock.GetPts(),
+                                        audio_clock.GetTimeBase().den, packets);
+            worker->fltp_frame_pool.Release(fltp_frame);
+            audio_clock.Advance(frame_samples);
+        }
+        for(size_t i = 0; i < packets.size(); i++) {
+            if(first_video_packet && packets[i]->stream_index == muxer.GetVideoStreamIndex()) {
+                // 复用的编码器没有回到GOP开头时, 文件开头的帧会参考上一个任务的帧, 无法解码
+                first_video_packet = 0;
+                if(!(packets[i]->flags & AV_PKT_FLAG_KEY)) {
+                    printf("%s first video packet is not a key frame, encoder reused:%d\n",
+                           job.out_name.c_str(), result.video_reused);
+                    ret = -1;
+                }
+            }
+            ret |= muxer.SendPacket(packets[i]);
+        }
+        packets.clear();
+    }
+    ret |= muxer.SendTrailer();
+    ret |= muxer.DeInit();
+    av_frame_free(&yuv_frame);
+    fclose(in_pcm_fd);
+
+    struct stat st;
+    if(stat(job.out_name.c_str(), &st) == 0)
+        result.out_bytes = st.st_size;
+    return ret < 0 ? -1 : 0;
+}
+
+int BatchRunner::SameAudioParams(const Job &a, const Job &b)
+{
+    return a.pcm_channels == b.pcm_channels && a.pcm_sample_rate == b.pcm_sample_rate
+            && a.audio_bit_rate == b.audio_bit_rate;
+}
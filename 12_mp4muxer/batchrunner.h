@@ -0,0 +1,84 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+#include <string>
+#include <vector>
+#include <mutex>
+#include "audioencoder.h"
+#include "audioresampler.h"
+#include "videoencoder.h"
+#include "encodercache.h"
+#include "packetpool.h"
+#include "framepool.h"
+
+// 批量编码: 从清单读取(yuv, pcm, 输出mp4, 参数)任务, 固定数量的工作线程依次领取任务,
+// 编码器从共用的EncoderCache取出, 参数相同时直接复用已经打开的编码器; 每个线程持有自己的重采样/对象池,
+// 避免每个文件都启动进程、重新初始化
+class BatchRunner
+{
+public:
+    struct Job
+    {
+        std::string yuv_name;
+        std::string pcm_name;
+        std::string out_name;
+        int width = 720;
+        int height = 576;
+        int fps = 25;
+        int video_bit_rate = 500 * 1024;
+        int pcm_channels = 2;
+        int pcm_sample_rate = 44100;
+        int audio_bit_rate = 128 * 1024;
+    };
+    struct Result
+    {
+        int ret = -1;
+        int worker = -1;
+        int frames = 0;             // 编码的视频帧数
+        int64_t out_bytes = 0;
+        double elapsed_ms = 0;
+        int video_reused = 0;       // 1: 视频编码器来自缓存, 并且没有重新打开codec context
+        int audio_reused = 0;
+    };
+    BatchRunner();
+    ~BatchRunner();
+    // 每行一个任务: in.yuv in.pcm out.mp4 [WxH] [fps=N] [vbr=kbps] [ar=Hz] [ac=N] [abr=kbps]
+    // 空行和#开头的行忽略, 没有指定的参数取defaults
+    int LoadManifest(const char *manifest_name, const Job &defaults);
+    void AddJob(const Job &job);
+    // workers为0时使用cpu核数, 每个编码器的线程数按核数平分; 有任务失败时返回<0
+    int Run(int workers = 0);
+    const std::vector<Job> &GetJobs();
+    const std::vector<Result> &GetResults();
+    // 所有任务的墙上时间
+    double GetElapsedMs();
+private:
+    // 每个工作线程独占, 任务之间保留
+    struct Worker
+    {
+        int id = 0;
+        int encoder_threads = 0;
+        VideoEncoder *video_encoder = NULL;     // 当前任务从缓存取出的编码器
+        AudioEncoder *audio_encoder = NULL;
+        AudioResampler audio_resampler;
+        PacketPool packet_pool;
+        FramePool fltp_frame_pool;
+        Job audio_params;           // 重采样和帧池对应的参数
+        int audio_ready = 0;
+    };
+    void WorkerLoop(Worker *worker);
+    // 从缓存取出编码器, 音频参数和上一个任务相同时复用重采样和帧池
+    int PrepareEncoders(Worker *worker, const Job &job, Result &result);
+    // 编码器放回缓存
+    void ReleaseEncoders(Worker *worker);
+    int RunJob(Worker *worker, const Job &job, Result &result);
+    static int SameAudioParams(const Job &a, const Job &b);
+
+    std::vector<Job> jobs_;
+    std::vector<Result> results_;
+    EncoderCache encoder_cache_;
+    std::mutex mutex_;
+    size_t next_job_ = 0;
+    double elapsed_ms_ = 0;
+};
+
+#endif // BATCHRUNNER_H
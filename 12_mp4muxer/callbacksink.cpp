@@ -0,0 +1,56 @@
+#include "callbacksink.h"
+#include <stdio.h>
+extern "C"
+{
+#include "libavformat/avio.h"
+}
+
+CallbackSink::CallbackSink(WriteCallback write_cb, CloseCallback close_cb, void *opaque)
+    : write_cb_(write_cb), close_cb_(close_cb), opaque_(opaque)
+{
+
+}
+
+int CallbackSink::Write(const uint8_t *data, int size)
+{
+    if(!write_cb_ || closed_)
+        return -1;
+    if(write_cb_(opaque_, pos_, data, size) < 0) {
+        printf("sink write callback failed at %lld\n", (long long)pos_);
+        return -1;
+    }
+    pos_ += size;
+    if(pos_ > size_)
+        size_ = pos_;
+    return size;
+}
+
+int64_t CallbackSink::Seek(int64_t offset, int whence)
+{
+    switch(whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return size_;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += pos_;
+        break;
+    case SEEK_END:
+        offset += size_;
+        break;
+    default:
+        return -1;
+    }
+    if(offset < 0)
+        return -1;
+    pos_ = offset;
+    return pos_;
+}
+
+int CallbackSink::Close()
+{
+    if(!closed_ && close_cb_)
+        close_cb_(opaque_, size_);
+    closed_ = 1;
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef CALLBACKSINK_H
+#define CALLBACKSINK_H
+#include <stddef.h>
+#include "outputsink.h"
+
+// 回调输出: 每次写入都带上文件内的偏移, 调用者按偏移保存即可,
+// seek回去修改的数据也通过同一个回调给出, 不需要调用者实现seek
+class CallbackSink : public OutputSink
+{
+public:
+    // 返回<0表示失败, 复用器会停止写入
+    typedef int (*WriteCallback)(void *opaque, int64_t offset, const uint8_t *data, int size);
+    // 输出结束时调用, 可以为NULL
+    typedef void (*CloseCallback)(void *opaque, int64_t size);
+
+    CallbackSink(WriteCallback write_cb, CloseCallback close_cb, void *opaque);
+    int Write(const uint8_t *data, int size) override;
+    int64_t Seek(int64_t offset, int whence) override;
+    int Close() override;
+private:
+    WriteCallback write_cb_ = NULL;
+    CloseCallback close_cb_ = NULL;
+    void *opaque_ = NULL;
+    int64_t pos_ = 0;
+    int64_t size_ = 0;
+    int closed_ = 0;
+};
+
+#endif // CALLBACKSINK_H
@@ -0,0 +1,184 @@
+#include "encodercache.h"
+#include <stdio.h>
+
+bool EncoderCache::VideoKey::operator<(const VideoKey &other) const
+{
+    if(width != other.width)
+        return width < other.width;
+    if(height != other.height)
+        return height < other.height;
+    if(fps != other.fps)
+        return fps < other.fps;
+    if(bit_rate != other.bit_rate)
+        return bit_rate < other.bit_rate;
+    if(thread_count != other.thread_count)
+        return thread_count < other.thread_count;
+    return thread_type < other.thread_type;
+}
+
+bool EncoderCache::AudioKey::operator<(const AudioKey &other) const
+{
+    if(channels != other.channels)
+        return channels < other.channels;
+    if(sample_rate != other.sample_rate)
+        return sample_rate < other.sample_rate;
+    return bit_rate < other.bit_rate;
+}
+
+EncoderCache::EncoderCache(int max_idle)
+    : max_idle_(max_idle)
+{
+
+}
+
+EncoderCache::~EncoderCache()
+{
+    Clear();
+}
+
+VideoEncoder *EncoderCache::GetVideo(int width, int height, int fps, int bit_rate,
+                                     const VideoThreadConfig &thread_config, int *reused)
+{
+    VideoKey key = {width, height, fps, bit_rate, thread_config.thread_count, thread_config.thread_type};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::multimap<VideoKey, IdleVideo>::iterator it = idle_video_.find(key);
+        if(it != idle_video_.end()) {
+            VideoEncoder *encoder = it->second.encoder;
+            if(reused)
+                *reused = !it->second.reopened;
+            idle_video_.erase(it);
+            busy_video_[encoder] = key;
+            hits_++;
+            return encoder;
+        }
+        misses_++;
+    }
+    // 编码器的初始化比较慢, 不在锁里做
+    VideoEncoder *encoder = new VideoEncoder();
+    encoder->SetThreadConfig(thread_config);
+    if(encoder->InitH264(width, height, fps, bit_rate) < 0) {
+        delete encoder;
+        return NULL;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    busy_video_[encoder] = key;
+    if(reused)
+        *reused = 0;
+    return encoder;
+}
+
+void EncoderCache::ReleaseVideo(VideoEncoder *encoder)
+{
+    if(!encoder)
+        return;
+    VideoKey key;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<VideoEncoder *, VideoKey>::iterator it = busy_video_.find(encoder);
+        if(it == busy_video_.end()) {
+            printf("video encoder %p not from cache\n", (void *)encoder);
+            return;
+        }
+        key = it->second;
+        busy_video_.erase(it);
+        if((int)idle_video_.count(key) >= max_idle_) {
+            delete encoder;
+            return;
+        }
+    }
+    // 放回之前就Reset, 取出时可以直接编码
+    encoder->SetPacketPool(NULL);
+    int ret = encoder->Reset();
+    if(ret < 0) {
+        printf("video encoder reset failed, drop it\n");
+        delete encoder;
+        return;
+    }
+    IdleVideo idle = {encoder, ret > 0};
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_video_.insert(std::make_pair(key, idle));
+}
+
+AudioEncoder *EncoderCache::GetAudio(int channels, int sample_rate, int bit_rate, int *reused)
+{
+    AudioKey key = {channels, sample_rate, bit_rate};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::multimap<AudioKey, IdleAudio>::iterator it = idle_audio_.find(key);
+        if(it != idle_audio_.end()) {
+            AudioEncoder *encoder = it->second.encoder;
+            if(reused)
+                *reused = !it->second.reopened;
+            idle_audio_.erase(it);
+            busy_audio_[encoder] = key;
+            hits_++;
+            return encoder;
+        }
+        misses_++;
+    }
+    AudioEncoder *encoder = new AudioEncoder();
+    if(encoder->InitAAC(channels, sample_rate, bit_rate) < 0) {
+        delete encoder;
+        return NULL;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    busy_audio_[encoder] = key;
+    if(reused)
+        *reused = 0;
+    return encoder;
+}
+
+void EncoderCache::ReleaseAudio(AudioEncoder *encoder)
+{
+    if(!encoder)
+        return;
+    AudioKey key;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<AudioEncoder *, AudioKey>::iterator it = busy_audio_.find(encoder);
+        if(it == busy_audio_.end()) {
+            printf("audio encoder %p not from cache\n", (void *)encoder);
+            return;
+        }
+        key = it->second;
+        busy_audio_.erase(it);
+        if((int)idle_audio_.count(key) >= max_idle_) {
+            delete encoder;
+            return;
+        }
+    }
+    encoder->SetPacketPool(NULL);
+    int ret = encoder->Reset();
+    if(ret < 0) {
+        printf("audio encoder reset failed, drop it\n");
+        delete encoder;
+        return;
+    }
+    IdleAudio idle = {encoder, ret > 0};
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_audio_.insert(std::make_pair(key, idle));
+}
+
+void EncoderCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(std::multimap<VideoKey, IdleVideo>::iterator it = idle_video_.begin(); it != idle_video_.end(); ++it)
+        delete it->second.encoder;
+    idle_video_.clear();
+    for(std::multimap<AudioKey, IdleAudio>::iterator it = idle_audio_.begin(); it != idle_audio_.end(); ++it)
+        delete it->second.encoder;
+    idle_audio_.clear();
+}
+
+int EncoderCache::GetHits()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+int EncoderCache::GetMisses()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
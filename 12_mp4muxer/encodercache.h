@@ -0,0 +1,70 @@
+#ifndef ENCODERCACHE_H
+#define ENCODERCACHE_H
+#include <vector>
+#include <map>
+#include <mutex>
+#include "videoencoder.h"
+#include "audioencoder.h"
+
+// 已经打开的编码器缓存, 按参数查找
+// 连续的短任务从缓存取出参数相同的编码器, 用完Release时Reset, 下一个任务不用再查找编码器、分配上下文
+// 编码器不支持原地冲刷时Reset会重新打开codec context, 这时只省掉了查找编码器和分配frame
+// 多个线程可以共用一个缓存, 取出的编码器只属于取出它的线程
+class EncoderCache
+{
+public:
+    // 每种参数最多缓存max_idle个空闲编码器
+    EncoderCache(int max_idle = 4);
+    ~EncoderCache();
+    // reused不为NULL时返回是否复用了已经打开的codec context(来自缓存且Reset时没有重新打开); 失败返回NULL
+    VideoEncoder *GetVideo(int width, int height, int fps, int bit_rate,
+                           const VideoThreadConfig &thread_config, int *reused = NULL);
+    // 编码器已经冲刷完(或者不再使用), Reset失败或者缓存满时直接释放
+    void ReleaseVideo(VideoEncoder *encoder);
+    AudioEncoder *GetAudio(int channels, int sample_rate, int bit_rate, int *reused = NULL);
+    void ReleaseAudio(AudioEncoder *encoder);
+    // 释放所有空闲的编码器, 取出还没放回的不受影响
+    void Clear();
+    // 从缓存取出的次数(包括Reset时重新打开过的)和新建的次数
+    int GetHits();
+    int GetMisses();
+private:
+    struct VideoKey
+    {
+        int width;
+        int height;
+        int fps;
+        int bit_rate;
+        int thread_count;
+        int thread_type;
+        bool operator<(const VideoKey &other) const;
+    };
+    struct AudioKey
+    {
+        int channels;
+        int sample_rate;
+        int bit_rate;
+        bool operator<(const AudioKey &other) const;
+    };
+    // 空闲的编码器, reopened为1表示Reset时重新打开了codec context
+    struct IdleVideo
+    {
+        VideoEncoder *encoder;
+        int reopened;
+    };
+    struct IdleAudio
+    {
+        AudioEncoder *encoder;
+        int reopened;
+    };
+    int max_idle_ = 4;
+    std::multimap<VideoKey, IdleVideo> idle_video_;
+    std::map<VideoEncoder *, VideoKey> busy_video_;
+    std::multimap<AudioKey, IdleAudio> idle_audio_;
+    std::map<AudioEncoder *, AudioKey> busy_audio_;
+    int hits_ = 0;
+    int misses_ = 0;
+    std::mutex mutex_;
+};
+
+#endif // ENCODERCACHE_H
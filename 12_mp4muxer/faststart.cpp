@@ -0,0 +1,207 @@
+#include "faststart.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <vector>
+
+#define ALIGN_SIZE 4096
+
+static uint32_t ReadU32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t ReadU64(const uint8_t *p)
+{
+    return ((uint64_t)ReadU32(p) << 32) | ReadU32(p + 4);
+}
+
+static void WriteU32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void WriteU64(uint8_t *p, uint64_t v)
+{
+    WriteU32(p, (uint32_t)(v >> 32));
+    WriteU32(p + 4, (uint32_t)v);
+}
+
+// 解析box头, 返回头长度, 失败返回0
+static int ParseBoxHeader(const uint8_t *p, uint64_t avail, uint64_t *box_size, uint32_t *type)
+{
+    if(avail < 8)
+        return 0;
+    uint64_t size = ReadU32(p);
+    *type = ReadU32(p + 4);
+    int header = 8;
+    if(size == 1) {
+        if(avail < 16)
+            return 0;
+        size = ReadU64(p + 8);
+        header = 16;
+    } else if(size == 0) {
+        size = avail;   // 一直到结尾
+    }
+    if(size < (uint64_t)header || size > avail)
+        return 0;
+    *box_size = size;
+    return header;
+}
+
+#define BOX_TYPE(a, b, c, d) (((uint32_t)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+// 递归修改moov中所有stco/co64的chunk偏移, 先检查溢出再修改, apply为0时只检查
+static int PatchChunkOffsets(uint8_t *data, uint64_t size, uint64_t shift, int apply)
+{
+    uint64_t pos = 0;
+    while(pos < size) {
+        uint64_t box_size = 0;
+        uint32_t type = 0;
+        int header = ParseBoxHeader(data + pos, size - pos, &box_size, &type);
+        if(header == 0)
+            return -1;
+        uint8_t *body = data + pos + header;
+        uint64_t body_size = box_size - header;
+        if(type == BOX_TYPE('t','r','a','k') || type == BOX_TYPE('m','d','i','a')
+                || type == BOX_TYPE('m','i','n','f') || type == BOX_TYPE('s','t','b','l')) {
+            if(PatchChunkOffsets(body, body_size, shift, apply) < 0)
+                return -1;
+        } else if(type == BOX_TYPE('s','t','c','o') || type == BOX_TYPE('c','o','6','4')) {
+            int entry_size = type == BOX_TYPE('s','t','c','o') ? 4 : 8;
+            if(body_size < 8)
+                return -1;
+            uint32_t count = ReadU32(body + 4);
+            if(8 + (uint64_t)count * entry_size > body_size)
+                return -1;
+            uint8_t *entry = body + 8;
+            for(uint32_t i = 0; i < count; i++, entry += entry_size) {
+                if(entry_size == 4) {
+                    uint64_t offset = ReadU32(entry) + shift;
+                    if(offset > 0xFFFFFFFFULL) {
+                        printf("stco offset overflow, need co64\n");
+                        return -1;
+                    }
+                    if(apply)
+                        WriteU32(entry, (uint32_t)offset);
+                } else if(apply) {
+                    WriteU64(entry, ReadU64(entry) + shift);
+                }
+            }
+        }
+        pos += box_size;
+    }
+    return 0;
+}
+
+int MoveMoovToFront(const char *file_name, size_t buffer_size)
+{
+    int fd = open(file_name, O_RDWR);
+    if(fd < 0) {
+        printf("open %s failed\n", file_name);
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    uint64_t file_size = st.st_size;
+
+    // 1. 找到顶层的第一个mdat和moov
+    uint64_t pos = 0;
+    uint64_t mdat_pos = 0, moov_pos = 0, moov_size = 0;
+    int has_mdat = 0, has_moov = 0;
+    while(pos + 8 <= file_size) {
+        uint8_t header[16];
+        ssize_t n = pread(fd, header, sizeof(header), pos);
+        if(n < 8)
+            break;
+        uint64_t box_size = 0;
+        uint32_t type = 0;
+        if(ParseBoxHeader(header, file_size - pos, &box_size, &type) == 0) {
+            printf("invalid box at %llu\n", (unsigned long long)pos);
+            close(fd);
+            return -1;
+        }
+        if(type == BOX_TYPE('m','d','a','t') && !has_mdat) {
+            mdat_pos = pos;
+            has_mdat = 1;
+        } else if(type == BOX_TYPE('m','o','o','v')) {
+            moov_pos = pos;
+            moov_size = box_size;
+            has_moov = 1;
+        }
+        pos += box_size;
+    }
+    if(!has_moov || !has_mdat) {
+        printf("%s has no moov or mdat\n", file_name);
+        close(fd);
+        return -1;
+    }
+    if(moov_pos < mdat_pos) {
+        close(fd);
+        return 1;   // 已经是faststart
+    }
+
+    // 2. 读出moov并修改chunk偏移, 所有mdat数据都会后移moov_size
+    std::vector<uint8_t> moov(moov_size);
+    if(pread(fd, moov.data(), moov_size, moov_pos) != (ssize_t)moov_size) {
+        printf("read moov failed\n");
+        close(fd);
+        return -1;
+    }
+    if(PatchChunkOffsets(moov.data() + 8, moov_size - 8, moov_size, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    PatchChunkOffsets(moov.data() + 8, moov_size - 8, moov_size, 1);
+
+    // 3. 从后往前把[mdat_pos, moov_pos)后移moov_size, 对齐的大块读写
+    buffer_size = (buffer_size + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE;
+    void *buffer = NULL;
+    if(posix_memalign(&buffer, ALIGN_SIZE, buffer_size) != 0) {
+        printf("posix_memalign %zu failed\n", buffer_size);
+        close(fd);
+        return -1;
+    }
+    posix_fadvise(fd, mdat_pos, moov_pos - mdat_pos, POSIX_FADV_SEQUENTIAL);
+    int ret = 0;
+    uint64_t end = moov_pos;
+    while(end > mdat_pos) {
+        // 第一次先处理不对齐的尾部, 之后每块的起始位置都对齐
+        uint64_t begin = end > buffer_size ? (end - buffer_size + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE : 0;
+        if(begin < mdat_pos)
+            begin = mdat_pos;
+        size_t len = end - begin;
+        if(pread(fd, buffer, len, begin) != (ssize_t)len
+                || pwrite(fd, buffer, len, begin + moov_size) != (ssize_t)len) {
+            printf("move mdat failed at %llu\n", (unsigned long long)begin);
+            ret = -2;   // 数据已经部分移动, 文件损坏
+            break;
+        }
+        end = begin;
+    }
+    free(buffer);
+    if(ret == 0 && pwrite(fd, moov.data(), moov_size, mdat_pos) != (ssize_t)moov_size) {
+        printf("write moov failed\n");
+        ret = -2;
+    }
+    close(fd);
+    return ret;
+}
+
+int64_t EstimateMoovSize(int64_t duration_us, double video_fps, double audio_frames_per_second)
+{
+    // 按每个sample最坏的情况估算: stsz 4 + stts 8 + ctts 8 + stsc 12 + co64 8 = 40字节,
+    // 再加上关键帧stss和固定的box开销, 多留25%余量; 预留不够时mov复用器写trailer会失败
+    double seconds = duration_us / 1000000.0;
+    double samples = seconds * (video_fps + audio_frames_per_second);
+    return (int64_t)((samples * 40 + seconds * 4 + 8192) * 1.25);
+}
@@ -0,0 +1,16 @@
+#ifndef FASTSTART_H
+#define FASTSTART_H
+#include <stddef.h>
+#include <stdint.h>
+
+// 把写在文件末尾的moov移到mdat前面, 在原文件上原地完成:
+// 只读一遍、写一遍mdat(从后往前按buffer_size大块搬移), 不需要再单独生成一个临时文件
+// 成功返回0; 文件不需要处理(moov已经在前面)返回1;
+// 开始搬移之前失败返回-1, 文件保持不变; 搬移过程中读写失败返回-2, 这时文件已经损坏
+// (进程在搬移过程中退出同样会留下损坏的文件), 需要用户保留原始输出时不要用这种方式
+int MoveMoovToFront(const char *file_name, size_t buffer_size = 8 * 1024 * 1024);
+
+// 按时长和帧率估算moov需要预留的空间, 用于mov复用器的moov_size选项
+int64_t EstimateMoovSize(int64_t duration_us, double video_fps, double audio_frames_per_second);
+
+#endif // FASTSTART_H
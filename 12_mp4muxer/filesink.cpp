@@ -0,0 +1,279 @@
+#include "filesink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+extern "C"
+{
+#include "libavformat/avio.h"
+}
+
+#define ALIGN_SIZE 4096
+
+FileSink::FileSink()
+{
+
+}
+
+FileSink::~FileSink()
+{
+    Close();
+}
+
+int FileSink::Open(const char *file_name, const FileSinkConfig &config)
+{
+    fd_ = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd_ < 0) {
+        printf("open %s failed:%s\n", file_name, strerror(errno));
+        return -1;
+    }
+    direct_fd_ = fd_;
+    if(config.direct) {
+#ifdef O_DIRECT
+        direct_fd_ = open(file_name, O_WRONLY | O_DIRECT);
+#else
+        direct_fd_ = -1;
+#endif
+        if(direct_fd_ < 0) {
+            // tmpfs等文件系统不支持O_DIRECT
+            printf("open %s with O_DIRECT failed, use buffered io\n", file_name);
+            direct_fd_ = fd_;
+        }
+    }
+    capacity_ = config.buffer_size > ALIGN_SIZE ? config.buffer_size : ALIGN_SIZE;
+    capacity_ = (capacity_ + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE;
+
+    int buffer_count = 1;
+#ifdef USE_IO_URING
+    if(config.uring_depth > 0) {
+        int ret = io_uring_queue_init(config.uring_depth, &ring_, 0);
+        if(ret < 0) {
+            printf("io_uring_queue_init failed:%s, use pwrite\n", strerror(-ret));
+        } else {
+            use_uring_ = 1;
+            buffer_count = config.uring_depth + 1;  // 多一个缓冲区接收新数据
+        }
+    }
+#endif
+    for(int i = 0; i < buffer_count; i++) {
+        void *buffer = NULL;
+        if(posix_memalign(&buffer, ALIGN_SIZE, capacity_) != 0) {
+            printf("posix_memalign %zu failed\n", capacity_);
+            Close();
+            return -1;
+        }
+        buffers_.push_back((uint8_t *)buffer);
+        inflight_.push_back(0);
+    }
+    cur_ = 0;
+    buf_start_ = 0;
+    buf_len_ = 0;
+    pos_ = 0;
+    file_size_ = 0;
+    return 0;
+}
+
+int FileSink::Write(const uint8_t *data, int size)
+{
+    if(fd_ < 0)
+        return -1;
+    int written = 0;
+    while(written < size) {
+        int64_t remain = size - written;
+        if(pos_ < buf_start_) {
+            // seek回已经写出的位置修改数据, 修改的部分最多到缓冲区开始的位置
+            int64_t len = buf_start_ - pos_ < remain ? buf_start_ - pos_ : remain;
+            if(WaitBuffers(1) < 0 || PwriteAll(fd_, data + written, len, pos_) < 0)
+                return -1;
+            pos_ += len;
+            written += len;
+        } else if(pos_ < buf_start_ + (int64_t)capacity_) {
+            size_t offset = pos_ - buf_start_;
+            size_t len = capacity_ - offset < (size_t)remain ? capacity_ - offset : remain;
+            if(offset > buf_len_)
+                memset(buffers_[cur_] + buf_len_, 0, offset - buf_len_);   // seek越过结尾留下的空洞
+            memcpy(buffers_[cur_] + offset, data + written, len);
+            if(offset + len > buf_len_)
+                buf_len_ = offset + len;
+            pos_ += len;
+            written += len;
+            if(buf_len_ == capacity_ && pos_ == buf_start_ + (int64_t)capacity_) {
+                if(SubmitBuffer() < 0)
+                    return -1;
+            }
+        } else {
+            // seek到缓冲区之后, 写出当前数据后重新定位
+            if(FlushPartial() < 0 || LoadBuffer(pos_) < 0)
+                return -1;
+        }
+        if(pos_ > file_size_)
+            file_size_ = pos_;
+    }
+    return written;
+}
+
+int64_t FileSink::Seek(int64_t offset, int whence)
+{
+    if(fd_ < 0)
+        return -1;
+    int64_t size = file_size_ > pos_ ? file_size_ : pos_;
+    switch(whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return size;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += pos_;
+        break;
+    case SEEK_END:
+        offset += size;
+        break;
+    default:
+        return -1;
+    }
+    if(offset < 0)
+        return -1;
+    pos_ = offset;
+    return pos_;
+}
+
+int FileSink::Close()
+{
+    int ret = 0;
+    if(fd_ >= 0) {
+        if(FlushPartial() < 0)
+            ret = -1;
+        if(direct_fd_ != fd_)
+            close(direct_fd_);
+        close(fd_);
+    }
+#ifdef USE_IO_URING
+    if(use_uring_)
+        io_uring_queue_exit(&ring_);
+#endif
+    use_uring_ = 0;
+    fd_ = -1;
+    direct_fd_ = -1;
+    for(size_t i = 0; i < buffers_.size(); i++)
+        free(buffers_[i]);
+    buffers_.clear();
+    inflight_.clear();
+    return ret;
+}
+
+int FileSink::SubmitBuffer()
+{
+#ifdef USE_IO_URING
+    if(use_uring_) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+        if(!sqe) {
+            printf("io_uring_get_sqe failed\n");
+            return -1;
+        }
+        io_uring_prep_write(sqe, direct_fd_, buffers_[cur_], capacity_, buf_start_);
+        io_uring_sqe_set_data(sqe, (void *)(intptr_t)cur_);
+        int ret = io_uring_submit(&ring_);
+        if(ret < 0) {
+            printf("io_uring_submit failed:%s\n", strerror(-ret));
+            return -1;
+        }
+        inflight_[cur_] = capacity_;
+        cur_ = (cur_ + 1) % buffers_.size();
+        buf_start_ += capacity_;
+        buf_len_ = 0;
+        return WaitBuffers(0);
+    }
+#endif
+    if(PwriteAll(direct_fd_, buffers_[cur_], capacity_, buf_start_) < 0)
+        return -1;
+    buf_start_ += capacity_;
+    buf_len_ = 0;
+    return 0;
+}
+
+int FileSink::FlushPartial()
+{
+    if(WaitBuffers(1) < 0)
+        return -1;
+    if(buf_len_ == 0)
+        return 0;
+    size_t aligned = buf_len_ / ALIGN_SIZE * ALIGN_SIZE;
+    if(aligned > 0 && PwriteAll(direct_fd_, buffers_[cur_], aligned, buf_start_) < 0)
+        return -1;
+    if(buf_len_ > aligned
+            && PwriteAll(fd_, buffers_[cur_] + aligned, buf_len_ - aligned, buf_start_ + aligned) < 0)
+        return -1;
+    return 0;
+}
+
+int FileSink::WaitBuffers(int all)
+{
+#ifdef USE_IO_URING
+    if(use_uring_) {
+        while(1) {
+            int busy = inflight_[cur_] > 0;
+            for(size_t i = 0; all && !busy && i < inflight_.size(); i++)
+                busy = inflight_[i] > 0;
+            if(!busy)
+                break;
+            struct io_uring_cqe *cqe = NULL;
+            int ret = io_uring_wait_cqe(&ring_, &cqe);
+            if(ret < 0) {
+                printf("io_uring_wait_cqe failed:%s\n", strerror(-ret));
+                return -1;
+            }
+            int index = (int)(intptr_t)io_uring_cqe_get_data(cqe);
+            int res = cqe->res;
+            io_uring_cqe_seen(&ring_, cqe);
+            if(res < 0 || (size_t)res != inflight_[index]) {
+                printf("io_uring write failed, res:%d\n", res);
+                return -1;
+            }
+            inflight_[index] = 0;
+        }
+    }
+#endif
+    (void)all;
+    return 0;
+}
+
+int FileSink::LoadBuffer(int64_t pos)
+{
+    if(WaitBuffers(1) < 0)
+        return -1;
+    buf_start_ = pos / ALIGN_SIZE * ALIGN_SIZE;
+    buf_len_ = 0;
+    if(file_size_ > buf_start_) {
+        size_t len = file_size_ - buf_start_ < (int64_t)capacity_ ? file_size_ - buf_start_ : capacity_;
+        if(pread(fd_, buffers_[cur_], len, buf_start_) != (ssize_t)len) {
+            printf("pread %zu at %lld failed\n", len, (long long)buf_start_);
+            return -1;
+        }
+        buf_len_ = len;
+    }
+    // 文件空洞部分补0
+    if(pos - buf_start_ > (int64_t)buf_len_) {
+        memset(buffers_[cur_] + buf_len_, 0, pos - buf_start_ - buf_len_);
+        buf_len_ = pos - buf_start_;
+    }
+    return 0;
+}
+
+int FileSink::PwriteAll(int fd, const uint8_t *data, size_t len, int64_t offset)
+{
+    while(len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            printf("pwrite %zu at %lld failed:%s\n", len, (long long)offset, strerror(errno));
+            return -1;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
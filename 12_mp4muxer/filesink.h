@@ -0,0 +1,55 @@
+#ifndef FILESINK_H
+#define FILESINK_H
+#include <stddef.h>
+#include <vector>
+#include "outputsink.h"
+#ifdef USE_IO_URING
+#include <liburing.h>
+#endif
+
+struct FileSinkConfig
+{
+    int buffer_size = 4 * 1024 * 1024;  // 每次写盘的大小, 按4096对齐
+    int direct = 0;                     // 1: O_DIRECT写, 不经过page cache
+    int uring_depth = 0;                // >0且定义了USE_IO_URING: io_uring异步提交, 最多uring_depth个buffer同时在写
+};
+
+// 大块对齐写文件: 数据先进对齐的缓冲区, 满了整块写出(O_DIRECT或io_uring);
+// seek回已经写出的位置(mp4修改box大小)时用普通fd直接pwrite, 缓冲区始终保持在文件尾部
+class FileSink : public OutputSink
+{
+public:
+    FileSink();
+    ~FileSink();
+    int Open(const char *file_name, const FileSinkConfig &config);
+    int Write(const uint8_t *data, int size) override;
+    int64_t Seek(int64_t offset, int whence) override;
+    int Close() override;
+private:
+    // 整块写出当前缓冲区并切换到下一个缓冲区
+    int SubmitBuffer();
+    // 同步写出当前缓冲区里已有的数据: 对齐部分走direct_fd_, 尾部走fd_
+    int FlushPartial();
+    // 等待异步写完成, all为0时只等待下一个要用的缓冲区
+    int WaitBuffers(int all);
+    // 缓冲区重新定位到pos所在的对齐块, 已有的文件内容先读进来
+    int LoadBuffer(int64_t pos);
+    int PwriteAll(int fd, const uint8_t *data, size_t len, int64_t offset);
+
+    int fd_ = -1;           // 普通fd: 写不对齐的尾部和seek回去修改的数据
+    int direct_fd_ = -1;    // O_DIRECT打开时单独的fd, 否则和fd_相同
+    size_t capacity_ = 0;
+    std::vector<uint8_t *> buffers_;
+    std::vector<size_t> inflight_;      // 每个缓冲区正在异步写的字节数, 0表示空闲
+    int cur_ = 0;
+    int64_t buf_start_ = 0;  // 当前缓冲区对应的文件位置, 始终对齐
+    size_t buf_len_ = 0;     // 当前缓冲区有效数据长度
+    int64_t pos_ = 0;
+    int64_t file_size_ = 0;
+    int use_uring_ = 0;
+#ifdef USE_IO_URING
+    struct io_uring ring_;
+#endif
+};
+
+#endif // FILESINK_H
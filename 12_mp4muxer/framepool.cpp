@@ -0,0 +1,99 @@
+#include "framepool.h"
+
+FramePool::FramePool()
+{
+
+}
+
+FramePool::~FramePool()
+{
+    DeInit();
+}
+
+int FramePool::InitAudio(int sample_format, int channels, int nb_samples)
+{
+    if(channels <= 0 || channels > AV_NUM_DATA_POINTERS || nb_samples <= 0) {
+        printf("FramePool unsupport channels:%d nb_samples:%d\n", channels, nb_samples);
+        return -1;
+    }
+    sample_format_ = sample_format;
+    channels_ = channels;
+    nb_samples_ = nb_samples;
+    planes_ = av_sample_fmt_is_planar((AVSampleFormat)sample_format_) ? channels_ : 1;
+
+    // 和av_frame_get_buffer(frame, 0)一样的对齐方式
+    int ret = av_samples_get_buffer_size(&linesize_, channels_, nb_samples_,
+                                         (AVSampleFormat)sample_format_, 0);
+    if(ret < 0) {
+        char errbuf[1024] = {0};
+        av_strerror(ret, errbuf, sizeof(errbuf) - 1);
+        printf("av_samples_get_buffer_size failed:%s\n", errbuf);
+        return -1;
+    }
+    buffer_pool_ = av_buffer_pool_init(linesize_, NULL);
+    if(!buffer_pool_) {
+        printf("av_buffer_pool_init failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+void FramePool::DeInit()
+{
+    for(size_t i = 0; i < free_frames_.size(); i++) {
+        av_frame_free(&free_frames_[i]);
+    }
+    free_frames_.clear();
+    // 还被编码器引用的buffer释放后pool才会真正销毁
+    if(buffer_pool_) {
+        av_buffer_pool_uninit(&buffer_pool_);
+    }
+}
+
+AVFrame *FramePool::Get()
+{
+    if(!buffer_pool_) {
+        printf("FramePool not init\n");
+        return NULL;
+    }
+    AVFrame *frame = NULL;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!free_frames_.empty()) {
+            frame = free_frames_.back();
+            free_frames_.pop_back();
+        }
+    }
+    if(!frame) {
+        frame = av_frame_alloc();
+        if(!frame) {
+            printf("av_frame_alloc failed\n");
+            return NULL;
+        }
+    }
+    frame->format = sample_format_;
+    frame->channels = channels_;
+    frame->channel_layout = av_get_default_channel_layout(channels_);
+    frame->nb_samples = nb_samples_;
+    for(int i = 0; i < planes_; i++) {
+        frame->buf[i] = av_buffer_pool_get(buffer_pool_);
+        if(!frame->buf[i]) {
+            printf("av_buffer_pool_get failed\n");
+            av_frame_free(&frame);
+            return NULL;
+        }
+        frame->data[i] = frame->buf[i]->data;
+    }
+    frame->linesize[0] = linesize_;
+    frame->extended_data = frame->data;
+    return frame;
+}
+
+void FramePool::Release(AVFrame *frame)
+{
+    if(!frame)
+        return;
+    av_frame_unref(frame);
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_frames_.push_back(frame);
+}
@@ -0,0 +1,36 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+#include <vector>
+#include <mutex>
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+#include "libavutil/buffer.h"
+}
+
+// 音频AVFrame对象池
+// AVFrame结构体放在空闲链表里复用, 采样数据的buffer来自AVBufferPool,
+// 编码器内部av_frame_ref持有的buffer在编码器释放后自动回到AVBufferPool
+class FramePool
+{
+public:
+    FramePool();
+    ~FramePool();
+    int InitAudio(int sample_format, int channels, int nb_samples);
+    void DeInit();
+    // 返回可写的frame, 失败返回NULL
+    AVFrame *Get();
+    // av_frame_unref后放回空闲链表
+    void Release(AVFrame *frame);
+private:
+    int sample_format_ = AV_SAMPLE_FMT_FLTP;
+    int channels_ = 2;
+    int nb_samples_ = 1024;
+    int planes_ = 2;
+    int linesize_ = 0;
+    AVBufferPool *buffer_pool_ = NULL;
+    std::vector<AVFrame *> free_frames_;
+    std::mutex mutex_;
+};
+
+#endif // FRAMEPOOL_H
@@ -0,0 +1,254 @@
+#include "ladderencoder.h"
+#include "yuvmmapreader.h"
+#include "streamclock.h"
+#include "logger.h"
+
+LadderEncoder::LadderEncoder()
+{
+
+}
+
+LadderEncoder::~LadderEncoder()
+{
+    DeInit();
+}
+
+int LadderEncoder::Init(int width, int height, int fps, int pcm_channels, int pcm_sample_rate,
+                        int audio_bit_rate, const std::vector<Rendition> &renditions,
+                        const char *out_prefix)
+{
+    width_ = width;
+    height_ = height;
+    fps_ = fps;
+    pcm_channels_ = pcm_channels;
+    pcm_sample_rate_ = pcm_sample_rate;
+    if(renditions.empty()) {
+        printf("ladder has no rendition\n");
+        return -1;
+    }
+    // 输出文件名由分辨率和码率组成, 完全相同的两路会写同一个文件
+    for(size_t i = 0; i < renditions.size(); i++) {
+        for(size_t j = 0; j < i; j++) {
+            if(renditions[i].width == renditions[j].width && renditions[i].height == renditions[j].height
+                    && renditions[i].bit_rate / 1000 == renditions[j].bit_rate / 1000) {
+                printf("duplicate rendition %dx%d:%d\n", renditions[i].width, renditions[i].height,
+                       renditions[i].bit_rate / 1000);
+                return -1;
+            }
+        }
+    }
+
+    // 音频只初始化一次, 所有输出共用
+    if(audio_encoder_.InitAAC(pcm_channels_, pcm_sample_rate_, audio_bit_rate) < 0) {
+        printf("audio_encoder.InitAAC failed\n");
+        return -1;
+    }
+    audio_encoder_.SetPacketPool(&packet_pool_);
+    if(fltp_frame_pool_.InitAudio(AV_SAMPLE_FMT_FLTP, audio_encoder_.GetChannels(),
+                                  audio_encoder_.GetFrameSize()) < 0) {
+        printf("fltp_frame_pool.InitAudio failed\n");
+        return -1;
+    }
+    if(audio_resampler_.InitFromS16ToFLTP(pcm_channels_, pcm_sample_rate_,
+                                          audio_encoder_.GetChannels(),
+                                          audio_encoder_.GetSampleRate()) < 0) {
+        printf("audio_resampler.InitFromS16ToFLTP failed\n");
+        return -1;
+    }
+
+    for(size_t i = 0; i < renditions.size(); i++) {
+        Output output;
+        output.rendition = renditions[i];
+        output.encoder = new VideoEncoder();
+        output.scaler = NULL;
+        output.muxer = new Muxer();
+        outputs_.push_back(output);     // 先放进去, 失败时由DeInit统一释放
+
+        const Rendition &r = renditions[i];
+        if(output.encoder->InitH264(r.width, r.height, fps_, r.bit_rate) < 0) {
+            printf("InitH264 %dx%d failed\n", r.width, r.height);
+            return -1;
+        }
+        output.encoder->SetPacketPool(&packet_pool_);
+        if(r.width != width_ || r.height != height_) {
+            outputs_.back().scaler = new VideoScaler();
+            if(outputs_.back().scaler->Init(width_, height_, r.width, r.height) < 0) {
+                return -1;
+            }
+        }
+
+        char out_name[1024] = {0};
+        snprintf(out_name, sizeof(out_name) - 1, "%s_%dx%d_%dk.mp4", out_prefix, r.width, r.height,
+                 r.bit_rate / 1000);
+        Muxer *muxer = output.muxer;
+        muxer->SetPacketPool(&packet_pool_);
+        if(muxer->Init(out_name) < 0
+                || muxer->AddStream(output.encoder->GetCodecContext()) < 0
+                || muxer->AddStream(audio_encoder_.GetCodecContext()) < 0
+                || muxer->Open() < 0
+                || muxer->SendHeader() < 0) {
+            printf("init muxer %s failed\n", out_name);
+            return -1;
+        }
+        printf("ladder output %s %dx%d %dbps\n", out_name, r.width, r.height, r.bit_rate);
+    }
+    return 0;
+}
+
+int LadderEncoder::Run(const char *in_yuv_name, const char *in_pcm_name)
+{
+    if(outputs_.empty()) {
+        printf("LadderEncoder not init\n");
+        return -1;
+    }
+    YuvMmapReader yuv_reader;
+    if(yuv_reader.Open(in_yuv_name, width_, height_) < 0) {
+        printf("Failed to open %s file\n", in_yuv_name);
+        return -1;
+    }
+    FILE *in_pcm_fd = fopen(in_pcm_name, "rb");
+    if(!in_pcm_fd) {
+        printf("Failed to open %s file\n", in_pcm_name);
+        return -1;
+    }
+    int frame_samples = audio_encoder_.GetFrameSize();
+    int pcm_frame_size = av_get_bytes_per_sample(AV_SAMPLE_FMT_S16) * pcm_channels_ * frame_samples;
+    uint8_t *pcm_frame_buf = (uint8_t *)malloc(pcm_frame_size);
+    AVFrame *yuv_frame = av_frame_alloc();
+    if(!pcm_frame_buf || !yuv_frame) {
+        printf("alloc pcm_frame_buf/yuv_frame failed\n");
+        fclose(in_pcm_fd);
+        free(pcm_frame_buf);
+        av_frame_free(&yuv_frame);
+        return -1;
+    }
+
+    StreamClock audio_clock;
+    StreamClock video_clock;
+    audio_clock.Init(AVRational{1, audio_encoder_.GetSampleRate()},
+                     audio_encoder_.GetCodecContext()->time_base);
+    video_clock.Init(AVRational{1, fps_}, outputs_[0].encoder->GetCodecContext()->time_base);
+
+    int ret = 0;
+    int audio_finish = 0;
+    int video_finish = 0;
+    while(!audio_finish || !video_finish) {
+        int64_t audio_pts = audio_clock.GetPts();
+        int64_t video_pts = video_clock.GetPts();
+        if(!video_finish && (audio_finish || av_compare_ts(audio_pts, audio_clock.GetTimeBase(),
+                                                           video_pts, video_clock.GetTimeBase()) > 0)) {
+            // 读一次yuv, 所有分辨率共用
+            if(yuv_reader.ReadFrame(yuv_frame) < 0) {
+                video_finish = 1;
+                printf("read yuv frame finish, flush video encoders\n");
+                ret |= EncodeVideo(NULL, video_pts, video_clock.GetTimeBase().den);
+            } else {
+                ret |= EncodeVideo(yuv_frame, video_pts, video_clock.GetTimeBase().den);
+                av_frame_unref(yuv_frame);
+            }
+            video_clock.Advance(1);
+        } else {
+            if(fread(pcm_frame_buf, 1, pcm_frame_size, in_pcm_fd) < (size_t)pcm_frame_size) {
+                audio_finish = 1;
+                printf("fread pcm_frame_buf finish, flush audio encoder\n");
+                ret |= EncodeAudio(NULL, audio_pts, audio_clock.GetTimeBase().den);
+            } else {
+                AVFrame *fltp_frame = fltp_frame_pool_.Get();
+                if(!fltp_frame || audio_resampler_.ResampleFromS16ToFLTP(pcm_frame_buf, fltp_frame) < 0) {
+                    printf("ResampleFromS16ToFLTP error\n");
+                }
+                ret |= EncodeAudio(fltp_frame, audio_pts, audio_clock.GetTimeBase().den);
+                fltp_frame_pool_.Release(fltp_frame);
+            }
+            audio_clock.Advance(frame_samples);
+        }
+    }
+
+    for(size_t i = 0; i < outputs_.size(); i++) {
+        if(outputs_[i].muxer->SendTrailer() < 0) {
+            ret = -1;
+        }
+    }
+    printf("ladder encode finish, %d outputs\n", (int)outputs_.size());
+
+    av_frame_free(&yuv_frame);
+    free(pcm_frame_buf);
+    fclose(in_pcm_fd);
+    return ret < 0 ? -1 : 0;
+}
+
+void LadderEncoder::DeInit()
+{
+    for(size_t i = 0; i < outputs_.size(); i++) {
+        delete outputs_[i].encoder;
+        delete outputs_[i].scaler;
+        if(outputs_[i].muxer) {
+            outputs_[i].muxer->DeInit();
+            delete outputs_[i].muxer;
+        }
+    }
+    outputs_.clear();
+    audio_resampler_.DeInit();
+    audio_encoder_.DeInit();
+    fltp_frame_pool_.DeInit();
+}
+
+int LadderEncoder::EncodeVideo(AVFrame *frame, int64_t pts, int64_t time_base)
+{
+    int ret = 0;
+    std::vector<AVPacket *> packets;
+    for(size_t i = 0; i < outputs_.size(); i++) {
+        Output &output = outputs_[i];
+        AVFrame *out_frame = frame;
+        if(frame && output.scaler) {
+            out_frame = output.scaler->Scale(frame);
+            if(!out_frame) {
+                ret = -1;
+                continue;
+            }
+        }
+        if(output.encoder->Encode(out_frame, output.muxer->GetVideoStreamIndex(),
+                                  pts, time_base, packets) < 0) {
+            ret = -1;
+        }
+        for(size_t j = 0; j < packets.size(); j++) {
+            if(output.muxer->SendPacket(packets[j]) < 0) {
+                ret = -1;
+            }
+        }
+        packets.clear();
+    }
+    return ret;
+}
+
+int LadderEncoder::EncodeAudio(AVFrame *frame, int64_t pts, int64_t time_base)
+{
+    int ret = 0;
+    std::vector<AVPacket *> packets;
+    if(audio_encoder_.Encode(frame, outputs_[0].muxer->GetAudioStreamIndex(),
+                             pts, time_base, packets) < 0) {
+        ret = -1;
+    }
+    for(size_t j = 0; j < packets.size(); j++) {
+        AVPacket *packet = packets[j];
+        // 编码数据是引用计数的, 其他输出只增加引用不拷贝
+        for(size_t i = 1; i < outputs_.size(); i++) {
+            AVPacket *ref_packet = AllocPacket(&packet_pool_);
+            if(!ref_packet || av_packet_ref(ref_packet, packet) < 0) {
+                printf("av_packet_ref failed\n");
+                FreePacket(&packet_pool_, &ref_packet);
+                ret = -1;
+                continue;
+            }
+            ref_packet->stream_index = outputs_[i].muxer->GetAudioStreamIndex();
+            if(outputs_[i].muxer->SendPacket(ref_packet) < 0) {
+                ret = -1;
+            }
+        }
+        // SendPacket会修改时间戳, 最后才写第一路
+        if(outputs_[0].muxer->SendPacket(packet) < 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,54 @@
+#ifndef LADDERENCODER_H
+#define LADDERENCODER_H
+#include <vector>
+#include "audioencoder.h"
+#include "audioresampler.h"
+#include "videoencoder.h"
+#include "videoscaler.h"
+#include "muxer.h"
+#include "packetpool.h"
+#include "framepool.h"
+
+// 多码率阶梯编码: 一次读取yuv/pcm, 视频缩放到多个分辨率分别编码,
+// aac只编码一次, 复制packet后写入每一路输出
+class LadderEncoder
+{
+public:
+    struct Rendition
+    {
+        int width;
+        int height;
+        int bit_rate;
+    };
+    LadderEncoder();
+    ~LadderEncoder();
+    // 每一路输出文件名为 out_prefix_<width>x<height>_<kbps>k.mp4, 分辨率和码率都相同的两路返回失败
+    int Init(int width, int height, int fps, int pcm_channels, int pcm_sample_rate,
+             int audio_bit_rate, const std::vector<Rendition> &renditions,
+             const char *out_prefix);
+    int Run(const char *in_yuv_name, const char *in_pcm_name);
+    void DeInit();
+private:
+    struct Output
+    {
+        Rendition rendition;
+        VideoEncoder *encoder;
+        VideoScaler *scaler;    // 和输入分辨率一致时为NULL
+        Muxer *muxer;
+    };
+    int EncodeVideo(AVFrame *frame, int64_t pts, int64_t time_base);
+    int EncodeAudio(AVFrame *frame, int64_t pts, int64_t time_base);
+
+    int width_ = 0;
+    int height_ = 0;
+    int fps_ = 25;
+    int pcm_channels_ = 2;
+    int pcm_sample_rate_ = 44100;
+    std::vector<Output> outputs_;
+    AudioEncoder audio_encoder_;
+    AudioResampler audio_resampler_;
+    PacketPool packet_pool_;
+    FramePool fltp_frame_pool_;
+};
+
+#endif // LADDERENCODER_H
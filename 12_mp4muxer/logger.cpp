@@ -0,0 +1,130 @@
+#include "logger.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <chrono>
+
+static const char kLevelTag[] = {'D', 'I', 'W', 'E'};
+
+Logger *Logger::Instance()
+{
+    static Logger logger;   // C++11保证局部静态变量初始化是线程安全的
+    return &logger;
+}
+
+Logger::Logger()
+{
+    slots_ = new Slot[kSlotCount];
+    for(int i = 0; i < kSlotCount; i++) {
+        slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    write_pos_ = 0;
+    read_done_ = 0;
+    dropped_ = 0;
+    stop_ = false;
+    thread_ = std::thread(&Logger::Run, this);
+}
+
+Logger::~Logger()
+{
+    stop_ = true;
+    if(thread_.joinable()) {
+        thread_.join();
+    }
+    delete [] slots_;
+}
+
+void Logger::Write(int level, const char *fmt, ...)
+{
+    // 多生产者抢占写位置(Vyukov有界队列), 每个slot的seq表示该slot当前是否可写/可读
+    uint64_t pos = write_pos_.load(std::memory_order_relaxed);
+    Slot *slot = NULL;
+    while(1) {
+        slot = &slots_[pos & (kSlotCount - 1)];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)pos;
+        if(diff == 0) {
+            if(write_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if(diff < 0) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);   // 缓冲区满
+            return;
+        } else {
+            pos = write_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    int len = snprintf(slot->text, kMaxLineSize, "[%c] ",
+                       kLevelTag[level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_ERROR ? LOG_LEVEL_ERROR : level]);
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(slot->text + len, kMaxLineSize - len, fmt, args);
+    va_end(args);
+    if(n < 0) {
+        n = 0;
+    }
+    len += n;
+    if(len >= kMaxLineSize) {   // 被截断, 保证以换行结尾
+        len = kMaxLineSize - 1;
+        slot->text[len - 1] = '\n';
+    }
+    slot->len = len;
+    slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+void Logger::Flush()
+{
+    uint64_t target = write_pos_.load(std::memory_order_acquire);
+    while(read_done_.load(std::memory_order_acquire) < target) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+uint64_t Logger::GetDroppedCount()
+{
+    return dropped_.load(std::memory_order_relaxed);
+}
+
+int Logger::Drain()
+{
+    char buf[64 * 1024];
+    int buf_len = 0;
+    int count = 0;
+    while(1) {
+        Slot *slot = &slots_[read_pos_ & (kSlotCount - 1)];
+        if(slot->seq.load(std::memory_order_acquire) != read_pos_ + 1) {
+            break;  // 没有已经写完的日志
+        }
+        if(buf_len + slot->len > (int)sizeof(buf)) {
+            fwrite(buf, 1, buf_len, stdout);
+            buf_len = 0;
+        }
+        memcpy(buf + buf_len, slot->text, slot->len);
+        buf_len += slot->len;
+        slot->seq.store(read_pos_ + kSlotCount, std::memory_order_release);
+        read_pos_++;
+        count++;
+    }
+    if(buf_len > 0) {
+        fwrite(buf, 1, buf_len, stdout);
+        fflush(stdout);
+    }
+    read_done_.store(read_pos_, std::memory_order_release);
+    return count;
+}
+
+void Logger::Run()
+{
+    uint64_t reported_dropped = 0;
+    while(!stop_.load(std::memory_order_relaxed)) {
+        if(Drain() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if(dropped != reported_dropped) {
+            printf("[W] logger dropped %" PRIu64 " lines\n", dropped - reported_dropped);
+            reported_dropped = dropped;
+        }
+    }
+    Drain();
+}
@@ -0,0 +1,75 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+#include <inttypes.h>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE  4
+
+// 编译期日志级别, 低于该级别的日志在编译时直接去掉, 比如 -DLOG_LEVEL=0 打开debug日志
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// 异步日志: 调用线程只做格式化并写入无锁环形缓冲区, 由后台线程批量写到stdout
+// 缓冲区满时丢弃日志并计数, 不会阻塞编码线程
+class Logger
+{
+public:
+    static Logger *Instance();
+    void Write(int level, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+    // 等待已经写入缓冲区的日志全部输出
+    void Flush();
+    uint64_t GetDroppedCount();
+private:
+    Logger();
+    ~Logger();
+    void Run();
+    int Drain();
+
+    enum { kSlotCount = 4096, kMaxLineSize = 240 };  // kSlotCount必须是2的幂
+    struct Slot
+    {
+        std::atomic<uint64_t> seq;
+        int len;
+        char text[kMaxLineSize];
+    };
+    Slot *slots_ = NULL;
+    std::atomic<uint64_t> write_pos_;
+    uint64_t read_pos_ = 0;     // 只有后台线程访问
+    std::atomic<uint64_t> read_done_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+};
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LogDebug(...) Logger::Instance()->Write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LogDebug(...) do {} while(0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LogInfo(...) Logger::Instance()->Write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LogInfo(...) do {} while(0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LogWarn(...) Logger::Instance()->Write(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LogWarn(...) do {} while(0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LogError(...) Logger::Instance()->Write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LogError(...) do {} while(0)
+#endif
+
+#endif // LOGGER_H
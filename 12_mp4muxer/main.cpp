@@ -1,9 +1,28 @@
 #include <iostream>
+#include <string.h>
+#include <math.h>
+#include <thread>
 
 #include "audioencoder.h"
 #include "audioresampler.h"
 #include "videoencoder.h"
 #include "muxer.h"
+#include "packetpool.h"
+#include "framepool.h"
+#include "yuvmmapreader.h"
+#include "logger.h"
+#include "streamclock.h"
+#include "ladderencoder.h"
+#include "threadbench.h"
+#include "memorysink.h"
+#include "segmentmuxer.h"
+#include "batchrunner.h"
+#include "sampleconvert.h"
+#include "samplefifo.h"
+extern "C"
+{
+#include "libavutil/time.h"
+}
 using namespace std;
 
 #define YUV_WIDTH 720
@@ -18,27 +37,440 @@ using namespace std;
 
 #define AUDIO_BIT_RATE 128*1024
 
-#define AUDIO_TIME_BASE 1000000
-#define VIDEO_TIME_BASE 1000000
+// 多线程模式下编码线程和复用线程之间的队列长度
+#define VIDEO_QUEUE_SIZE 32
+#define AUDIO_QUEUE_SIZE 64
+// 多线程模式下pcm读取线程每次读取的采样点数, 以及和音频编码线程之间fifo的容量(每通道采样点数)
+#define PCM_CHUNK_SAMPLES 4096
+#define SAMPLE_FIFO_SIZE 65536
+// iobuf=选项的范围, 单位MB, FileSinkConfig::buffer_size是int
+#define MAX_IO_BUFFER_MB 1024
 //ffmpeg -i sound_in_sync_test.mp4 -pix_fmt yuv420p 720x576_yuv420p.yuv
 //ffmpeg -i sound_in_sync_test.mp4 -vn -ar 44100 -ac 2 -f s16le 44100_2_s16le.pcm
-// 执行文件  yuv文件 pcm文件 输出mp4文件
+// 执行文件 ladder yuv文件 pcm文件 输出前缀 [宽x高:码率kbps ...]
+// 不指定阶梯时使用默认的1080p/720p/480p/360p中不超过输入高度的几档, 宽度按输入的宽高比计算,
+// 最高一档低于输入时再加上输入分辨率, 不做放大
+static int RunLadder(int argc, char **argv)
+{
+    if(argc < 5) {
+        printf("usage -> exe ladder in.yuv in.pcm out_prefix [WxH:kbps ...]\n");
+        return -1;
+    }
+    std::vector<LadderEncoder::Rendition> renditions;
+    for(int i = 5; i < argc; i++) {
+        LadderEncoder::Rendition r;
+        int kbps = 0;
+        if(sscanf(argv[i], "%dx%d:%d", &r.width, &r.height, &kbps) != 3
+                || r.width <= 0 || r.height <= 0 || kbps <= 0) {
+            printf("invalid rendition:%s\n", argv[i]);
+            return -1;
+        }
+        r.bit_rate = kbps * 1000;
+        renditions.push_back(r);
+    }
+    if(renditions.empty()) {
+        static const int ladder_heights[] = {1080, 720, 480, 360};
+        static const int ladder_kbps[] = {4500, 2500, 1200, 700};
+        int top_kbps = 0;   // 去掉的最低一档的码率, 给输入分辨率那一档用
+        for(int i = 0; i < (int)(sizeof(ladder_heights) / sizeof(ladder_heights[0])); i++) {
+            int height = ladder_heights[i];
+            if(height > YUV_HEIGHT) {
+                top_kbps = ladder_kbps[i];
+                continue;
+            }
+            if(height < YUV_HEIGHT && renditions.empty() && top_kbps > 0)
+                renditions.push_back({YUV_WIDTH, YUV_HEIGHT, top_kbps * 1000});
+            int width = YUV_WIDTH * height / YUV_HEIGHT / 2 * 2;   // yuv420p宽度需要是偶数
+            renditions.push_back({width, height, ladder_kbps[i] * 1000});
+        }
+        if(renditions.empty())
+            renditions.push_back({YUV_WIDTH, YUV_HEIGHT, top_kbps * 1000});
+    }
+    LadderEncoder ladder_encoder;
+    if(ladder_encoder.Init(YUV_WIDTH, YUV_HEIGHT, YUV_FPS, PCM_CHANNELS, PCM_SAMPLE_RATE,
+                           AUDIO_BIT_RATE, renditions, argv[4]) < 0) {
+        printf("ladder_encoder.Init failed\n");
+        return -1;
+    }
+    if(ladder_encoder.Run(argv[2], argv[3]) < 0) {
+        printf("ladder_encoder.Run failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+// 执行文件 bench-threads yuv文件 [最多编码帧数] [affinity]
+// 遍历编码线程配置, 输出每种配置的编码速度和延迟, 用来选择当前机器的最佳配置
+static int RunThreadBench(int argc, char **argv)
+{
+    if(argc < 3) {
+        printf("usage -> exe bench-threads in.yuv [max_frames] [affinity]\n");
+        return -1;
+    }
+    int max_frames = 0;
+    int affinity = 0;
+    for(int i = 3; i < argc; i++) {
+        if(strcmp(argv[i], "affinity") == 0) {
+            affinity = 1;
+        } else {
+            max_frames = atoi(argv[i]);
+        }
+    }
+    ThreadBench bench;
+    if(bench.Init(argv[2], YUV_WIDTH, YUV_HEIGHT, YUV_FPS, VIDEO_BIT_RATE, max_frames) < 0) {
+        printf("bench.Init failed\n");
+        return -1;
+    }
+    std::vector<VideoThreadConfig> configs = ThreadBench::DefaultSweep(affinity);
+    std::vector<ThreadBench::Result> results;
+    for(size_t i = 0; i < configs.size(); i++) {
+        ThreadBench::Result result;
+        if(bench.Run(configs[i], result) < 0) {
+            printf("bench config %d failed\n", (int)i);
+            continue;
+        }
+        results.push_back(result);
+    }
+    printf("threads,type,lookahead,affinity,frames,fps,avg_latency_ms,max_latency_ms\n");
+    int best = -1;
+    for(size_t i = 0; i < results.size(); i++) {
+        const ThreadBench::Result &r = results[i];
+        printf("%d,%s,%d,%d,%d,%.2f,%.2f,%.2f\n", r.config.thread_count,
+               r.config.thread_type == FF_THREAD_SLICE ? "slice" : "frame",
+               r.config.lookahead_threads, r.config.cpu_first >= 0 ? 1 : 0,
+               r.frames, r.fps, r.avg_latency_ms, r.max_latency_ms);
+        if(best < 0 || r.fps > results[best].fps)
+            best = (int)i;
+    }
+    if(best >= 0) {
+        printf("best fps: threads:%d type:%s %.2f fps\n", results[best].config.thread_count,
+               results[best].config.thread_type == FF_THREAD_SLICE ? "slice" : "frame",
+               results[best].fps);
+    }
+    return 0;
+}
+
+// 执行文件 segment yuv文件 pcm文件 输出前缀 [ts|fmp4] [切片时长ms]
+// 按关键帧切片输出HLS(fmp4同时输出DASH), 切片在后台线程关闭和fsync
+static int RunSegment(int argc, char **argv)
+{
+    if(argc < 5) {
+        printf("usage -> exe segment in.yuv in.pcm out_prefix [ts|fmp4] [segment_ms]\n");
+        return -1;
+    }
+    SegmentMuxer::Format format = SegmentMuxer::FORMAT_TS;
+    int segment_ms = 4000;
+    for(int i = 5; i < argc; i++) {
+        if(strcmp(argv[i], "ts") == 0) {
+            format = SegmentMuxer::FORMAT_TS;
+        } else if(strcmp(argv[i], "fmp4") == 0) {
+            format = SegmentMuxer::FORMAT_FMP4;
+        } else if(atoi(argv[i]) > 0) {
+            segment_ms = atoi(argv[i]);
+        } else {
+            printf("unknown option:%s\n", argv[i]);
+            return -1;
+        }
+    }
+    YuvMmapReader yuv_reader;
+    if(yuv_reader.Open(argv[2], YUV_WIDTH, YUV_HEIGHT) < 0) {
+        printf("Failed to open %s file\n", argv[2]);
+        return -1;
+    }
+    FILE *in_pcm_fd = fopen(argv[3], "rb");
+    if(!in_pcm_fd) {
+        printf("Failed to open %s file\n", argv[3]);
+        return -1;
+    }
+    PacketPool packet_pool;
+    VideoEncoder video_encoder;
+    AudioEncoder audio_encoder;
+    AudioResampler audio_resampler;
+    FramePool fltp_frame_pool;
+    SegmentMuxer segment_muxer;
+    video_encoder.SetPacketPool(&packet_pool);
+    audio_encoder.SetPacketPool(&packet_pool);
+    segment_muxer.SetPacketPool(&packet_pool);
+    if(video_encoder.InitH264(YUV_WIDTH, YUV_HEIGHT, YUV_FPS, VIDEO_BIT_RATE) < 0
+            || audio_encoder.InitAAC(PCM_CHANNELS, PCM_SAMPLE_RATE, AUDIO_BIT_RATE) < 0
+            || fltp_frame_pool.InitAudio(AV_SAMPLE_FMT_FLTP, audio_encoder.GetChannels(),
+                                         audio_encoder.GetFrameSize()) < 0
+            || audio_resampler.InitFromS16ToFLTP(PCM_CHANNELS, PCM_SAMPLE_RATE,
+                                                 audio_encoder.GetChannels(), audio_encoder.GetSampleRate()) < 0) {
+        printf("init encoders failed\n");
+        fclose(in_pcm_fd);
+        return -1;
+    }
+    if(segment_muxer.Init(argv[4], format, (int64_t)segment_ms * 1000,
+                          video_encoder.GetCodecContext(), audio_encoder.GetCodecContext()) < 0) {
+        printf("segment_muxer.Init failed\n");
+        fclose(in_pcm_fd);
+        return -1;
+    }
+    int frame_samples = audio_encoder.GetFrameSize();
+    int pcm_frame_size = av_get_bytes_per_sample(PCM_SAMPLE_FORMAT) * PCM_CHANNELS * frame_samples;
+    std::vector<uint8_t> pcm_frame_buf(pcm_frame_size);
+    AVFrame *yuv_frame = av_frame_alloc();
+    StreamClock audio_clock;
+    StreamClock video_clock;
+    audio_clock.Init(AVRational{1, audio_encoder.GetSampleRate()}, audio_encoder.GetCodecContext()->time_base);
+    video_clock.Init(AVRational{1, YUV_FPS}, video_encoder.GetCodecContext()->time_base);
+
+    int ret = 0;
+    int audio_finish = 0;
+    int video_finish = 0;
+    std::vector<AVPacket *> packets;
+    while(yuv_frame && (!audio_finish || !video_finish)) {
+        if(!video_finish && (audio_finish || av_compare_ts(audio_clock.GetPts(), audio_clock.GetTimeBase(),
+                                                           video_clock.GetPts(), video_clock.GetTimeBase()) > 0)) {
+            AVFrame *frame = NULL;
+            if(yuv_reader.ReadFrame(yuv_frame) < 0)
+                video_finish = 1;
+            else
+                frame = yuv_frame;
+            ret |= video_encoder.Encode(frame, segment_muxer.GetVideoStreamIndex(), video_clock.GetPts(),
+                                        video_clock.GetTimeBase().den, packets);
+            av_frame_unref(yuv_frame);
+            video_clock.Advance(1);
+        } else {
+            AVFrame *fltp_frame = NULL;
+            if(fread(pcm_frame_buf.data(), 1, pcm_frame_size, in_pcm_fd) < (size_t)pcm_frame_size) {
+                audio_finish = 1;
+            } else {
+                fltp_frame = fltp_frame_pool.Get();
+                if(!fltp_frame || audio_resampler.ResampleFromS16ToFLTP(pcm_frame_buf.data(), fltp_frame) < 0)
+                    printf("ResampleFromS16ToFLTP error\n");
+            }
+            ret |= audio_encoder.Encode(fltp_frame, segment_muxer.GetAudioStreamIndex(), audio_clock.GetPts(),
+                                        audio_clock.GetTimeBase().den, packets);
+            fltp_frame_pool.Release(fltp_frame);
+            audio_clock.Advance(frame_samples);
+        }
+        for(size_t i = 0; i < packets.size(); i++) {
+            ret |= segment_muxer.SendPacket(packets[i]);
+        }
+        packets.clear();
+    }
+    ret |= segment_muxer.SendTrailer();
+    printf("segment output finish, %d segments\n", segment_muxer.GetFinishedSegmentCount());
+    segment_muxer.DeInit();
+    av_frame_free(&yuv_frame);
+    fclose(in_pcm_fd);
+    return ret < 0 ? -1 : 0;
+}
+
+// 执行文件 batch 任务清单 [工作线程数]
+// 清单每行: in.yuv in.pcm out.mp4 [WxH] [fps=N] [vbr=kbps] [ar=Hz] [ac=N] [abr=kbps]
+static int RunBatch(int argc, char **argv)
+{
+    if(argc < 3) {
+        printf("usage -> exe batch manifest.txt [workers]\n");
+        return -1;
+    }
+    BatchRunner::Job defaults;
+    defaults.width = YUV_WIDTH;
+    defaults.height = YUV_HEIGHT;
+    defaults.fps = YUV_FPS;
+    defaults.video_bit_rate = VIDEO_BIT_RATE;
+    defaults.pcm_channels = PCM_CHANNELS;
+    defaults.pcm_sample_rate = PCM_SAMPLE_RATE;
+    defaults.audio_bit_rate = AUDIO_BIT_RATE;
+    BatchRunner runner;
+    if(runner.LoadManifest(argv[2], defaults) < 0) {
+        printf("runner.LoadManifest failed\n");
+        return -1;
+    }
+    int ret = runner.Run(argc > 3 ? atoi(argv[3]) : 0);
+
+    const std::vector<BatchRunner::Job> &jobs = runner.GetJobs();
+    const std::vector<BatchRunner::Result> &results = runner.GetResults();
+    int64_t total_frames = 0;
+    int64_t total_bytes = 0;
+    int failed = 0;
+    int video_reused = 0;
+    int audio_reused = 0;
+    printf("job,worker,ret,frames,elapsed_ms,fps,out_mb,video_reused,audio_reused,out\n");
+    for(size_t i = 0; i < results.size(); i++) {
+        const BatchRunner::Result &r = results[i];
+        printf("%d,%d,%d,%d,%.1f,%.1f,%.2f,%d,%d,%s\n", (int)i, r.worker, r.ret, r.frames, r.elapsed_ms,
+               r.elapsed_ms > 0 ? r.frames * 1000.0 / r.elapsed_ms : 0,
+               r.out_bytes / (1024.0 * 1024.0), r.video_reused, r.audio_reused, jobs[i].out_name.c_str());
+        total_frames += r.frames;
+        total_bytes += r.out_bytes;
+        failed += r.ret < 0;
+        video_reused += r.video_reused;
+        audio_reused += r.audio_reused;
+    }
+    double seconds = runner.GetElapsedMs() / 1000.0;
+    if(seconds > 0) {
+        printf("batch finish: %d jobs (%d failed) in %.2fs, %.2f jobs/s, %.1f fps, %.2f MB/s, "
+               "encoder reused video %d audio %d\n",
+               (int)results.size(), failed, seconds, results.size() / seconds, total_frames / seconds,
+               total_bytes / (1024.0 * 1024.0) / seconds, video_reused, audio_reused);
+    }
+    return ret;
+}
+
+// 执行文件 bench-resample [秒数]
+// 对比swr_convert和各个SIMD实现的s16->fltp转换速度, 输入是随机的44.1k双声道数据, 按aac的1024采样点一帧转换
+static int RunResampleBench(int argc, char **argv)
+{
+    int seconds = argc > 2 ? atoi(argv[2]) : 600;
+    const int frame_samples = 1024;
+    int frames = (int)((int64_t)seconds * PCM_SAMPLE_RATE / frame_samples);
+    if(frames <= 0) {
+        printf("usage -> exe bench-resample [seconds]\n");
+        return -1;
+    }
+    // 输入控制在缓存能装下的大小, 循环使用, 测的是转换本身而不是内存带宽
+    const int input_frames = 64;
+    std::vector<int16_t> s16(input_frames * frame_samples * PCM_CHANNELS);
+    for(size_t i = 0; i < s16.size(); i++)
+        s16[i] = (int16_t)(rand() & 0xffff);
+    AVFrame *frame = AllocFltpPcmFrame(PCM_CHANNELS, frame_samples);
+    AVFrame *ref_frame = AllocFltpPcmFrame(PCM_CHANNELS, frame_samples);
+    if(!frame || !ref_frame) {
+        FreePcmFrame(frame);
+        FreePcmFrame(ref_frame);
+        return -1;
+    }
+
+    // swr作为基准
+    AudioResampler resampler;
+    resampler.SetFastPath(0);
+    if(resampler.InitFromS16ToFLTP(PCM_CHANNELS, PCM_SAMPLE_RATE, PCM_CHANNELS, PCM_SAMPLE_RATE) < 0) {
+        FreePcmFrame(frame);
+        FreePcmFrame(ref_frame);
+        return -1;
+    }
+    int64_t begin = av_gettime_relative();
+    for(int i = 0; i < frames; i++) {
+        resampler.ResampleFromS16ToFLTP((uint8_t *)&s16[(i % input_frames) * frame_samples * PCM_CHANNELS], frame);
+    }
+    double swr_ms = (av_gettime_relative() - begin) / 1000.0;
+    printf("impl,ms,msamples_per_s,speedup,max_diff\n");
+    printf("swr,%.2f,%.1f,1.00,0\n", swr_ms, (double)frames * frame_samples / swr_ms / 1000.0);
+
+    for(int level = SIMD_C; level < SIMD_COUNT; level++) {
+        S16ToFltpFunc convert = GetS16ToFltpFunc(level);
+        if(!convert)
+            continue;
+        begin = av_gettime_relative();
+        for(int i = 0; i < frames; i++) {
+            convert(&s16[(i % input_frames) * frame_samples * PCM_CHANNELS], (float **)frame->data,
+                    PCM_CHANNELS, frame_samples);
+        }
+        double ms = (av_gettime_relative() - begin) / 1000.0;
+        // 和swr的结果比较, 应该完全一致
+        float max_diff = 0;
+        for(int i = 0; i < input_frames; i++) {
+            const int16_t *in = &s16[i * frame_samples * PCM_CHANNELS];
+            resampler.ResampleFromS16ToFLTP((uint8_t *)in, ref_frame);
+            convert(in, (float **)frame->data, PCM_CHANNELS, frame_samples);
+            for(int ch = 0; ch < PCM_CHANNELS; ch++) {
+                for(int j = 0; j < frame_samples; j++) {
+                    float diff = fabsf(((float *)frame->data[ch])[j] - ((float *)ref_frame->data[ch])[j]);
+                    if(diff > max_diff)
+                        max_diff = diff;
+                }
+            }
+        }
+        printf("%s,%.2f,%.1f,%.2f,%g\n", GetSimdName(level), ms, (double)frames * frame_samples / ms / 1000.0,
+               ms > 0 ? swr_ms / ms : 0, max_diff);
+    }
+    resampler.DeInit();
+    FreePcmFrame(frame);
+    FreePcmFrame(ref_frame);
+    return 0;
+}
+
+// 执行文件  yuv文件 pcm文件 输出mp4文件 [pipeline] [live]
+// pipeline: 视频编码、音频编码、复用分别在独立的线程运行, pcm由单独的线程读取后经无锁fifo交给音频编码线程
+// pcm_chunk: pipeline模式下每次读取pcm的采样点数
+// live: 视频编码使用直播低延迟模式, 结束时打印编码延迟
+// fmp4=ms: 输出CMAF分片mp4, 每个分片至少ms毫秒并按GOP对齐, 写完一个分片就可以被读取
+// faststart: moov放在文件开头, 按yuv文件的时长预留moov空间
+// direct/uring=N/iobuf=MB: 输出用FileSink大块对齐写, O_DIRECT不经过page cache, io_uring异步提交
+// memory: 复用到内存(MemorySink), 结束后再一次性写到输出文件, 模拟直接交给下一个处理环节
+// pcm_rate=Hz: 输入pcm的采样率, 和aac编码器(44100)不同时在流式重采样里转换
 int main(int argc, char **argv)
 {
-    if(argc != 4) {
-        printf("usage -> exe in.yuv in.pcm out.mp4");
+    if(argc >= 2 && strcmp(argv[1], "ladder") == 0) {
+        return RunLadder(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "bench-threads") == 0) {
+        return RunThreadBench(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "segment") == 0) {
+        return RunSegment(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "batch") == 0) {
+        return RunBatch(argc, argv);
+    }
+    if(argc >= 2 && strcmp(argv[1], "bench-resample") == 0) {
+        return RunResampleBench(argc, argv);
+    }
+    if(argc < 4) {
+        printf("usage -> exe in.yuv in.pcm out.mp4 [pipeline] [live] [fmp4=ms] [faststart] [direct] [uring=N] [iobuf=MB] [memory] [pcm_rate=Hz] [pcm_chunk=N]");
+        return -1;
+    }
+    int pipeline = 0;
+    int live = 0;
+    int fragment_ms = 0;
+    int faststart = 0;
+    int use_file_sink = 0;
+    int memory_output = 0;
+    int in_pcm_rate = PCM_SAMPLE_RATE;
+    int pcm_chunk_samples = PCM_CHUNK_SAMPLES;
+    FileSinkConfig file_sink_config;
+    for(int i = 4; i < argc; i++) {
+        if(strcmp(argv[i], "pipeline") == 0) {
+            pipeline = 1;
+        } else if(strcmp(argv[i], "live") == 0) {
+            live = 1;
+        } else if(strcmp(argv[i], "direct") == 0) {
+            file_sink_config.direct = 1;
+            use_file_sink = 1;
+        } else if(strncmp(argv[i], "uring=", 6) == 0) {
+            file_sink_config.uring_depth = atoi(argv[i] + 6);
+            use_file_sink = 1;
+        } else if(strncmp(argv[i], "iobuf=", 6) == 0) {
+            long long buffer_mb = strtoll(argv[i] + 6, NULL, 10);
+            if(buffer_mb < 1)
+                buffer_mb = 1;
+            else if(buffer_mb > MAX_IO_BUFFER_MB)
+                buffer_mb = MAX_IO_BUFFER_MB;
+            file_sink_config.buffer_size = (int)(buffer_mb * 1024 * 1024);
+            use_file_sink = 1;
+        } else if(strcmp(argv[i], "memory") == 0) {
+            memory_output = 1;
+        } else if(strcmp(argv[i], "faststart") == 0) {
+            faststart = 1;
+        } else if(strncmp(argv[i], "fmp4=", 5) == 0) {
+            fragment_ms = atoi(argv[i] + 5);
+        } else if(strncmp(argv[i], "pcm_rate=", 9) == 0 && atoi(argv[i] + 9) > 0) {
+            in_pcm_rate = atoi(argv[i] + 9);
+        } else if(strncmp(argv[i], "pcm_chunk=", 10) == 0 && atoi(argv[i] + 10) > 0) {
+            pcm_chunk_samples = atoi(argv[i] + 10);
+        } else {
+            printf("unknown option:%s\n", argv[i]);
+            return -1;
+        }
+    }
+    if(live && fragment_ms > 0) {
+        // 直播模式用帧内刷新, 只有第一帧是关键帧, 分片只在关键帧切分, 整个文件会只有一个分片
+        printf("live and fmp4 can not be used together\n");
         return -1;
     }
     // 1. 打开yuv pcm文件
     char *in_yuv_name = argv[1];
     char *in_pcm_name = argv[2];
     char *out_mp4_name = argv[3];
-    FILE *in_yuv_fd = NULL;
+    YuvMmapReader yuv_reader;
     FILE *in_pcm_fd = NULL;
     //1. 打开测试文件
-    // 打开YUV文件
-    in_yuv_fd = fopen(in_yuv_name, "rb");
-    if( !in_yuv_fd )
+    // 打开YUV文件, mmap方式读取, 帧数据直接交给编码器
+    if(yuv_reader.Open(in_yuv_name, YUV_WIDTH, YUV_HEIGHT) < 0)
     {
         printf("Failed to open %s file\n", in_yuv_name);
         return -1;
@@ -61,38 +493,36 @@ int main(int argc, char **argv)
     int yuv_fps = YUV_FPS;
     int video_bit_rate = VIDEO_BIT_RATE;
     VideoEncoder video_encoder;
+    if(live)
+        video_encoder.SetLiveMode();
     ret = video_encoder.InitH264(yuv_width, yuv_height, yuv_fps, video_bit_rate);
     if(ret < 0)
     {
         printf("video_encoder.InitH264 failed\n");
         return -1;
     }
-    // 分配yuv buf
-    int y_frame_size = yuv_width * yuv_height;
-    int u_frame_size = yuv_width * yuv_height /4;
-    int v_frame_size = yuv_width * yuv_height /4;
-    int yuv_frame_size = y_frame_size + u_frame_size + v_frame_size;
-    uint8_t *yuv_frame_buf = (uint8_t *)malloc(yuv_frame_size);
-    if(!yuv_frame_buf)
+    // yuv帧指向mmap的内存, 不需要再分配yuv buf
+    AVFrame *yuv_frame = av_frame_alloc();
+    if(!yuv_frame)
     {
-        printf("malloc(yuv_frame_size)\n");
+        printf("av_frame_alloc yuv_frame failed\n");
         return -1;
     }
 
     // 2.2 初始化audio
     // 初始化音频编码器
     int pcm_channels= PCM_CHANNELS;
-    int pcm_sample_rate = PCM_SAMPLE_RATE;
+    int pcm_sample_rate = in_pcm_rate;     // 输入pcm的采样率, 和aac不同时重采样
     int pcm_sample_format = PCM_SAMPLE_FORMAT;
     int audio_bit_rate = AUDIO_BIT_RATE;
     AudioEncoder audio_encoder;
-    ret = audio_encoder.InitAAC(pcm_channels, pcm_sample_rate, audio_bit_rate);
+    ret = audio_encoder.InitAAC(pcm_channels, PCM_SAMPLE_RATE, audio_bit_rate);
     if(ret < 0)
     {
         printf("audio_encoder.InitAAC failed\n");
         return -1;
     }
-    // 分配pcm buf
+    // 分配pcm buf, 每次读取的输入采样点数不需要和编码帧一致, 这里取一帧的大小
     // pcm_frame_size  = 单个采样点占用的字节 * 通道数量 * 每个通道有多少给采用点
     int pcm_frame_size = av_get_bytes_per_sample((AVSampleFormat)pcm_sample_format)
             *pcm_channels * audio_encoder.GetFrameSize();
@@ -107,19 +537,62 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    // 初始化重采样
+    // 编码器和muxer共用packet池, pcm帧也从池里取, 稳定编码时不再每帧分配内存
+    PacketPool packet_pool;
+    video_encoder.SetPacketPool(&packet_pool);
+    audio_encoder.SetPacketPool(&packet_pool);
+    FramePool fltp_frame_pool;
+    ret = fltp_frame_pool.InitAudio(AV_SAMPLE_FMT_FLTP, audio_encoder.GetChannels(),
+                                    audio_encoder.GetFrameSize());
+    if(ret < 0)
+    {
+        printf("fltp_frame_pool.InitAudio failed\n");
+        return -1;
+    }
+
+    // 初始化重采样, 流式输入任意长度的pcm, 输出编码器帧长的fltp帧
     AudioResampler audio_resampler;
-    ret = audio_resampler.InitFromS16ToFLTP(pcm_channels, pcm_sample_rate,
-                                            audio_encoder.GetChannels(), audio_encoder.GetSampleRate());
+    ret = audio_resampler.InitStream(pcm_channels, pcm_sample_rate,
+                                     audio_encoder.GetChannels(), audio_encoder.GetSampleRate(),
+                                     audio_encoder.GetFrameSize());
     if(ret < 0)
     {
-        printf("audio_resampler.InitFromS16ToFLTP failed\n");
+        printf("audio_resampler.InitStream failed\n");
         return -1;
     }
+    // 从pcm文件读取并重采样出一帧, 1: 得到一帧 0: 读完并且冲刷完 <0: 失败
+    int pcm_eof = 0;
+    int pcm_sample_bytes = av_get_bytes_per_sample((AVSampleFormat)pcm_sample_format) * pcm_channels;
+    auto read_audio_frame = [&](AVFrame *fltp_frame) -> int {
+        while(1) {
+            int got = audio_resampler.ReceiveFrame(fltp_frame);
+            if(got != 0 || pcm_eof)
+                return got;
+            size_t samples = fread(pcm_frame_buf, pcm_sample_bytes, pcm_frame_size / pcm_sample_bytes, in_pcm_fd);
+            if(samples > 0 && audio_resampler.SendS16(pcm_frame_buf, (int)samples) < 0)
+                return -1;
+            if(samples < (size_t)(pcm_frame_size / pcm_sample_bytes)) {
+                pcm_eof = 1;
+                if(audio_resampler.SendS16(NULL, 0) < 0)
+                    return -1;
+            }
+        }
+    };
 
     // 3. mp4初始化 包括新建流，open io, send header
+    MemorySink memory_sink;     // 在mp4_muxer之前定义, 析构时muxer先关闭
     Muxer mp4_muxer;
-    ret = mp4_muxer.Init(out_mp4_name);
+    mp4_muxer.SetPacketPool(&packet_pool);
+    if(fragment_ms > 0)
+        mp4_muxer.SetFragmentDuration((int64_t)fragment_ms * 1000);
+    if(use_file_sink)
+        mp4_muxer.SetFileSinkConfig(file_sink_config);
+    if(faststart)
+        mp4_muxer.SetFaststart(yuv_reader.GetFrameCount() * AV_TIME_BASE / yuv_fps);
+    if(memory_output)
+        ret = mp4_muxer.Init("mp4", &memory_sink);
+    else
+        ret = mp4_muxer.Init(out_mp4_name);
     if(ret < 0)
     {
         printf("mp4_muxer.Init failed\n");
@@ -155,113 +628,253 @@ int main(int argc, char **argv)
     }
     // 4. 在while循环读取yuv、pcm进行编码然后发送给MP4 muxer
     // 4.1 时间戳相关
-    int64_t audio_time_base = AUDIO_TIME_BASE;
-    int64_t video_time_base = VIDEO_TIME_BASE;
-    double audio_pts = 0;
-    double video_pts = 0;
-    double audio_frame_duration = 1.0 * audio_encoder.GetFrameSize()/pcm_sample_rate*audio_time_base;
-    double video_frame_duration = 1.0/yuv_fps * video_time_base;
+    // 按帧数/采样点数计数, 直接生成编码器time_base下的pts, 编码器内部不用再转换
+    StreamClock audio_clock;
+    StreamClock video_clock;
+    audio_clock.Init(AVRational{1, audio_encoder.GetSampleRate()},
+                     audio_encoder.GetCodecContext()->time_base);
+    video_clock.Init(AVRational{1, yuv_fps}, video_encoder.GetCodecContext()->time_base);
+    int64_t audio_time_base = audio_clock.GetTimeBase().den;
+    int64_t video_time_base = video_clock.GetTimeBase().den;
+    int audio_frame_samples = audio_encoder.GetFrameSize();
 
     int audio_finish = 0;   // 两者都为0的时候才结束while循环
     int video_finish = 0;
 
-    size_t read_len = 0;
     AVPacket *packet =  NULL;
     std::vector<AVPacket *> packets;
     int audio_index = mp4_muxer.GetAudioStreamIndex();
     int video_index = mp4_muxer.GetVideoStreamIndex();
-    while (1) {
-        if(audio_finish && video_finish) {
-            break;
+    if(pipeline) {
+        // 4.2 多线程模式: 视频线程和音频线程各自读取、编码, 复用在当前线程按dts交错写入
+        // pcm读取线程和音频编码线程之间用无锁fifo, 读取的块大小和编码器帧长无关
+        // 可能失败的初始化都放在启动线程之前, 线程启动后不能直接返回
+        SampleFifo sample_fifo;
+        if(sample_fifo.Init(audio_encoder.GetChannels(), SAMPLE_FIFO_SIZE) < 0) {
+            printf("sample_fifo.Init failed\n");
+            return -1;
         }
-        printf("apts:%0.0lf vpts:%0.0lf\n", audio_pts/1000, video_pts/1000);
-        if((video_finish != 1 && audio_pts > video_pts)   // audio和vidoe都还有数据，优先audio（audio_pts > video_pts）
-                ||  (video_finish != 1 && audio_finish == 1)) {
-            read_len = fread(yuv_frame_buf, 1, yuv_frame_size, in_yuv_fd);
-            if(read_len < yuv_frame_size) {
-                video_finish = 1;
-                printf("fread yuv_frame_buf finish\n");
+        PacketQueue video_queue(VIDEO_QUEUE_SIZE);
+        PacketQueue audio_queue(AUDIO_QUEUE_SIZE);
+        std::thread video_thread([&]() {
+            std::vector<AVPacket *> video_packets;
+            StreamClock clock = video_clock;
+            int finish = 0;
+            while(!finish) {
+                int encode_ret = 0;
+                if(yuv_reader.ReadFrame(yuv_frame) < 0) {
+                    finish = 1;
+                    printf("read yuv frame finish, flush video encoder\n");
+                    encode_ret = video_encoder.Encode((AVFrame *)NULL, video_index, clock.GetPts(), video_time_base,
+                                                      video_packets);
+                } else {
+                    encode_ret = video_encoder.Encode(yuv_frame, video_index, clock.GetPts(), video_time_base,
+                                                      video_packets);
+                    av_frame_unref(yuv_frame);
+                }
+                clock.Advance(1);
+                for(size_t i = 0; i < video_packets.size(); i++) {
+                    if(encode_ret < 0 || video_queue.Push(video_packets[i]) < 0) {
+                        FreePacket(&packet_pool, &video_packets[i]);
+                    }
+                }
+                video_packets.clear();
             }
-            if(video_finish != 1) {
-                //                packet = video_encoder.Encode(yuv_frame_buf, yuv_frame_size, video_index,
-                //                                              video_pts, video_time_base);
-                ret = video_encoder.Encode(yuv_frame_buf, yuv_frame_size,
-                                           video_index, video_pts, video_time_base,
-                                           packets);
-            }else {
-                //                packet = video_encoder.Encode(NULL, 0, video_index,
-                //                                              video_pts, video_time_base);
-                printf("flush video encoder\n");
-                ret = video_encoder.Encode(NULL, 0,
-                                           video_index, video_pts, video_time_base,
-                                           packets);
+            video_queue.Finish();
+        });
+        std::thread pcm_thread([&]() {
+            std::vector<uint8_t> chunk_buf(pcm_chunk_samples * pcm_sample_bytes);
+            // 采样率和通道数相同时直接转换写入fifo, 否则先经过重采样
+            int direct = pcm_sample_rate == audio_encoder.GetSampleRate()
+                    && pcm_channels == audio_encoder.GetChannels();
+            AVFrame *resample_frame = direct ? NULL
+                                             : AllocFltpPcmFrame(audio_encoder.GetChannels(), audio_frame_samples);
+            int eof = 0;
+            while(!eof) {
+                size_t samples = fread(chunk_buf.data(), pcm_sample_bytes, pcm_chunk_samples, in_pcm_fd);
+                if(samples < (size_t)pcm_chunk_samples)
+                    eof = 1;
+                if(direct) {
+                    if(samples > 0 && sample_fifo.PushS16Wait((const int16_t *)chunk_buf.data(), (int)samples) < 0)
+                        break;
+                    continue;
+                }
+                if(!resample_frame)
+                    break;
+                if(samples > 0 && audio_resampler.SendS16(chunk_buf.data(), (int)samples) < 0)
+                    break;
+                if(eof && audio_resampler.SendS16(NULL, 0) < 0)
+                    break;
+                int got = 0;
+                while((got = audio_resampler.ReceiveFrame(resample_frame)) > 0) {
+                    if(sample_fifo.PushWait((const float *const *)resample_frame->data,
+                                            resample_frame->nb_samples) < 0) {
+                        eof = 1;
+                        break;
+                    }
+                    resample_frame->nb_samples = audio_frame_samples;
+                }
+                if(got < 0)
+                    break;
             }
-            video_pts += video_frame_duration;  // 叠加pts
-            //            if(packet) {
-            //                mp4_muxer.SendPacket(packet);
-            //            }
-            if(ret >= 0) {
-                for(int i = 0; i < packets.size(); i++) {
-                    ret = mp4_muxer.SendPacket(packets[i]);
+            if(resample_frame)
+                FreePcmFrame(resample_frame);
+            sample_fifo.Finish();
+        });
+        std::thread audio_thread([&]() {
+            std::vector<AVPacket *> audio_packets;
+            StreamClock clock = audio_clock;
+            int finish = 0;
+            while(!finish) {
+                int encode_ret = 0;
+                AVFrame *fltp_frame = fltp_frame_pool.Get();
+                int samples = fltp_frame ? sample_fifo.PopWait((float **)fltp_frame->data, audio_frame_samples) : -1;
+                if(samples > 0)
+                    fltp_frame->nb_samples = samples;   // 最后一帧可能不满
+                if(samples <= 0) {
+                    finish = 1;
+                    printf("fread pcm_frame_buf finish, flush audio encoder\n");
+                    encode_ret = audio_encoder.Encode(NULL, audio_index, clock.GetPts(), audio_time_base,
+                                                      audio_packets);
+                } else {
+                    encode_ret = audio_encoder.Encode(fltp_frame, audio_index, clock.GetPts(), audio_time_base,
+                                                      audio_packets);
+                }
+                fltp_frame_pool.Release(fltp_frame);
+                clock.Advance(audio_frame_samples);
+                for(size_t i = 0; i < audio_packets.size(); i++) {
+                    if(encode_ret < 0 || audio_queue.Push(audio_packets[i]) < 0) {
+                        FreePacket(&packet_pool, &audio_packets[i]);
+                    }
                 }
+                audio_packets.clear();
             }
-            packets.clear();
-        } else if(audio_finish != 1) {
-            read_len = fread(pcm_frame_buf, 1, pcm_frame_size, in_pcm_fd);
-            if(read_len < pcm_frame_size) {
-                audio_finish = 1;
-                printf("fread pcm_frame_buf finish\n");
+            // 编码线程提前退出时让读取线程不再等待
+            sample_fifo.Abort();
+            audio_queue.Finish();
+        });
+        ret = mp4_muxer.SendPackets(&video_queue, &audio_queue);
+        if(ret < 0) {
+            printf("mp4_muxer.SendPackets failed\n");
+        }
+        video_thread.join();
+        audio_thread.join();
+        pcm_thread.join();
+    } else {
+        while (1) {
+            if(audio_finish && video_finish) {
+                break;
             }
+            int64_t audio_pts = audio_clock.GetPts();
+            int64_t video_pts = video_clock.GetPts();
+            LogDebug("apts:%" PRId64 " vpts:%" PRId64 "\n", audio_pts, video_pts);
+            if((video_finish != 1 && av_compare_ts(audio_pts, audio_clock.GetTimeBase(),
+                                                   video_pts, video_clock.GetTimeBase()) > 0)   // audio和vidoe都还有数据，优先audio（audio_pts > video_pts）
+                    ||  (video_finish != 1 && audio_finish == 1)) {
+                if(yuv_reader.ReadFrame(yuv_frame) < 0) {
+                    video_finish = 1;
+                    printf("read yuv frame finish\n");
+                }
+                if(video_finish != 1) {
+                    //                packet = video_encoder.Encode(yuv_frame_buf, yuv_frame_size, video_index,
+                    //                                              video_pts, video_time_base);
+                    ret = video_encoder.Encode(yuv_frame,
+                                               video_index, video_pts, video_time_base,
+                                               packets);
+                    av_frame_unref(yuv_frame);
+                }else {
+                    //                packet = video_encoder.Encode(NULL, 0, video_index,
+                    //                                              video_pts, video_time_base);
+                    printf("flush video encoder\n");
+                    ret = video_encoder.Encode((AVFrame *)NULL,
+                                               video_index, video_pts, video_time_base,
+                                               packets);
+                }
+                video_clock.Advance(1);  // 叠加帧数
+                //            if(packet) {
+                //                mp4_muxer.SendPacket(packet);
+                //            }
+                if(ret >= 0) {
+                    for(int i = 0; i < packets.size(); i++) {
+                        ret = mp4_muxer.SendPacket(packets[i]);
+                    }
+                }
+                packets.clear();
+            } else if(audio_finish != 1) {
+                AVFrame *fltp_frame = fltp_frame_pool.Get();
+                if(!fltp_frame || read_audio_frame(fltp_frame) <= 0) {
+                    audio_finish = 1;
+                    printf("fread pcm_frame_buf finish\n");
+                }
 
-            if(audio_finish != 1) {
-                AVFrame *fltp_frame = AllocFltpPcmFrame(pcm_channels, audio_encoder.GetFrameSize());
-                ret = audio_resampler.ResampleFromS16ToFLTP(pcm_frame_buf, fltp_frame);
-                if(ret < 0)
-                    printf("ResampleFromS16ToFLTP error\n");
-                //                packet = audio_encoder.Encode(fltp_frame, audio_index,
-                //                                              audio_pts, audio_time_base);
-                ret = audio_encoder.Encode(fltp_frame,
-                                           audio_index, audio_pts, audio_time_base,
-                                           packets);
-                FreePcmFrame(fltp_frame);
-            }else {
-                printf("flush audio encoder\n");
-                //                packet = audio_encoder.Encode(NULL,video_index,
-                //                                              audio_pts, audio_time_base);
-                ret = audio_encoder.Encode(NULL,
-                                           audio_index, audio_pts, audio_time_base,
-                                           packets);
-            }
-            audio_pts += audio_frame_duration;  // 叠加pts
-            //            if(packet) {
-            //                mp4_muxer.SendPacket(packet);
-            //            }
-            if(ret >= 0) {
-                for(int i = 0; i < packets.size(); i++) {
-                    ret = mp4_muxer.SendPacket(packets[i]);
+                if(audio_finish != 1) {
+                    //                packet = audio_encoder.Encode(fltp_frame, audio_index,
+                    //                                              audio_pts, audio_time_base);
+                    ret = audio_encoder.Encode(fltp_frame,
+                                               audio_index, audio_pts, audio_time_base,
+                                               packets);
+                    fltp_frame_pool.Release(fltp_frame);
+                }else {
+                    fltp_frame_pool.Release(fltp_frame);
+                    printf("flush audio encoder\n");
+                    //                packet = audio_encoder.Encode(NULL,video_index,
+                    //                                              audio_pts, audio_time_base);
+                    ret = audio_encoder.Encode(NULL,
+                                               audio_index, audio_pts, audio_time_base,
+                                               packets);
                 }
+                audio_clock.Advance(audio_frame_samples);  // 叠加采样点数
+                //            if(packet) {
+                //                mp4_muxer.SendPacket(packet);
+                //            }
+                if(ret >= 0) {
+                    for(int i = 0; i < packets.size(); i++) {
+                        ret = mp4_muxer.SendPacket(packets[i]);
+                    }
+                }
+                packets.clear();
             }
-            packets.clear();
         }
     }
+    int exit_ret = 0;
     ret = mp4_muxer.SendTrailer();
     if(ret < 0)
     {
         printf("mp4_muxer.SendTrailer failed\n");
+        exit_ret = -1;
     }
 
-    printf("write mp4 finish\n");
+    if(memory_output) {
+        // av_write_trailer已经把avio缓冲刷到了memory_sink
+        FILE *out_fd = fopen(out_mp4_name, "wb");
+        if(out_fd) {
+            for(int i = 0; i < memory_sink.GetChunkCount(); i++) {
+                int chunk_size = 0;
+                const uint8_t *chunk = memory_sink.GetChunk(i, &chunk_size);
+                fwrite(chunk, 1, chunk_size, out_fd);
+            }
+            fclose(out_fd);
+        }
+        printf("memory output size:%" PRId64 "\n", memory_sink.GetSize());
+    }
+    printf("write mp4 finish, mux queue peak packets:%d bytes:%" PRId64 "\n",
+           mp4_muxer.GetPeakQueueDepth(), mp4_muxer.GetPeakQueueBytes());
+    // 关闭输出, FileSink(direct/uring/iobuf)在这里写出最后一块缓冲(包括moov), 失败时文件不完整
+    if(mp4_muxer.DeInit() < 0)
+        exit_ret = -1;
+    if(live)
+        printf("video encode latency p50:%.2fms p99:%.2fms\n",
+               video_encoder.GetLatencyPercentile(50), video_encoder.GetLatencyPercentile(99));
 
-    if(yuv_frame_buf)
-        free(yuv_frame_buf);
+    if(yuv_frame)
+        av_frame_free(&yuv_frame);
     if(pcm_frame_buf)
         free(pcm_frame_buf);
-    if(in_yuv_fd)
-        fclose(in_yuv_fd);
+    yuv_reader.Close();
     if(in_pcm_fd)
         fclose(in_pcm_fd);
 
-    return 0;
+    return exit_ret;
 }
 
 
@@ -0,0 +1,120 @@
+#include "memorysink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+extern "C"
+{
+#include "libavformat/avio.h"
+}
+
+MemorySink::MemorySink(int chunk_size)
+{
+    chunk_size_ = chunk_size > 0 ? chunk_size : 1024 * 1024;
+}
+
+MemorySink::~MemorySink()
+{
+    Reset();
+}
+
+int MemorySink::Write(const uint8_t *data, int size)
+{
+    int written = 0;
+    while(written < size) {
+        size_t index = pos_ / chunk_size_;
+        size_t offset = pos_ % chunk_size_;
+        while(chunks_.size() <= index) {
+            // 新块清0, seek越过结尾时中间的空洞读出来是0
+            uint8_t *chunk = (uint8_t *)calloc(1, chunk_size_);
+            if(!chunk) {
+                printf("alloc memory chunk failed\n");
+                return -1;
+            }
+            chunks_.push_back(chunk);
+        }
+        size_t len = chunk_size_ - offset;
+        if(len > (size_t)(size - written))
+            len = size - written;
+        memcpy(chunks_[index] + offset, data + written, len);
+        written += len;
+        pos_ += len;
+    }
+    if(pos_ > size_)
+        size_ = pos_;
+    return written;
+}
+
+int64_t MemorySink::Seek(int64_t offset, int whence)
+{
+    switch(whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return size_;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += pos_;
+        break;
+    case SEEK_END:
+        offset += size_;
+        break;
+    default:
+        return -1;
+    }
+    if(offset < 0)
+        return -1;
+    pos_ = offset;
+    return pos_;
+}
+
+int MemorySink::Close()
+{
+    return 0;
+}
+
+void MemorySink::Reset()
+{
+    for(size_t i = 0; i < chunks_.size(); i++)
+        free(chunks_[i]);
+    chunks_.clear();
+    pos_ = 0;
+    size_ = 0;
+}
+
+int64_t MemorySink::GetSize()
+{
+    return size_;
+}
+
+int MemorySink::GetChunkCount()
+{
+    return (int)((size_ + chunk_size_ - 1) / chunk_size_);
+}
+
+const uint8_t *MemorySink::GetChunk(int index, int *size)
+{
+    if(index < 0 || index >= GetChunkCount()) {
+        *size = 0;
+        return NULL;
+    }
+    int64_t remain = size_ - (int64_t)index * chunk_size_;
+    *size = remain < (int64_t)chunk_size_ ? (int)remain : (int)chunk_size_;
+    return chunks_[index];
+}
+
+int MemorySink::Read(int64_t offset, uint8_t *buf, int size)
+{
+    int read_len = 0;
+    while(read_len < size && offset < size_) {
+        size_t index = offset / chunk_size_;
+        size_t chunk_offset = offset % chunk_size_;
+        int64_t len = chunk_size_ - chunk_offset;
+        if(len > size - read_len)
+            len = size - read_len;
+        if(len > size_ - offset)
+            len = size_ - offset;
+        memcpy(buf + read_len, chunks_[index] + chunk_offset, len);
+        read_len += len;
+        offset += len;
+    }
+    return read_len;
+}
@@ -0,0 +1,32 @@
+#ifndef MEMORYSINK_H
+#define MEMORYSINK_H
+#include <stddef.h>
+#include <vector>
+#include "outputsink.h"
+
+// 内存输出: 按固定大小分块增长, 不需要整体realloc拷贝; 支持seek回去修改(mp4写trailer时改mdat/moov大小)
+// Close后数据仍然保留, 直接交给下一个处理环节, 不经过磁盘
+class MemorySink : public OutputSink
+{
+public:
+    MemorySink(int chunk_size = 1024 * 1024);
+    ~MemorySink();
+    int Write(const uint8_t *data, int size) override;
+    int64_t Seek(int64_t offset, int whence) override;
+    int Close() override;
+    // 释放所有数据, 可以重新写入
+    void Reset();
+    int64_t GetSize();
+    // 按块访问, 不拷贝; 最后一块的有效长度可能小于chunk_size
+    int GetChunkCount();
+    const uint8_t *GetChunk(int index, int *size);
+    // 从offset读取最多size字节, 返回实际读取的长度
+    int Read(int64_t offset, uint8_t *buf, int size);
+private:
+    std::vector<uint8_t *> chunks_;
+    size_t chunk_size_ = 0;
+    int64_t pos_ = 0;
+    int64_t size_ = 0;
+};
+
+#endif // MEMORYSINK_H
@@ -1,4 +1,6 @@
 #include "muxer.h"
+#include "logger.h"
+#include "faststart.h"
 
 
 Muxer::Muxer()
@@ -8,7 +10,8 @@ Muxer::Muxer()
 
 Muxer::~Muxer()
 {
-
+    // 没有调用DeInit时也要关闭输出, FileSink需要在Close里写出最后一块缓冲
+    DeInit();
 }
 
 int Muxer::Init(const char *url)
@@ -24,8 +27,30 @@ int Muxer::Init(const char *url)
     return 0;
 }
 
-void Muxer::DeInit()
+int Muxer::Init(const char *format_name, OutputSink *sink)
+{
+    if(!sink) {
+        printf("sink is NULL\n");
+        return -1;
+    }
+    int ret = avformat_alloc_output_context2(&fmt_ctx_, NULL, format_name, NULL);
+    if(ret < 0) {
+        char errbuf[1024] = {0};
+        av_strerror(ret, errbuf, sizeof(errbuf) - 1);
+        printf("avformat_alloc_output_context2 %s failed:%s\n", format_name, errbuf);
+        return -1;
+    }
+    url_ = "";
+    sink_ = sink;
+    own_sink_ = 0;
+    use_file_sink_ = 0;
+    return 0;
+}
+
+int Muxer::DeInit()
 {
+    ClearQueues();
+    int ret = CloseIO();
     if(fmt_ctx_) {
         avformat_close_input(&fmt_ctx_);
     }
@@ -37,6 +62,14 @@ void Muxer::DeInit()
     vid_codec_ctx_ = NULL;
     vid_stream_ = NULL;
     video_index_ = -1;
+    video_rescale_ = 1;
+    audio_rescale_ = 1;
+    peak_queue_depth_ = 0;
+    peak_queue_bytes_ = 0;
+    fragment_start_dts_ = AV_NOPTS_VALUE;
+    video_end_dts_ = AV_NOPTS_VALUE;
+    fragment_count_ = 0;
+    return ret;
 }
 
 int Muxer::AddStream(AVCodecContext *codec_ctx)
@@ -55,6 +88,8 @@ int Muxer::AddStream(AVCodecContext *codec_ctx)
         return -1;
     }
     //    st->codecpar->codec_tag = 0;
+    // 建议复用器使用编码器的time_base, 一致时写packet不需要转换时间基
+    st->time_base = codec_ctx->time_base;
     // 从编码器上下文复制
     avcodec_parameters_from_context(st->codecpar, codec_ctx);
     av_dump_format(fmt_ctx_, 0, url_.c_str(), 1);
@@ -78,47 +113,188 @@ int Muxer::SendHeader()
         printf("fmt ctx is NULL\n");
         return -1;
     }
-    int ret = avformat_write_header(fmt_ctx_, NULL);
+    AVDictionary *opts = NULL;
+    if(fragment_duration_ > 0) {
+        // frag_custom: 只有调用av_write_frame(NULL)时才输出分片, 由CheckFragment控制切分位置
+        std::string movflags = "frag_custom+empty_moov+default_base_moof";
+        if(cmaf_)
+            movflags += "+cmaf";
+        // 分片单独成文件时不写mfra, 它的偏移是相对整个流的, 放在最后一个切片里是错的
+        if(skip_trailer_)
+            movflags += "+skip_trailer";
+        av_dict_set(&opts, "movflags", movflags.c_str(), 0);
+    }
+    moov_reserved_ = 0;
+    if(faststart_ && fragment_duration_ <= 0 && faststart_duration_ > 0) {
+        double video_fps = vid_codec_ctx_ ? av_q2d(vid_codec_ctx_->framerate) : 0;
+        double audio_fps = (aud_codec_ctx_ && aud_codec_ctx_->frame_size > 0) ?
+                    (double)aud_codec_ctx_->sample_rate / aud_codec_ctx_->frame_size : 0;
+        int64_t moov_size = EstimateMoovSize(faststart_duration_, video_fps, audio_fps);
+        av_dict_set_int(&opts, "moov_size", moov_size, 0);
+        moov_reserved_ = 1;
+        printf("reserve moov size:%" PRId64 "\n", moov_size);
+    }
+    int ret = avformat_write_header(fmt_ctx_, &opts);
+    av_dict_free(&opts);
     if(ret < 0) {
         char errbuf[1024] = {0};
         av_strerror(ret, errbuf, sizeof(errbuf) - 1);
         printf("avformat_write_header failed:%s\n", errbuf);
         return -1;
     }
+    if(fragment_duration_ > 0) {
+        avio_flush(fmt_ctx_->pb);   // 分片模式下ftyp+moov作为初始化段立即输出
+    }
+    // write header后流的time_base才最终确定
+    video_rescale_ = !(vid_stream_ && vid_codec_ctx_
+                       && av_cmp_q(vid_stream_->time_base, vid_codec_ctx_->time_base) == 0);
+    audio_rescale_ = !(aud_stream_ && aud_codec_ctx_
+                       && av_cmp_q(aud_stream_->time_base, aud_codec_ctx_->time_base) == 0);
     return 0;
 }
 
 int Muxer::SendPacket(AVPacket *packet)
 {
     int stream_index = packet->stream_index;
-    printf("index:%d, pts:%lld\n", stream_index, packet->pts);
+    LogDebug("index:%d, pts:%" PRId64 "\n", stream_index, packet->pts);
 
     if(!packet || packet->size <= 0 || !packet->data) {
         printf("packet is null\n");
         if(packet)
-            av_packet_free(&packet);
+            FreePacket(packet_pool_, &packet);
 
         return -1;
     }
 
-    AVRational src_time_base;   // 编码后的包
-    AVRational dst_time_base;   // mp4输出文件对应流的time_base
+    AVRational src_time_base = {1, 1};   // 编码后的包
+    AVRational dst_time_base = {1, 1};   // mp4输出文件对应流的time_base
+    int need_rescale = 1;
     if(vid_stream_ && vid_codec_ctx_ && stream_index == video_index_) {
         src_time_base = vid_codec_ctx_->time_base;
         dst_time_base = vid_stream_->time_base;
+        need_rescale = video_rescale_;
     } else if(aud_stream_ && aud_codec_ctx_ && stream_index == audio_index_) {
         src_time_base = aud_codec_ctx_->time_base;
         dst_time_base = aud_stream_->time_base;
+        need_rescale = audio_rescale_;
     }
-    // 时间基转换
-    packet->pts = av_rescale_q(packet->pts, src_time_base, dst_time_base);
-    packet->dts = av_rescale_q(packet->dts, src_time_base, dst_time_base);
-    packet->duration = av_rescale_q(packet->duration, src_time_base, dst_time_base);
+    // 时间基转换, 两者一致时(SendHeader时已经判断)跳过
+    if(need_rescale) {
+        packet->pts = av_rescale_q(packet->pts, src_time_base, dst_time_base);
+        packet->dts = av_rescale_q(packet->dts, src_time_base, dst_time_base);
+        packet->duration = av_rescale_q(packet->duration, src_time_base, dst_time_base);
+    }
+
+    // 不再用av_interleaved_write_frame, 它内部缓存多少数据不可控; 改为muxer自己的有界队列
+    std::deque<AVPacket *> *queue = GetQueue(stream_index);
+    if(!queue) {
+        return WritePacket(packet);
+    }
+    queue->push_back(packet);
+    queue_bytes_ += packet->size;
+    int depth = (int)(video_packets_.size() + audio_packets_.size());
+    if(depth > peak_queue_depth_)
+        peak_queue_depth_ = depth;
+    if(queue_bytes_ > peak_queue_bytes_)
+        peak_queue_bytes_ = queue_bytes_;
+    return WriteInterleaved(0);
+}
 
+int Muxer::WriteInterleaved(int flush)
+{
     int ret = 0;
-    ret = av_interleaved_write_frame(fmt_ctx_, packet); // 不是立即写入文件，内部缓存，主要是对pts进行排序
-    //    ret = av_write_frame(fmt_ctx_, packet);
-    av_packet_free(&packet);
+    while(1) {
+        std::deque<AVPacket *> *queue = NULL;
+        if(!video_packets_.empty() && !audio_packets_.empty()) {
+            // 两路都有数据, 先写dts小的, 之后到达的packet dts不会比它小
+            AVPacket *video_packet = video_packets_.front();
+            AVPacket *audio_packet = audio_packets_.front();
+            if(av_compare_ts(video_packet->dts, GetStreamTimeBase(video_index_),
+                             audio_packet->dts, GetStreamTimeBase(audio_index_)) <= 0) {
+                queue = &video_packets_;
+            } else {
+                queue = &audio_packets_;
+            }
+        } else if(!video_packets_.empty() || !audio_packets_.empty()) {
+            queue = video_packets_.empty() ? &audio_packets_ : &video_packets_;
+            int stream_index = queue->front()->stream_index;
+            int other_exist = (stream_index == video_index_) ? (audio_index_ >= 0) : (video_index_ >= 0);
+            int64_t delta = av_rescale_q(queue->back()->dts - queue->front()->dts,
+                                         GetStreamTimeBase(stream_index), AVRational{1, AV_TIME_BASE});
+            // 另一路还没有数据, 没有超出上限时继续等待
+            if(!flush && other_exist && delta <= max_interleave_delta_
+                    && (int)queue->size() <= max_queue_packets_) {
+                break;
+            }
+        } else {
+            break;
+        }
+        AVPacket *packet = queue->front();
+        queue->pop_front();
+        queue_bytes_ -= packet->size;
+        if(WritePacket(packet) < 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+int Muxer::CheckFragment(AVPacket *packet)
+{
+    if(fragment_duration_ <= 0 || packet->stream_index != video_index_
+            || !(packet->flags & AV_PKT_FLAG_KEY)) {
+        return 0;
+    }
+    if(fragment_start_dts_ == AV_NOPTS_VALUE) {
+        fragment_start_dts_ = packet->dts;
+        return 0;
+    }
+    int64_t duration = av_rescale_q(packet->dts - fragment_start_dts_,
+                                    GetStreamTimeBase(video_index_), AVRational{1, AV_TIME_BASE});
+    if(duration < fragment_duration_) {
+        return 0;
+    }
+    // 写出当前分片的moof+mdat, 并把avio缓冲刷到文件, 复用器不再保留这个分片的数据
+    int ret = av_write_frame(fmt_ctx_, NULL);
+    if(ret < 0) {
+        char errbuf[1024] = {0};
+        av_strerror(ret, errbuf, sizeof(errbuf) - 1);
+        printf("flush fragment failed:%s\n", errbuf);
+        return -1;
+    }
+    avio_flush(fmt_ctx_->pb);
+    NotifyFragment(packet->dts);
+    fragment_start_dts_ = packet->dts;
+    fragment_count_++;
+    LogDebug("fragment %d flushed, duration:%" PRId64 "us\n", fragment_count_, duration);
+    return 0;
+}
+
+void Muxer::NotifyFragment(int64_t end_dts)
+{
+    if(!fragment_cb_ || fragment_start_dts_ == AV_NOPTS_VALUE)
+        return;
+    AVRational time_base = GetStreamTimeBase(video_index_);
+    fragment_cb_(fragment_opaque_, fragment_count_,
+                 av_rescale_q(fragment_start_dts_, time_base, AVRational{1, AV_TIME_BASE}),
+                 av_rescale_q(end_dts - fragment_start_dts_, time_base, AVRational{1, AV_TIME_BASE}));
+}
+
+int Muxer::WritePacket(AVPacket *packet)
+{
+    if(CheckFragment(packet) < 0) {
+        FreePacket(packet_pool_, &packet);
+        return -1;
+    }
+    if(fragment_duration_ > 0 && packet->stream_index == video_index_) {
+        // 记录视频结束时间, 最后一个分片的时长要用到
+        int64_t duration = packet->duration;
+        if(duration <= 0 && vid_codec_ctx_ && vid_codec_ctx_->framerate.num > 0)
+            duration = av_rescale_q(1, av_inv_q(vid_codec_ctx_->framerate), GetStreamTimeBase(video_index_));
+        video_end_dts_ = packet->dts + duration;
+    }
+    int ret = av_write_frame(fmt_ctx_, packet);
+    FreePacket(packet_pool_, &packet);
     if(ret == 0) {
         return 0;
     } else {
@@ -129,24 +305,115 @@ int Muxer::SendPacket(AVPacket *packet)
     }
 }
 
+std::deque<AVPacket *> *Muxer::GetQueue(int stream_index)
+{
+    if(stream_index == video_index_ && video_index_ >= 0)
+        return &video_packets_;
+    if(stream_index == audio_index_ && audio_index_ >= 0)
+        return &audio_packets_;
+    return NULL;
+}
+
+AVRational Muxer::GetStreamTimeBase(int stream_index)
+{
+    return fmt_ctx_->streams[stream_index]->time_base;
+}
+
+void Muxer::ClearQueues()
+{
+    while(!video_packets_.empty()) {
+        FreePacket(packet_pool_, &video_packets_.front());
+        video_packets_.pop_front();
+    }
+    while(!audio_packets_.empty()) {
+        FreePacket(packet_pool_, &audio_packets_.front());
+        audio_packets_.pop_front();
+    }
+    queue_bytes_ = 0;
+}
+
 int Muxer::SendTrailer()
 {
     if(!fmt_ctx_) {
         printf("fmt ctx is NULL\n");
         return -1;
     }
-    int ret = av_write_trailer(fmt_ctx_);
+    int ret = WriteInterleaved(1);
+    if(ret < 0) {
+        printf("write queued packets failed\n");
+    }
+    ret = av_write_trailer(fmt_ctx_);
     if(ret != 0) {
         char errbuf[1024] = {0};
         av_strerror(ret, errbuf, sizeof(errbuf) - 1);
         printf("av_write_trailer failed:%s\n", errbuf);
         return -1;
     }
+    if(fragment_duration_ > 0) {
+        // av_write_trailer已经输出最后一个分片并刷新了avio
+        NotifyFragment(video_end_dts_);
+        fragment_start_dts_ = AV_NOPTS_VALUE;
+    }
+    if(faststart_ && fragment_duration_ <= 0 && !moov_reserved_ && url_.empty()) {
+        printf("faststart without reserved moov needs a file output\n");
+    } else if(faststart_ && fragment_duration_ <= 0 && !moov_reserved_) {
+        // 先关闭avio, 保证数据都写到文件后再搬移moov
+        if(CloseIO() < 0)
+            return -1;
+        ret = MoveMoovToFront(url_.c_str());
+        if(ret == -2) {
+            printf("move moov to front failed, %s is corrupted\n", url_.c_str());
+            return -1;
+        } else if(ret < 0) {
+            printf("move moov to front failed, %s keeps moov at the end\n", url_.c_str());
+            return -1;
+        }
+    }
     return 0;
 }
 
+int Muxer::SendPackets(PacketQueue *video_queue, PacketQueue *audio_queue)
+{
+    int ret = 0;
+    while(1) {
+        // 两个队列都有数据时才能判断先写哪一个, 否则阻塞等待
+        AVPacket *video_packet = video_queue ? video_queue->Peek() : NULL;
+        AVPacket *audio_packet = audio_queue ? audio_queue->Peek() : NULL;
+        if(!video_packet && !audio_packet) {
+            break;
+        }
+        PacketQueue *queue = NULL;
+        if(!audio_packet) {
+            queue = video_queue;
+        } else if(!video_packet) {
+            queue = audio_queue;
+        } else if(av_compare_ts(video_packet->dts, vid_codec_ctx_->time_base,
+                                audio_packet->dts, aud_codec_ctx_->time_base) <= 0) {
+            queue = video_queue;
+        } else {
+            queue = audio_queue;
+        }
+        if(SendPacket(queue->Pop()) < 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
 int Muxer::Open()
 {
+    if(use_file_sink_) {
+        FileSink *file_sink = new FileSink();
+        if(file_sink->Open(url_.c_str(), file_sink_config_) < 0) {
+            delete file_sink;
+            return -1;
+        }
+        sink_ = file_sink;
+        own_sink_ = 1;
+    }
+    if(sink_) {
+        return OpenSink();
+    }
     int ret = avio_open(&fmt_ctx_->pb, url_.c_str(), AVIO_FLAG_WRITE);
     if(ret < 0) {
         char errbuf[1024] = {0};
@@ -168,6 +435,16 @@ int Muxer::GetVideoStreamIndex()
     return video_index_;
 }
 
+void Muxer::SetPacketPool(PacketPool *pool)
+{
+    packet_pool_ = pool;
+}
+
+
+
+
+
+
 
 
 
@@ -185,7 +462,119 @@ int Muxer::GetVideoStreamIndex()
 
 
 
+void Muxer::SetMaxInterleaveDelta(int64_t max_delta_us, int max_packets)
+{
+    max_interleave_delta_ = max_delta_us;
+    max_queue_packets_ = max_packets;
+}
+
+int Muxer::GetQueueDepth(int stream_index)
+{
+    std::deque<AVPacket *> *queue = GetQueue(stream_index);
+    return queue ? (int)queue->size() : 0;
+}
+
+int64_t Muxer::GetQueueBytes()
+{
+    return queue_bytes_;
+}
+
+int Muxer::GetPeakQueueDepth()
+{
+    return peak_queue_depth_;
+}
+
+int64_t Muxer::GetPeakQueueBytes()
+{
+    return peak_queue_bytes_;
+}
+
+void Muxer::SetFragmentDuration(int64_t duration_us, int cmaf)
+{
+    fragment_duration_ = duration_us;
+    cmaf_ = cmaf;
+}
+
+int Muxer::GetFragmentCount()
+{
+    return fragment_count_;
+}
+
+void Muxer::SetFragmentCallback(FragmentCallback callback, void *opaque, int skip_trailer)
+{
+    fragment_cb_ = callback;
+    fragment_opaque_ = opaque;
+    skip_trailer_ = skip_trailer;
+}
+
+void Muxer::SetFaststart(int64_t duration_us)
+{
+    faststart_ = 1;
+    faststart_duration_ = duration_us;
+}
+
+void Muxer::SetFileSinkConfig(const FileSinkConfig &config)
+{
+    file_sink_config_ = config;
+    use_file_sink_ = 1;
+}
 
+int Muxer::OpenSink()
+{
+    uint8_t *io_buffer = (uint8_t *)av_malloc(SINK_IO_BUFFER_SIZE);
+    if(!io_buffer) {
+        printf("av_malloc io buffer failed\n");
+        return -1;
+    }
+    AVIOContext *avio_ctx = avio_alloc_context(io_buffer, SINK_IO_BUFFER_SIZE, 1, sink_,
+                                               NULL, WriteSink, SeekSink);
+    if(!avio_ctx) {
+        printf("avio_alloc_context failed\n");
+        av_free(io_buffer);
+        return -1;
+    }
+    fmt_ctx_->pb = avio_ctx;
+    fmt_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+    return 0;
+}
 
+int Muxer::CloseIO()
+{
+    int ret = 0;
+    if(fmt_ctx_ && fmt_ctx_->pb) {
+        if(sink_) {
+            avio_flush(fmt_ctx_->pb);
+            if(fmt_ctx_->pb->error < 0)
+                ret = -1;
+            av_freep(&fmt_ctx_->pb->buffer);
+            avio_context_free(&fmt_ctx_->pb);
+        } else if(avio_closep(&fmt_ctx_->pb) < 0) {
+            ret = -1;
+        }
+    }
+    if(sink_) {
+        if(sink_->Close() < 0)
+            ret = -1;
+        if(own_sink_)
+            delete sink_;
+        sink_ = NULL;
+        own_sink_ = 0;
+    }
+    if(ret < 0)
+        printf("close output %s failed\n", url_.c_str());
+    return ret;
+}
 
+int Muxer::WriteSink(void *opaque, uint8_t *buf, int buf_size)
+{
+    OutputSink *sink = (OutputSink *)opaque;
+    int ret = sink->Write(buf, buf_size);
+    return ret < 0 ? AVERROR(EIO) : ret;
+}
 
+int64_t Muxer::SeekSink(void *opaque, int64_t offset, int whence)
+{
+    OutputSink *sink = (OutputSink *)opaque;
+    int64_t ret = sink->Seek(offset, whence);
+    return ret < 0 ? AVERROR(EINVAL) : ret;
+}
@@ -1,11 +1,16 @@
 #ifndef MUXER_H
 #define MUXER_H
 #include <iostream>
+#include <deque>
 extern "C"
 {
 #include "libavformat/avformat.h"
 #include "libavcodec/avcodec.h"
 }
+#include "packetqueue.h"
+#include "packetpool.h"
+#include "outputsink.h"
+#include "filesink.h"
 
 
 class Muxer
@@ -16,21 +21,96 @@ public:
     // 输出文件 返回<0值异常
     // 初始化
     int Init(const char *url);
-    // 资源释放
-    void DeInit();
+    // 输出到sink(比如MemorySink/CallbackSink)而不是文件, format_name如"mp4"
+    // sink由调用者释放, 需要在DeInit之后
+    int Init(const char *format_name, OutputSink *sink);
+    // 资源释放, 关闭输出(FileSink在这里写出最后一块缓冲), 关闭失败返回<0, 这时输出文件不完整
+    // 析构时也会调用
+    int DeInit();
     // 创建流
     int AddStream(AVCodecContext *codec_ctx);
 
     // 写流
     int SendHeader();
+    // packet先进入对应流的队列, 按dts交错后用av_write_frame写出; packet的所有权交给muxer
     int SendPacket(AVPacket *packet);
+    // 先写出队列中剩余的packet
     int SendTrailer();
+    // 多线程模式: 从音视频队列中按dts顺序取出packet写入, 直到两个队列都结束
+    int SendPackets(PacketQueue *video_queue, PacketQueue *audio_queue);
 
     int Open(); // avio open
+    // 设置后Open时用FileSink(大块对齐写/O_DIRECT/io_uring)代替avio_open, 需要在Open之前调用
+    void SetFileSinkConfig(const FileSinkConfig &config);
 
     int GetAudioStreamIndex();
     int GetVideoStreamIndex();
+    // 设置后packet从对象池分配/回收, 不设置则直接av_packet_alloc/av_packet_free
+    void SetPacketPool(PacketPool *pool);
+    // 某个流的队列头尾跨度超过max_delta_us(或包数超过max_packets)而另一个流还没有数据时,
+    // 不再等待直接写出, 保证每路输出缓存的数据有上限
+    void SetMaxInterleaveDelta(int64_t max_delta_us, int max_packets = 1024);
+    // 分片mp4(cmaf为1时输出CMAF兼容的分片), 需要在SendHeader之前调用, duration_us为0时输出普通mp4
+    // 只在视频关键帧处切分, 分片时长是GOP的整数倍(>=duration_us), 每个分片完成后立即写到文件
+    // 视频没有周期关键帧(比如帧内刷新的直播模式)时不会切分, 调用者需要避免这种组合
+    void SetFragmentDuration(int64_t duration_us, int cmaf = 1);
+    int GetFragmentCount();
+    // 每个分片写出(avio已经flush)后调用, index从0开始, 时间单位us; 最后一个分片在SendTrailer里回调
+    typedef void (*FragmentCallback)(void *opaque, int index, int64_t start_us, int64_t duration_us);
+    // skip_trailer为1时(每个分片单独保存成切片)SendTrailer不再写mfra, 每个切片只有moof+mdat, 需要在SendHeader之前调用
+    void SetFragmentCallback(FragmentCallback callback, void *opaque, int skip_trailer = 0);
+    // moov写在文件开头, 需要在SendHeader之前调用, 分片模式下无效
+    // duration_us>0: 按时长和帧率预留moov空间, 写trailer时直接写到预留的位置, 不需要额外的读写
+    // duration_us为0(时长未知): SendTrailer之后在原文件上把moov搬到mdat前面
+    void SetFaststart(int64_t duration_us);
+    // 队列统计: 当前缓存的packet数/字节数, 以及运行以来的峰值
+    int GetQueueDepth(int stream_index);
+    int64_t GetQueueBytes();
+    int GetPeakQueueDepth();
+    int64_t GetPeakQueueBytes();
 private:
+    enum { SINK_IO_BUFFER_SIZE = 256 * 1024 };
+    // 通过avio_alloc_context把sink_接到复用器上
+    int OpenSink();
+    // 关闭输出, 自定义io时释放AVIOContext并关闭sink_, 失败返回<0
+    int CloseIO();
+    static int WriteSink(void *opaque, uint8_t *buf, int buf_size);
+    static int64_t SeekSink(void *opaque, int64_t offset, int whence);
+    std::deque<AVPacket *> *GetQueue(int stream_index);
+    AVRational GetStreamTimeBase(int stream_index);
+    // flush为1时写出所有缓存的packet
+    int WriteInterleaved(int flush);
+    int WritePacket(AVPacket *packet);
+    // 分片模式下在视频关键帧前判断是否需要结束当前分片
+    int CheckFragment(AVPacket *packet);
+    // 当前分片结束于end_dts(视频流time_base), 通知fragment_cb_
+    void NotifyFragment(int64_t end_dts);
+    void ClearQueues();
+
+    std::deque<AVPacket *> video_packets_;
+    std::deque<AVPacket *> audio_packets_;
+    int64_t max_interleave_delta_ = AV_TIME_BASE;   // 单位us, 默认1秒
+    int max_queue_packets_ = 1024;
+    int64_t queue_bytes_ = 0;
+    int peak_queue_depth_ = 0;
+    int64_t peak_queue_bytes_ = 0;
+    int64_t fragment_duration_ = 0;   // 单位us, 0表示不分片
+    int cmaf_ = 0;
+    int64_t fragment_start_dts_ = AV_NOPTS_VALUE;
+    int fragment_count_ = 0;
+    int64_t video_end_dts_ = AV_NOPTS_VALUE;  // 最后写出的视频帧dts+duration
+    FragmentCallback fragment_cb_ = NULL;
+    void *fragment_opaque_ = NULL;
+    int skip_trailer_ = 0;
+    int faststart_ = 0;
+    int64_t faststart_duration_ = 0;
+    int moov_reserved_ = 0;
+    OutputSink *sink_ = NULL;
+    int own_sink_ = 0;      // sink_由muxer创建时DeInit负责释放
+    int use_file_sink_ = 0;
+    FileSinkConfig file_sink_config_;
+
+    PacketPool *packet_pool_ = NULL;
     AVFormatContext *fmt_ctx_ = NULL;
     std::string url_ = "";
 
@@ -42,6 +122,9 @@ private:
 
     int audio_index_ = -1;
     int video_index_ = -1;
+    // 编码器和输出流的time_base不一致时才需要转换
+    int audio_rescale_ = 1;
+    int video_rescale_ = 1;
 };
 
 #endif // MUXER_H
@@ -0,0 +1,18 @@
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+#include <stdint.h>
+
+// Muxer的输出后端, 通过avio_alloc_context接到复用器上
+// mp4写trailer时会seek回去修改mdat/moov的大小, 所以需要支持seek
+class OutputSink
+{
+public:
+    virtual ~OutputSink() {}
+    // 成功返回写入的字节数, 失败返回<0
+    virtual int Write(const uint8_t *data, int size) = 0;
+    // whence: SEEK_SET/SEEK_CUR/SEEK_END, 以及AVSEEK_SIZE(返回总大小); 返回新的位置, 失败返回<0
+    virtual int64_t Seek(int64_t offset, int whence) = 0;
+    virtual int Close() = 0;
+};
+
+#endif // OUTPUTSINK_H
@@ -0,0 +1,61 @@
+#include "packetpool.h"
+
+PacketPool::PacketPool(int max_cached)
+{
+    max_cached_ = max_cached;
+}
+
+PacketPool::~PacketPool()
+{
+    for(size_t i = 0; i < free_packets_.size(); i++) {
+        av_packet_free(&free_packets_[i]);
+    }
+    free_packets_.clear();
+}
+
+AVPacket *PacketPool::Get()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!free_packets_.empty()) {
+            AVPacket *packet = free_packets_.back();
+            free_packets_.pop_back();
+            return packet;
+        }
+    }
+    return av_packet_alloc();
+}
+
+void PacketPool::Release(AVPacket *packet)
+{
+    if(!packet)
+        return;
+    av_packet_unref(packet);    // 释放数据buffer的引用, 只保留AVPacket结构体
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if((int)free_packets_.size() < max_cached_) {
+            free_packets_.push_back(packet);
+            return;
+        }
+    }
+    av_packet_free(&packet);
+}
+
+AVPacket *AllocPacket(PacketPool *pool)
+{
+    if(pool)
+        return pool->Get();
+    return av_packet_alloc();
+}
+
+void FreePacket(PacketPool *pool, AVPacket **packet)
+{
+    if(!packet || !*packet)
+        return;
+    if(pool) {
+        pool->Release(*packet);
+        *packet = NULL;
+    } else {
+        av_packet_free(packet);
+    }
+}
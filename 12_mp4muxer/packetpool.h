@@ -0,0 +1,31 @@
+#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+#include <vector>
+#include <mutex>
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+// AVPacket对象池, 编码器和muxer共用, 避免每一帧都av_packet_alloc/av_packet_free
+// 池里的packet就是普通的AVPacket, 直接av_packet_free也是安全的
+class PacketPool
+{
+public:
+    PacketPool(int max_cached = 256);
+    ~PacketPool();
+    // 空闲链表为空时才分配新的packet
+    AVPacket *Get();
+    // av_packet_unref后放回空闲链表, 超过max_cached则直接释放
+    void Release(AVPacket *packet);
+private:
+    std::vector<AVPacket *> free_packets_;
+    std::mutex mutex_;
+    int max_cached_ = 256;
+};
+
+// pool为NULL时退化为av_packet_alloc/av_packet_free
+AVPacket *AllocPacket(PacketPool *pool);
+void FreePacket(PacketPool *pool, AVPacket **packet);
+
+#endif // PACKETPOOL_H
@@ -0,0 +1,87 @@
+#include "packetqueue.h"
+
+PacketQueue::PacketQueue(int max_size)
+{
+    max_size_ = max_size > 0 ? max_size : 1;
+}
+
+PacketQueue::~PacketQueue()
+{
+    Clear();
+}
+
+int PacketQueue::Push(AVPacket *packet)
+{
+    if(!packet) {
+        return -1;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!abort_ && (int)packets_.size() >= max_size_) {
+        not_full_.wait(lock);
+    }
+    if(abort_) {
+        return -1;
+    }
+    packets_.push_back(packet);
+    not_empty_.notify_one();
+    return 0;
+}
+
+AVPacket *PacketQueue::Pop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!abort_ && !finished_ && packets_.empty()) {
+        not_empty_.wait(lock);
+    }
+    if(abort_ || packets_.empty()) {
+        return NULL;
+    }
+    AVPacket *packet = packets_.front();
+    packets_.pop_front();
+    not_full_.notify_one();
+    return packet;
+}
+
+AVPacket *PacketQueue::Peek()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!abort_ && !finished_ && packets_.empty()) {
+        not_empty_.wait(lock);
+    }
+    if(abort_ || packets_.empty()) {
+        return NULL;
+    }
+    return packets_.front();
+}
+
+void PacketQueue::Finish()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+    not_empty_.notify_all();
+}
+
+void PacketQueue::Abort()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    abort_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+}
+
+void PacketQueue::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    while(!packets_.empty()) {
+        AVPacket *packet = packets_.front();
+        packets_.pop_front();
+        av_packet_free(&packet);
+    }
+    not_full_.notify_all();
+}
+
+int PacketQueue::Size()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (int)packets_.size();
+}
@@ -0,0 +1,41 @@
+#ifndef PACKETQUEUE_H
+#define PACKETQUEUE_H
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+// 有界的packet队列, 用于编码线程和复用线程之间传递数据
+// 队列满时Push阻塞, 队列空时Pop/Peek阻塞
+class PacketQueue
+{
+public:
+    PacketQueue(int max_size = 64);
+    ~PacketQueue();
+    // 返回<0表示队列已中止, packet由调用者释放
+    int Push(AVPacket *packet);
+    // 返回NULL表示数据已经取完(Finish后队列为空)或者队列已中止
+    AVPacket *Pop();
+    // 查看队头但不取出, 阻塞规则和Pop一致
+    AVPacket *Peek();
+    // 生产者不再写入数据
+    void Finish();
+    // 中止队列, 唤醒所有阻塞的线程
+    void Abort();
+    // 释放队列里剩余的packet
+    void Clear();
+    int Size();
+private:
+    std::deque<AVPacket *> packets_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    int max_size_ = 64;
+    bool finished_ = false;
+    bool abort_ = false;
+};
+
+#endif // PACKETQUEUE_H
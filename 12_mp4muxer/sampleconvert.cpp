@@ -0,0 +1,278 @@
+#include "sampleconvert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_SIMD 1
+#include <arm_neon.h>
+#endif
+
+#define S16_SCALE (1.0f / (1 << 15))
+
+static void S16ToFltpC(const int16_t *in, float **out, int channels, int nb_samples)
+{
+    for(int i = 0; i < nb_samples; i++) {
+        for(int ch = 0; ch < channels; ch++) {
+            out[ch][i] = in[i * channels + ch] * S16_SCALE;
+        }
+    }
+}
+
+static void F32ToFltpC(const float *in, float **out, int channels, int nb_samples)
+{
+    for(int i = 0; i < nb_samples; i++) {
+        for(int ch = 0; ch < channels; ch++) {
+            out[ch][i] = in[i * channels + ch];
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static void S16ToFltpSSE2(const int16_t *in, float **out, int channels, int nb_samples)
+{
+    const __m128 scale = _mm_set1_ps(S16_SCALE);
+    int i = 0;
+    if(channels == 2) {
+        float *left = out[0];
+        float *right = out[1];
+        // 一次4个采样点: 每个32位元素是一对LR, 低16位是L, 高16位是R
+        for(; i + 4 <= nb_samples; i += 4) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(in + i * 2));
+            __m128i l = _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+            __m128i r = _mm_srai_epi32(x, 16);
+            _mm_storeu_ps(left + i, _mm_mul_ps(_mm_cvtepi32_ps(l), scale));
+            _mm_storeu_ps(right + i, _mm_mul_ps(_mm_cvtepi32_ps(r), scale));
+        }
+    } else if(channels == 1) {
+        float *mono = out[0];
+        for(; i + 8 <= nb_samples; i += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+            _mm_storeu_ps(mono + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+            _mm_storeu_ps(mono + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+        }
+    } else {
+        S16ToFltpC(in, out, channels, nb_samples);
+        return;
+    }
+    // 剩余不足一组的采样点
+    float *tail[2] = {out[0] + i, channels == 2 ? out[1] + i : 0};
+    S16ToFltpC(in + i * channels, tail, channels, nb_samples - i);
+}
+
+__attribute__((target("avx2")))
+static void S16ToFltpAVX2(const int16_t *in, float **out, int channels, int nb_samples)
+{
+    const __m256 scale = _mm256_set1_ps(S16_SCALE);
+    int i = 0;
+    if(channels == 2) {
+        float *left = out[0];
+        float *right = out[1];
+        // 32位元素按采样点顺序排列, 移位不跨128位通道, 不需要重排
+        for(; i + 8 <= nb_samples; i += 8) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(in + i * 2));
+            __m256i l = _mm256_srai_epi32(_mm256_slli_epi32(x, 16), 16);
+            __m256i r = _mm256_srai_epi32(x, 16);
+            _mm256_storeu_ps(left + i, _mm256_mul_ps(_mm256_cvtepi32_ps(l), scale));
+            _mm256_storeu_ps(right + i, _mm256_mul_ps(_mm256_cvtepi32_ps(r), scale));
+        }
+    } else if(channels == 1) {
+        float *mono = out[0];
+        for(; i + 8 <= nb_samples; i += 8) {
+            __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+            _mm256_storeu_ps(mono + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+        }
+    } else {
+        S16ToFltpC(in, out, channels, nb_samples);
+        return;
+    }
+    float *tail[2] = {out[0] + i, channels == 2 ? out[1] + i : 0};
+    S16ToFltpC(in + i * channels, tail, channels, nb_samples - i);
+}
+
+__attribute__((target("sse2")))
+static void F32ToFltpSSE2(const float *in, float **out, int channels, int nb_samples)
+{
+    if(channels != 2) {
+        F32ToFltpC(in, out, channels, nb_samples);
+        return;
+    }
+    float *left = out[0];
+    float *right = out[1];
+    int i = 0;
+    for(; i + 4 <= nb_samples; i += 4) {
+        __m128 a = _mm_loadu_ps(in + i * 2);        // L0 R0 L1 R1
+        __m128 b = _mm_loadu_ps(in + i * 2 + 4);    // L2 R2 L3 R3
+        _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    float *tail[2] = {left + i, right + i};
+    F32ToFltpC(in + i * 2, tail, 2, nb_samples - i);
+}
+
+__attribute__((target("avx2")))
+static void F32ToFltpAVX2(const float *in, float **out, int channels, int nb_samples)
+{
+    if(channels != 2) {
+        F32ToFltpC(in, out, channels, nb_samples);
+        return;
+    }
+    float *left = out[0];
+    float *right = out[1];
+    int i = 0;
+    for(; i + 8 <= nb_samples; i += 8) {
+        __m256 a = _mm256_loadu_ps(in + i * 2);
+        __m256 b = _mm256_loadu_ps(in + i * 2 + 8);
+        // 通道内shuffle后是[0 1 4 5 | 2 3 6 7], 再按64位重排成顺序
+        __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l), _MM_SHUFFLE(3, 1, 2, 0)));
+        r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_ps(left + i, l);
+        _mm256_storeu_ps(right + i, r);
+    }
+    float *tail[2] = {left + i, right + i};
+    F32ToFltpC(in + i * 2, tail, 2, nb_samples - i);
+}
+#endif
+
+#ifdef HAVE_NEON_SIMD
+static void S16ToFltpNEON(const int16_t *in, float **out, int channels, int nb_samples)
+{
+    int i = 0;
+    if(channels == 2) {
+        float *left = out[0];
+        float *right = out[1];
+        for(; i + 8 <= nb_samples; i += 8) {
+            int16x8x2_t x = vld2q_s16(in + i * 2);     // 读取时直接分离LR
+            vst1q_f32(left + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x.val[0]))), S16_SCALE));
+            vst1q_f32(left + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x.val[0]))), S16_SCALE));
+            vst1q_f32(right + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x.val[1]))), S16_SCALE));
+            vst1q_f32(right + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x.val[1]))), S16_SCALE));
+        }
+    } else if(channels == 1) {
+        float *mono = out[0];
+        for(; i + 8 <= nb_samples; i += 8) {
+            int16x8_t x = vld1q_s16(in + i);
+            vst1q_f32(mono + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), S16_SCALE));
+            vst1q_f32(mono + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), S16_SCALE));
+        }
+    } else {
+        S16ToFltpC(in, out, channels, nb_samples);
+        return;
+    }
+    float *tail[2] = {out[0] + i, channels == 2 ? out[1] + i : 0};
+    S16ToFltpC(in + i * channels, tail, channels, nb_samples - i);
+}
+
+static void F32ToFltpNEON(const float *in, float **out, int channels, int nb_samples)
+{
+    if(channels != 2) {
+        F32ToFltpC(in, out, channels, nb_samples);
+        return;
+    }
+    float *left = out[0];
+    float *right = out[1];
+    int i = 0;
+    for(; i + 4 <= nb_samples; i += 4) {
+        float32x4x2_t x = vld2q_f32(in + i * 2);
+        vst1q_f32(left + i, x.val[0]);
+        vst1q_f32(right + i, x.val[1]);
+    }
+    float *tail[2] = {left + i, right + i};
+    F32ToFltpC(in + i * 2, tail, 2, nb_samples - i);
+}
+#endif
+
+static int CpuSupports(int level)
+{
+    switch(level) {
+    case SIMD_C:
+        return 1;
+#ifdef HAVE_X86_SIMD
+    case SIMD_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case SIMD_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef HAVE_NEON_SIMD
+    case SIMD_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+int GetBestSimdLevel()
+{
+    for(int level = SIMD_COUNT - 1; level > SIMD_C; level--) {
+        if(CpuSupports(level))
+            return level;
+    }
+    return SIMD_C;
+}
+
+const char *GetSimdName(int level)
+{
+    switch(level) {
+    case SIMD_C:
+        return "c";
+    case SIMD_SSE2:
+        return "sse2";
+    case SIMD_AVX2:
+        return "avx2";
+    case SIMD_NEON:
+        return "neon";
+    default:
+        return "unknown";
+    }
+}
+
+S16ToFltpFunc GetS16ToFltpFunc(int level)
+{
+    if(!CpuSupports(level))
+        return 0;
+    switch(level) {
+    case SIMD_C:
+        return S16ToFltpC;
+#ifdef HAVE_X86_SIMD
+    case SIMD_SSE2:
+        return S16ToFltpSSE2;
+    case SIMD_AVX2:
+        return S16ToFltpAVX2;
+#endif
+#ifdef HAVE_NEON_SIMD
+    case SIMD_NEON:
+        return S16ToFltpNEON;
+#endif
+    default:
+        return 0;
+    }
+}
+
+F32ToFltpFunc GetF32ToFltpFunc(int level)
+{
+    if(!CpuSupports(level))
+        return 0;
+    switch(level) {
+    case SIMD_C:
+        return F32ToFltpC;
+#ifdef HAVE_X86_SIMD
+    case SIMD_SSE2:
+        return F32ToFltpSSE2;
+    case SIMD_AVX2:
+        return F32ToFltpAVX2;
+#endif
+#ifdef HAVE_NEON_SIMD
+    case SIMD_NEON:
+        return F32ToFltpNEON;
+#endif
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef SAMPLECONVERT_H
+#define SAMPLECONVERT_H
+#include <stdint.h>
+
+// 交错(packed)采样转换成平面(planar)float, 采样率和通道数不变时代替swr_convert
+// 双声道和单声道有SSE2/AVX2/NEON实现, 其他通道数用C实现; 结果和swr一致(s16按1/32768缩放)
+enum SimdLevel
+{
+    SIMD_C = 0,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_NEON,
+    SIMD_COUNT
+};
+
+// out[ch]指向每个通道的输出, 每个通道nb_samples个采样点
+typedef void (*S16ToFltpFunc)(const int16_t *in, float **out, int channels, int nb_samples);
+typedef void (*F32ToFltpFunc)(const float *in, float **out, int channels, int nb_samples);
+
+// 当前cpu支持的最快实现, 运行时检测
+int GetBestSimdLevel();
+const char *GetSimdName(int level);
+// 编译时没有对应实现或者cpu不支持时返回NULL
+S16ToFltpFunc GetS16ToFltpFunc(int level);
+F32ToFltpFunc GetF32ToFltpFunc(int level);
+
+#endif // SAMPLECONVERT_H
@@ -0,0 +1,205 @@
+#include "samplefifo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+
+SampleFifo::SampleFifo()
+    : write_pos_(0), read_pos_(0), finished_(0), abort_(0)
+{
+
+}
+
+SampleFifo::~SampleFifo()
+{
+    DeInit();
+}
+
+int SampleFifo::Init(int channels, int capacity)
+{
+    if(channels <= 0 || channels > SAMPLEFIFO_MAX_CHANNELS || capacity <= 0) {
+        printf("SampleFifo unsupport channels:%d capacity:%d\n", channels, capacity);
+        return -1;
+    }
+    DeInit();
+    channels_ = channels;
+    capacity_ = 1;
+    while(capacity_ < (size_t)capacity)
+        capacity_ <<= 1;
+    mask_ = capacity_ - 1;
+    for(int ch = 0; ch < channels_; ch++) {
+        void *plane = NULL;
+        if(posix_memalign(&plane, 64, capacity_ * sizeof(float)) != 0) {
+            printf("posix_memalign %zu failed\n", capacity_ * sizeof(float));
+            DeInit();
+            return -1;
+        }
+        planes_.push_back((float *)plane);
+    }
+    convert_ = GetS16ToFltpFunc(GetBestSimdLevel());
+    write_pos_.store(0);
+    read_pos_.store(0);
+    finished_.store(0);
+    abort_.store(0);
+    return 0;
+}
+
+void SampleFifo::DeInit()
+{
+    for(size_t i = 0; i < planes_.size(); i++)
+        free(planes_[i]);
+    planes_.clear();
+    channels_ = 0;
+    capacity_ = 0;
+    mask_ = 0;
+}
+
+int SampleFifo::PushS16(const int16_t *in, int nb_samples)
+{
+    size_t write_pos = write_pos_.load(std::memory_order_relaxed);
+    size_t read_pos = read_pos_.load(std::memory_order_acquire);
+    size_t space = capacity_ - (write_pos - read_pos);
+    size_t count = (size_t)nb_samples < space ? nb_samples : space;
+    // 环形缓冲区最多分两段写入
+    size_t offset = write_pos & mask_;
+    size_t first = capacity_ - offset < count ? capacity_ - offset : count;
+    float *out[SAMPLEFIFO_MAX_CHANNELS];
+    for(int ch = 0; ch < channels_; ch++)
+        out[ch] = planes_[ch] + offset;
+    convert_(in, out, channels_, (int)first);
+    if(count > first) {
+        for(int ch = 0; ch < channels_; ch++)
+            out[ch] = planes_[ch];
+        convert_(in + first * channels_, out, channels_, (int)(count - first));
+    }
+    write_pos_.store(write_pos + count, std::memory_order_release);
+    return (int)count;
+}
+
+int SampleFifo::Push(const float *const *in, int nb_samples)
+{
+    size_t write_pos = write_pos_.load(std::memory_order_relaxed);
+    size_t read_pos = read_pos_.load(std::memory_order_acquire);
+    size_t space = capacity_ - (write_pos - read_pos);
+    size_t count = (size_t)nb_samples < space ? nb_samples : space;
+    size_t offset = write_pos & mask_;
+    size_t first = capacity_ - offset < count ? capacity_ - offset : count;
+    for(int ch = 0; ch < channels_; ch++) {
+        memcpy(planes_[ch] + offset, in[ch], first * sizeof(float));
+        if(count > first)
+            memcpy(planes_[ch], in[ch] + first, (count - first) * sizeof(float));
+    }
+    write_pos_.store(write_pos + count, std::memory_order_release);
+    return (int)count;
+}
+
+int SampleFifo::PushS16Wait(const int16_t *in, int nb_samples)
+{
+    int written = 0;
+    int spins = 0;
+    while(written < nb_samples) {
+        if(abort_.load(std::memory_order_relaxed))
+            return -1;
+        int count = PushS16(in + written * channels_, nb_samples - written);
+        if(count == 0) {
+            Backoff(spins);
+            continue;
+        }
+        written += count;
+        spins = 0;
+    }
+    return written;
+}
+
+int SampleFifo::PushWait(const float *const *in, int nb_samples)
+{
+    int written = 0;
+    int spins = 0;
+    const float *offset_in[SAMPLEFIFO_MAX_CHANNELS];
+    while(written < nb_samples) {
+        if(abort_.load(std::memory_order_relaxed))
+            return -1;
+        for(int ch = 0; ch < channels_; ch++)
+            offset_in[ch] = in[ch] + written;
+        int count = Push(offset_in, nb_samples - written);
+        if(count == 0) {
+            Backoff(spins);
+            continue;
+        }
+        written += count;
+        spins = 0;
+    }
+    return written;
+}
+
+void SampleFifo::Finish()
+{
+    finished_.store(1, std::memory_order_release);
+}
+
+int SampleFifo::Pop(float **out, int nb_samples)
+{
+    // 先读finished_再读write_pos_, 保证看到Finish之前写入的所有数据
+    int finished = finished_.load(std::memory_order_acquire);
+    size_t read_pos = read_pos_.load(std::memory_order_relaxed);
+    size_t write_pos = write_pos_.load(std::memory_order_acquire);
+    size_t size = write_pos - read_pos;
+    if(size < (size_t)nb_samples && !finished)
+        return 0;
+    size_t count = size < (size_t)nb_samples ? size : nb_samples;
+    size_t offset = read_pos & mask_;
+    size_t first = capacity_ - offset < count ? capacity_ - offset : count;
+    for(int ch = 0; ch < channels_; ch++) {
+        memcpy(out[ch], planes_[ch] + offset, first * sizeof(float));
+        if(count > first)
+            memcpy(out[ch] + first, planes_[ch], (count - first) * sizeof(float));
+    }
+    read_pos_.store(read_pos + count, std::memory_order_release);
+    return (int)count;
+}
+
+int SampleFifo::PopWait(float **out, int nb_samples)
+{
+    int spins = 0;
+    while(1) {
+        if(abort_.load(std::memory_order_relaxed))
+            return -1;
+        int count = Pop(out, nb_samples);
+        if(count > 0)
+            return count;
+        // Pop和IsFinished之间生产者可能写入最后不足一帧的数据后Finish, 结束后需要再取一次
+        if(IsFinished())
+            return Pop(out, nb_samples);
+        Backoff(spins);
+    }
+}
+
+void SampleFifo::Abort()
+{
+    abort_.store(1);
+}
+
+int SampleFifo::Size()
+{
+    return (int)(write_pos_.load(std::memory_order_acquire) - read_pos_.load(std::memory_order_acquire));
+}
+
+int SampleFifo::Space()
+{
+    return (int)capacity_ - Size();
+}
+
+int SampleFifo::IsFinished()
+{
+    return finished_.load(std::memory_order_acquire);
+}
+
+void SampleFifo::Backoff(int &spins)
+{
+    if(++spins < 64) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
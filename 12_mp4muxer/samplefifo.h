@@ -0,0 +1,60 @@
+#ifndef SAMPLEFIFO_H
+#define SAMPLEFIFO_H
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include "sampleconvert.h"
+
+#define SAMPLEFIFO_MAX_CHANNELS 8
+
+// 单生产者单消费者的无锁平面float采样fifo
+// 生产者(读pcm/采集线程)每次写入任意个采样点, 消费者(编码线程)每次取出固定个数(编码器帧长)
+// 读写位置用原子变量同步, 数据只在写入时转换一次, 读出时拷贝一次到编码帧
+class SampleFifo
+{
+public:
+    SampleFifo();
+    ~SampleFifo();
+    // capacity为每个通道最多缓存的采样点数, 向上取整到2的幂
+    int Init(int channels, int capacity);
+    void DeInit();
+
+    // 生产者调用
+    // 写入交错的s16, 直接转换到fifo里(SIMD), 返回写入的采样点数, 空间不够时只写一部分
+    int PushS16(const int16_t *in, int nb_samples);
+    // 写入平面float
+    int Push(const float *const *in, int nb_samples);
+    // 空间不够时等待消费者, 直到全部写入; 返回<0表示已经Abort
+    int PushS16Wait(const int16_t *in, int nb_samples);
+    int PushWait(const float *const *in, int nb_samples);
+    // 不再写入, 消费者可以取出最后不满nb_samples的数据
+    void Finish();
+
+    // 消费者调用
+    // 数据够nb_samples个时取出nb_samples个; Finish之后取出剩余的; 否则返回0不取
+    int Pop(float **out, int nb_samples);
+    // 数据不够时等待生产者; 返回0表示Finish后已经取完, <0表示已经Abort
+    int PopWait(float **out, int nb_samples);
+
+    // 让等待的一方退出
+    void Abort();
+    int Size();
+    int Space();
+    int IsFinished();
+private:
+    // 等待时先让出cpu, 多次之后再短暂睡眠
+    static void Backoff(int &spins);
+    int channels_ = 0;
+    size_t capacity_ = 0;
+    size_t mask_ = 0;
+    std::vector<float *> planes_;
+    S16ToFltpFunc convert_ = 0;
+    // 读写位置只增加, 取余后才是下标; 分开放在不同的cache line, 避免两个线程互相干扰
+    alignas(64) std::atomic<size_t> write_pos_;
+    alignas(64) std::atomic<size_t> read_pos_;
+    alignas(64) std::atomic<int> finished_;
+    std::atomic<int> abort_;
+};
+
+#endif // SAMPLEFIFO_H
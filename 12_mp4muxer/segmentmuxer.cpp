@@ -0,0 +1,501 @@
+#include "segmentmuxer.h"
+#include "logger.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+SegmentMuxer::SegmentMuxer()
+{
+
+}
+
+SegmentMuxer::~SegmentMuxer()
+{
+    DeInit();
+}
+
+int SegmentMuxer::Init(const char *out_prefix, Format format, int64_t segment_duration_us,
+                       AVCodecContext *video_ctx, AVCodecContext *audio_ctx)
+{
+    if(!video_ctx) {
+        printf("segment muxer needs a video stream\n");
+        return -1;
+    }
+    if(segment_duration_us <= 0) {
+        printf("invalid segment duration:%" PRId64 "\n", segment_duration_us);
+        return -1;
+    }
+    std::string prefix = out_prefix;
+    size_t pos = prefix.rfind('/');
+    dir_ = pos == std::string::npos ? "" : prefix.substr(0, pos + 1);
+    base_name_ = pos == std::string::npos ? prefix : prefix.substr(pos + 1);
+    format_ = format;
+    segment_duration_ = segment_duration_us;
+    video_ctx_ = video_ctx;
+    audio_ctx_ = audio_ctx;
+    segment_index_ = 0;
+    segment_start_ = AV_NOPTS_VALUE;
+    video_end_ = AV_NOPTS_VALUE;
+    error_ = 0;
+
+    char time_buf[64] = {0};
+    time_t now = time(NULL);
+    struct tm tm_utc;
+    gmtime_r(&now, &tm_utc);
+    strftime(time_buf, sizeof(time_buf) - 1, "%Y-%m-%dT%H:%M:%SZ", &tm_utc);
+    availability_start_ = time_buf;
+
+    running_ = 1;
+    finished_count_ = 0;
+    trailer_done_ = 0;
+    thread_error_ = 0;
+    segments_.clear();
+    thread_ = std::thread(&SegmentMuxer::FinalizeLoop, this);
+
+    if(format_ == FORMAT_TS) {
+        muxer_ = OpenTsMuxer(0);
+        return muxer_ ? 0 : -1;
+    }
+
+    // fMP4: 一个分片mp4复用器, 每个分片就是一个切片, 数据经过CallbackSink收集到buffer_
+    sink_ = new CallbackSink(OnWrite, NULL, this);
+    muxer_ = new Muxer();
+    muxer_->SetPacketPool(packet_pool_);
+    muxer_->SetFragmentDuration(segment_duration_, 1);
+    muxer_->SetFragmentCallback(OnFragment, this, 1);  // 切片里不要mfra
+    if(muxer_->Init("mp4", sink_) < 0
+            || muxer_->AddStream(video_ctx_) < 0
+            || (audio_ctx_ && muxer_->AddStream(audio_ctx_) < 0)
+            || muxer_->Open() < 0
+            || muxer_->SendHeader() < 0) {
+        printf("init fmp4 segment muxer failed\n");
+        return -1;
+    }
+    // SendHeader之后buffer_里就是ftyp+moov
+    Job *job = new Job();
+    job->path = dir_ + base_name_ + "_init.mp4";
+    job->muxer = NULL;
+    job->data.swap(buffer_);
+    buffer_offset_ += job->data.size();
+    job->is_segment = 0;
+    job->is_last = 0;
+    PushJob(job);
+    return 0;
+}
+
+void SegmentMuxer::DeInit()
+{
+    if(thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = 0;
+        }
+        cond_.notify_all();
+        thread_.join();     // 后台线程处理完队列里的任务才退出
+    }
+    if(muxer_) {
+        muxer_->DeInit();
+        delete muxer_;
+        muxer_ = NULL;
+    }
+    if(sink_) {
+        delete sink_;
+        sink_ = NULL;
+    }
+    buffer_.clear();
+    buffer_offset_ = 0;
+    segments_.clear();
+}
+
+int SegmentMuxer::SendPacket(AVPacket *packet)
+{
+    if(!muxer_) {
+        printf("segment muxer not init\n");
+        FreePacket(packet_pool_, &packet);
+        return -1;
+    }
+    if(packet->stream_index == GetVideoStreamIndex()) {
+        AVRational time_base = video_ctx_->time_base;
+        int64_t dts = av_rescale_q(packet->dts, time_base, AVRational{1, AV_TIME_BASE});
+        if(format_ == FORMAT_TS && (packet->flags & AV_PKT_FLAG_KEY)) {
+            if(segment_start_ == AV_NOPTS_VALUE) {
+                segment_start_ = dts;
+            } else if(dts - segment_start_ >= segment_duration_) {
+                // 当前切片交给后台线程写trailer并fsync, 关键帧开始新的切片
+                Job *job = new Job();
+                job->path = dir_ + SegmentName(segment_index_);
+                job->muxer = muxer_;
+                job->segment.index = segment_index_;
+                job->segment.start_us = segment_start_;
+                job->segment.duration_us = dts - segment_start_;
+                job->is_segment = 1;
+                job->is_last = 0;
+                PushJob(job);
+                segment_index_++;
+                segment_start_ = dts;
+                muxer_ = OpenTsMuxer(segment_index_);
+                if(!muxer_) {
+                    FreePacket(packet_pool_, &packet);
+                    error_ = 1;
+                    return -1;
+                }
+            }
+        }
+        int64_t duration = packet->duration;
+        if(duration <= 0 && video_ctx_->framerate.num > 0)
+            duration = av_rescale_q(1, av_inv_q(video_ctx_->framerate), time_base);
+        video_end_ = av_rescale_q(packet->dts + duration, time_base, AVRational{1, AV_TIME_BASE});
+    }
+    // fMP4模式下Muxer在关键帧处结束分片, 通过OnFragment交给后台线程
+    int ret = muxer_->SendPacket(packet);
+    if(ret < 0)
+        error_ = 1;
+    return ret;
+}
+
+int SegmentMuxer::SendTrailer()
+{
+    if(!muxer_) {
+        printf("segment muxer not init\n");
+        return -1;
+    }
+    int ret = 0;
+    if(format_ == FORMAT_TS) {
+        Job *job = new Job();
+        job->path = dir_ + SegmentName(segment_index_);
+        job->muxer = muxer_;
+        job->segment.index = segment_index_;
+        job->segment.start_us = segment_start_;
+        job->segment.duration_us = video_end_ - segment_start_;
+        job->is_segment = segment_start_ != AV_NOPTS_VALUE;
+        job->is_last = 0;
+        PushJob(job);
+        muxer_ = NULL;
+    } else {
+        // 最后一个分片在SendTrailer里通过OnFragment输出
+        if(muxer_->SendTrailer() < 0 || muxer_->DeInit() < 0)
+            ret = -1;
+        delete muxer_;
+        muxer_ = NULL;
+        delete sink_;
+        sink_ = NULL;
+    }
+    Job *job = new Job();
+    job->muxer = NULL;
+    job->is_segment = 0;
+    job->is_last = 1;
+    PushJob(job);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() { return trailer_done_ != 0; });
+    printf("segment muxer finish, %d segments\n", finished_count_);
+    if(error_ || thread_error_)
+        ret = -1;
+    return ret;
+}
+
+int SegmentMuxer::GetVideoStreamIndex()
+{
+    return 0;
+}
+
+int SegmentMuxer::GetAudioStreamIndex()
+{
+    return audio_ctx_ ? 1 : -1;
+}
+
+void SegmentMuxer::SetPacketPool(PacketPool *pool)
+{
+    packet_pool_ = pool;
+}
+
+int SegmentMuxer::GetFinishedSegmentCount()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finished_count_;
+}
+
+Muxer *SegmentMuxer::OpenTsMuxer(int index)
+{
+    std::string path = dir_ + SegmentName(index);
+    Muxer *muxer = new Muxer();
+    muxer->SetPacketPool(packet_pool_);
+    if(muxer->Init(path.c_str()) < 0
+            || muxer->AddStream(video_ctx_) < 0
+            || (audio_ctx_ && muxer->AddStream(audio_ctx_) < 0)
+            || muxer->Open() < 0
+            || muxer->SendHeader() < 0) {
+        printf("open segment %s failed\n", path.c_str());
+        muxer->DeInit();
+        delete muxer;
+        return NULL;
+    }
+    return muxer;
+}
+
+void SegmentMuxer::PushJob(Job *job)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return jobs_.size() < MAX_PENDING_JOBS || !running_; });
+        jobs_.push_back(job);
+    }
+    cond_.notify_all();
+}
+
+void SegmentMuxer::FinalizeLoop()
+{
+    while(1) {
+        Job *job = NULL;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return !jobs_.empty() || !running_; });
+            if(jobs_.empty())
+                break;
+            job = jobs_.front();
+            jobs_.pop_front();
+        }
+        cond_.notify_all();     // 唤醒等待队列空位的编码线程
+        int ret = FinalizeJob(job);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(ret < 0)
+                thread_error_ = 1;
+            if(job->is_segment)
+                finished_count_++;
+            if(job->is_last)
+                trailer_done_ = 1;
+        }
+        cond_.notify_all();
+        delete job;
+    }
+}
+
+int SegmentMuxer::FinalizeJob(Job *job)
+{
+    int ret = 0;
+    if(job->muxer) {
+        // TS切片: 写出muxer队列里剩余的packet, 关闭文件后再fsync
+        if(job->muxer->SendTrailer() < 0 || job->muxer->DeInit() < 0)
+            ret = -1;
+        delete job->muxer;
+        job->muxer = NULL;
+        if(SyncFile(job->path) < 0)
+            ret = -1;
+    } else if(!job->path.empty()) {
+        if(WriteFile(job->path, job->data) < 0)
+            ret = -1;
+    }
+    if(job->is_segment) {
+        segments_.push_back(job->segment);
+        LogDebug("segment %d finish, duration:%" PRId64 "us\n", job->segment.index, job->segment.duration_us);
+    }
+    // 切片写完之后才更新播放列表, 播放列表里的切片都是完整的
+    if((job->is_segment || job->is_last) && WritePlaylists(job->is_last) < 0)
+        ret = -1;
+    return ret;
+}
+
+int SegmentMuxer::WriteFile(const std::string &path, const std::vector<uint8_t> &data)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        printf("open %s failed:%s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+    size_t written = 0;
+    while(written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            printf("write %s failed:%s\n", path.c_str(), strerror(errno));
+            close(fd);
+            return -1;
+        }
+        written += n;
+    }
+    int ret = 0;
+    if(fsync(fd) < 0) {
+        printf("fsync %s failed:%s\n", path.c_str(), strerror(errno));
+        ret = -1;
+    }
+    close(fd);
+    return ret;
+}
+
+int SegmentMuxer::SyncFile(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        printf("open %s failed:%s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+    int ret = 0;
+    if(fsync(fd) < 0) {
+        printf("fsync %s failed:%s\n", path.c_str(), strerror(errno));
+        ret = -1;
+    }
+    close(fd);
+    return ret;
+}
+
+int SegmentMuxer::ReplaceFile(const std::string &path, const std::string &content)
+{
+    std::string tmp_path = path + ".tmp";
+    std::vector<uint8_t> data(content.begin(), content.end());
+    if(WriteFile(tmp_path, data) < 0)
+        return -1;
+    if(rename(tmp_path.c_str(), path.c_str()) < 0) {
+        printf("rename %s failed:%s\n", tmp_path.c_str(), strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int SegmentMuxer::WritePlaylists(int finished)
+{
+    char line[1024] = {0};
+    // TARGETDURATION不能小于任何一个切片四舍五入后的时长
+    int target_duration = (int)((segment_duration_ + AV_TIME_BASE - 1) / AV_TIME_BASE);
+    for(size_t i = 0; i < segments_.size(); i++) {
+        int duration = (int)((segments_[i].duration_us + AV_TIME_BASE / 2) / AV_TIME_BASE);
+        if(duration > target_duration)
+            target_duration = duration;
+    }
+    std::string m3u8 = "#EXTM3U\n";
+    snprintf(line, sizeof(line) - 1, "#EXT-X-VERSION:%d\n", format_ == FORMAT_FMP4 ? 7 : 3);
+    m3u8 += line;
+    snprintf(line, sizeof(line) - 1, "#EXT-X-TARGETDURATION:%d\n", target_duration);
+    m3u8 += line;
+    m3u8 += "#EXT-X-MEDIA-SEQUENCE:0\n";
+    m3u8 += "#EXT-X-PLAYLIST-TYPE:EVENT\n";
+    m3u8 += "#EXT-X-INDEPENDENT-SEGMENTS\n";
+    if(format_ == FORMAT_FMP4)
+        m3u8 += "#EXT-X-MAP:URI=\"" + base_name_ + "_init.mp4\"\n";
+    for(size_t i = 0; i < segments_.size(); i++) {
+        snprintf(line, sizeof(line) - 1, "#EXTINF:%.3f,\n", segments_[i].duration_us / (double)AV_TIME_BASE);
+        m3u8 += line;
+        m3u8 += SegmentName(segments_[i].index) + "\n";
+    }
+    if(finished)
+        m3u8 += "#EXT-X-ENDLIST\n";
+    if(ReplaceFile(dir_ + base_name_ + ".m3u8", m3u8) < 0)
+        return -1;
+    if(format_ != FORMAT_FMP4)
+        return 0;
+
+    // DASH: 音视频在同一个切片里, 一个Representation, SegmentTimeline单位us
+    int64_t total_duration = 0;
+    for(size_t i = 0; i < segments_.size(); i++)
+        total_duration += segments_[i].duration_us;
+    int64_t bandwidth = video_ctx_->bit_rate + (audio_ctx_ ? audio_ctx_->bit_rate : 0);
+    std::string mpd = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
+    mpd += "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"urn:mpeg:dash:profile:isoff-live:2011\"";
+    if(finished) {
+        snprintf(line, sizeof(line) - 1, " type=\"static\" mediaPresentationDuration=\"PT%.3fS\"",
+                 total_duration / (double)AV_TIME_BASE);
+    } else {
+        snprintf(line, sizeof(line) - 1, " type=\"dynamic\" availabilityStartTime=\"%s\" minimumUpdatePeriod=\"PT%.3fS\"",
+                 availability_start_.c_str(), segment_duration_ / (double)AV_TIME_BASE);
+    }
+    mpd += line;
+    snprintf(line, sizeof(line) - 1, " minBufferTime=\"PT%.3fS\">\n", segment_duration_ / (double)AV_TIME_BASE);
+    mpd += line;
+    mpd += "  <Period id=\"0\" start=\"PT0S\">\n";
+    mpd += "    <AdaptationSet id=\"0\" mimeType=\"video/mp4\" segmentAlignment=\"true\" startWithSAP=\"1\">\n";
+    snprintf(line, sizeof(line) - 1,
+             "      <Representation id=\"0\" codecs=\"%s\" bandwidth=\"%" PRId64 "\" width=\"%d\" height=\"%d\">\n",
+             CodecString().c_str(), bandwidth, video_ctx_->width, video_ctx_->height);
+    mpd += line;
+    mpd += "        <SegmentTemplate timescale=\"1000000\" initialization=\"" + base_name_
+            + "_init.mp4\" media=\"" + base_name_ + "_$Number%05d$.m4s\" startNumber=\"0\">\n";
+    mpd += "          <SegmentTimeline>\n";
+    for(size_t i = 0; i < segments_.size(); i++) {
+        snprintf(line, sizeof(line) - 1, "            <S t=\"%" PRId64 "\" d=\"%" PRId64 "\"/>\n",
+                 segments_[i].start_us, segments_[i].duration_us);
+        mpd += line;
+    }
+    mpd += "          </SegmentTimeline>\n";
+    mpd += "        </SegmentTemplate>\n";
+    mpd += "      </Representation>\n";
+    mpd += "    </AdaptationSet>\n";
+    mpd += "  </Period>\n";
+    mpd += "</MPD>\n";
+    return ReplaceFile(dir_ + base_name_ + ".mpd", mpd);
+}
+
+std::string SegmentMuxer::SegmentName(int index)
+{
+    char name[64] = {0};
+    snprintf(name, sizeof(name) - 1, "_%05d.%s", index, format_ == FORMAT_FMP4 ? "m4s" : "ts");
+    return base_name_ + name;
+}
+
+std::string SegmentMuxer::CodecString()
+{
+    // avc1.PPCCLL: profile_idc, constraint_flags, level_idc, 取自avcC或者Annex-B的SPS
+    uint8_t profile = 0x42, constraints = 0xE0, level = 0x1E;
+    const uint8_t *extradata = video_ctx_->extradata;
+    int size = video_ctx_->extradata_size;
+    if(extradata && size >= 4 && extradata[0] == 1) {
+        profile = extradata[1];
+        constraints = extradata[2];
+        level = extradata[3];
+    } else if(extradata) {
+        for(int i = 0; i + 6 < size; i++) {
+            if(extradata[i] == 0 && extradata[i + 1] == 0 && extradata[i + 2] == 1
+                    && (extradata[i + 3] & 0x1f) == 7) {
+                profile = extradata[i + 4];
+                constraints = extradata[i + 5];
+                level = extradata[i + 6];
+                break;
+            }
+        }
+    }
+    char codecs[64] = {0};
+    snprintf(codecs, sizeof(codecs) - 1, "avc1.%02X%02X%02X", profile, constraints, level);
+    std::string result = codecs;
+    if(audio_ctx_) {
+        // mp4a.40.N, N为AAC的audio object type, 比profile大1
+        snprintf(codecs, sizeof(codecs) - 1, ",mp4a.40.%d", audio_ctx_->profile >= 0 ? audio_ctx_->profile + 1 : 2);
+        result += codecs;
+    }
+    return result;
+}
+
+int SegmentMuxer::OnWrite(void *opaque, int64_t offset, const uint8_t *data, int size)
+{
+    SegmentMuxer *self = (SegmentMuxer *)opaque;
+    if(offset < self->buffer_offset_) {
+        // 分片模式下不会seek回已经交出去的切片
+        printf("fmp4 write at %lld before segment start %lld\n",
+               (long long)offset, (long long)self->buffer_offset_);
+        return -1;
+    }
+    size_t pos = offset - self->buffer_offset_;
+    if(pos + size > self->buffer_.size())
+        self->buffer_.resize(pos + size);
+    memcpy(self->buffer_.data() + pos, data, size);
+    return 0;
+}
+
+void SegmentMuxer::OnFragment(void *opaque, int index, int64_t start_us, int64_t duration_us)
+{
+    // 在编码线程里调用, 只交换数据不做io
+    SegmentMuxer *self = (SegmentMuxer *)opaque;
+    Job *job = new Job();
+    job->path = self->dir_ + self->SegmentName(index);
+    job->muxer = NULL;
+    job->data.swap(self->buffer_);
+    self->buffer_offset_ += job->data.size();
+    job->segment.index = index;
+    job->segment.start_us = start_us;
+    job->segment.duration_us = duration_us;
+    job->is_segment = 1;
+    job->is_last = 0;
+    self->PushJob(job);
+}
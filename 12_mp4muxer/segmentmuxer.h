@@ -0,0 +1,109 @@
+#ifndef SEGMENTMUXER_H
+#define SEGMENTMUXER_H
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+#include "muxer.h"
+#include "callbacksink.h"
+#include "packetpool.h"
+
+// 切片输出: 在视频关键帧处切成TS或fMP4(CMAF)切片, 每完成一个切片就更新HLS播放列表(fMP4同时输出DASH mpd)
+// 切片的关闭、写盘、fsync和播放列表的改写都在后台线程完成, 编码线程不会因为切片结束而阻塞,
+// 只有后台积压了MAX_PENDING_JOBS个切片(比如fsync很慢)时才等待, 保证缓存的切片数有上限
+// 输出文件: TS: prefix_00000.ts ... prefix.m3u8
+//          fMP4: prefix_init.mp4 prefix_00000.m4s ... prefix.m3u8 prefix.mpd
+class SegmentMuxer
+{
+public:
+    enum Format { FORMAT_TS = 0, FORMAT_FMP4 = 1 };
+    SegmentMuxer();
+    ~SegmentMuxer();
+    // 切片时长至少segment_duration_us并按GOP对齐, video_ctx/audio_ctx在DeInit之前需要一直有效
+    int Init(const char *out_prefix, Format format, int64_t segment_duration_us,
+             AVCodecContext *video_ctx, AVCodecContext *audio_ctx);
+    // 等待后台线程处理完所有切片后释放资源
+    void DeInit();
+    // packet的所有权交给SegmentMuxer
+    int SendPacket(AVPacket *packet);
+    // 结束最后一个切片, 等待所有切片写完后输出最终的播放列表
+    int SendTrailer();
+    int GetVideoStreamIndex();
+    int GetAudioStreamIndex();
+    // 需要在Init之前调用
+    void SetPacketPool(PacketPool *pool);
+    // 已经写完并fsync的切片数
+    int GetFinishedSegmentCount();
+private:
+    struct Segment
+    {
+        int index;
+        int64_t start_us;
+        int64_t duration_us;
+    };
+    // 后台线程的任务: TS切片是还没写trailer的Muxer, fMP4切片是已经复用好的数据
+    struct Job
+    {
+        std::string path;
+        Muxer *muxer;
+        std::vector<uint8_t> data;
+        Segment segment;
+        int is_segment;     // 0: fMP4的初始化段, 不进播放列表
+        int is_last;
+    };
+    enum { MAX_PENDING_JOBS = 4 };
+    // TS模式: 新建一个Muxer写下一个切片
+    Muxer *OpenTsMuxer(int index);
+    // 队列满时阻塞到后台线程取走任务
+    void PushJob(Job *job);
+    void FinalizeLoop();
+    int FinalizeJob(Job *job);
+    int WriteFile(const std::string &path, const std::vector<uint8_t> &data);
+    int SyncFile(const std::string &path);
+    // 先写临时文件再rename, 播放器不会读到写了一半的播放列表
+    int ReplaceFile(const std::string &path, const std::string &content);
+    int WritePlaylists(int finished);
+    // 切片的文件名, 不包含目录
+    std::string SegmentName(int index);
+    std::string CodecString();
+    static int OnWrite(void *opaque, int64_t offset, const uint8_t *data, int size);
+    static void OnFragment(void *opaque, int index, int64_t start_us, int64_t duration_us);
+
+    std::string dir_;           // 输出目录, 包含最后的'/'
+    std::string base_name_;     // 播放列表里只引用文件名, 和播放列表放在同一个目录
+    std::string availability_start_;   // 动态mpd的availabilityStartTime
+    Format format_ = FORMAT_TS;
+    int64_t segment_duration_ = 0;   // 单位us
+    AVCodecContext *video_ctx_ = NULL;
+    AVCodecContext *audio_ctx_ = NULL;
+    PacketPool *packet_pool_ = NULL;
+
+    // 编码线程使用
+    Muxer *muxer_ = NULL;
+    int segment_index_ = 0;
+    int64_t segment_start_ = AV_NOPTS_VALUE;   // 单位us
+    int64_t video_end_ = AV_NOPTS_VALUE;       // 单位us
+    CallbackSink *sink_ = NULL;
+    std::vector<uint8_t> buffer_;      // fMP4模式下还没有交给后台线程的数据
+    int64_t buffer_offset_ = 0;        // buffer_[0]在整个fMP4流中的偏移
+    int error_ = 0;
+
+    // 后台线程
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Job *> jobs_;
+    int running_ = 0;
+    int finished_count_ = 0;
+    int trailer_done_ = 0;
+    std::vector<Segment> segments_;     // 已经完成的切片, 只在后台线程访问
+    int thread_error_ = 0;
+};
+
+#endif // SEGMENTMUXER_H
@@ -0,0 +1,44 @@
+#include "streamclock.h"
+
+StreamClock::StreamClock()
+{
+
+}
+
+void StreamClock::Init(AVRational unit, AVRational time_base)
+{
+    unit_ = unit;
+    time_base_ = time_base;
+    count_ = 0;
+    // unit / time_base = (unit.num * time_base.den) / (unit.den * time_base.num)
+    int64_t num = (int64_t)unit_.num * time_base_.den;
+    int64_t den = (int64_t)unit_.den * time_base_.num;
+    step_ = (den > 0 && num % den == 0) ? num / den : 0;
+}
+
+void StreamClock::Reset()
+{
+    count_ = 0;
+}
+
+void StreamClock::Advance(int64_t count)
+{
+    count_ += count;
+}
+
+int64_t StreamClock::GetPts()
+{
+    if(step_ > 0)
+        return count_ * step_;
+    return av_rescale_q(count_, unit_, time_base_);
+}
+
+int64_t StreamClock::GetCount()
+{
+    return count_;
+}
+
+AVRational StreamClock::GetTimeBase()
+{
+    return time_base_;
+}
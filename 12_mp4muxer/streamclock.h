@@ -0,0 +1,31 @@
+#ifndef STREAMCLOCK_H
+#define STREAMCLOCK_H
+extern "C"
+{
+#include "libavutil/rational.h"
+#include "libavutil/mathematics.h"
+}
+
+// 按整数计数(视频帧数、音频采样点数)生成pts, 代替double累加, 长时间运行也不会漂移
+// 每个计数正好是整数个time_base时(比如1/25 -> 1/1000000), pts直接用乘法得到
+class StreamClock
+{
+public:
+    StreamClock();
+    // unit: 一个计数的时长, 视频为1/fps, 音频为1/sample_rate
+    // time_base: 输出pts的时间基, 一般和编码器的time_base一致
+    void Init(AVRational unit, AVRational time_base);
+    void Reset();
+    // 视频每编码一帧加1, 音频加nb_samples
+    void Advance(int64_t count);
+    int64_t GetPts();
+    int64_t GetCount();
+    AVRational GetTimeBase();
+private:
+    AVRational unit_ = {1, 1};
+    AVRational time_base_ = {1, 1};
+    int64_t count_ = 0;
+    int64_t step_ = 0;  // >0 表示一个计数等于step_个time_base
+};
+
+#endif // STREAMCLOCK_H
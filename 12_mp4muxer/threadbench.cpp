@@ -0,0 +1,145 @@
+#include "threadbench.h"
+#include <stdio.h>
+#include <chrono>
+#include <map>
+#include <thread>
+#include "streamclock.h"
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double ElapsedMs(BenchClock::time_point begin, BenchClock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+ThreadBench::ThreadBench()
+{
+
+}
+
+ThreadBench::~ThreadBench()
+{
+    DeInit();
+}
+
+int ThreadBench::Init(const char *in_yuv_name, int width, int height, int fps, int bit_rate, int max_frames)
+{
+    width_ = width;
+    height_ = height;
+    fps_ = fps;
+    bit_rate_ = bit_rate;
+    max_frames_ = max_frames;
+    if(yuv_reader_.Open(in_yuv_name, width_, height_) < 0) {
+        printf("Failed to open %s file\n", in_yuv_name);
+        return -1;
+    }
+    if(max_frames_ <= 0 || max_frames_ > yuv_reader_.GetFrameCount())
+        max_frames_ = (int)yuv_reader_.GetFrameCount();
+    return 0;
+}
+
+void ThreadBench::DeInit()
+{
+    yuv_reader_.Close();
+}
+
+int ThreadBench::Run(const VideoThreadConfig &config, Result &result)
+{
+    result.config = config;
+    result.frames = 0;
+    result.fps = 0;
+    result.avg_latency_ms = 0;
+    result.max_latency_ms = 0;
+
+    VideoEncoder video_encoder;
+    video_encoder.SetThreadConfig(config);
+    if(video_encoder.InitH264(width_, height_, fps_, bit_rate_) < 0) {
+        printf("video_encoder.InitH264 failed\n");
+        return -1;
+    }
+    AVFrame *yuv_frame = av_frame_alloc();
+    if(!yuv_frame) {
+        printf("av_frame_alloc yuv_frame failed\n");
+        return -1;
+    }
+    StreamClock clock;
+    clock.Init(AVRational{1, fps_}, video_encoder.GetCodecContext()->time_base);
+    int64_t time_base = clock.GetTimeBase().den;
+
+    std::map<int64_t, BenchClock::time_point> send_times;   // pts -> 送入编码器的时间
+    std::vector<AVPacket *> packets;
+    double total_latency = 0;
+    int ret = 0;
+    int finish = 0;
+    yuv_reader_.Rewind();
+    BenchClock::time_point begin = BenchClock::now();
+    while(!finish) {
+        int64_t pts = clock.GetPts();
+        if(clock.GetCount() >= max_frames_ || yuv_reader_.ReadFrame(yuv_frame) < 0) {
+            finish = 1;
+            ret = video_encoder.Encode((AVFrame *)NULL, 0, pts, time_base, packets);
+        } else {
+            send_times[pts] = BenchClock::now();   // clock的time_base就是编码器的, packet pts不用转换
+            ret = video_encoder.Encode(yuv_frame, 0, pts, time_base, packets);
+            av_frame_unref(yuv_frame);
+            clock.Advance(1);
+        }
+        BenchClock::time_point now = BenchClock::now();
+        for(size_t i = 0; i < packets.size(); i++) {
+            std::map<int64_t, BenchClock::time_point>::iterator it = send_times.find(packets[i]->pts);
+            if(it != send_times.end()) {
+                double latency = ElapsedMs(it->second, now);
+                total_latency += latency;
+                if(latency > result.max_latency_ms)
+                    result.max_latency_ms = latency;
+                send_times.erase(it);
+                result.frames++;
+            }
+            FreePacket(NULL, &packets[i]);
+        }
+        packets.clear();
+        if(ret < 0)
+            break;
+    }
+    double elapsed = ElapsedMs(begin, BenchClock::now());
+    av_frame_free(&yuv_frame);
+    if(ret < 0) {
+        printf("encode failed\n");
+        return -1;
+    }
+    if(elapsed > 0)
+        result.fps = result.frames * 1000.0 / elapsed;
+    if(result.frames > 0)
+        result.avg_latency_ms = total_latency / result.frames;
+    return 0;
+}
+
+std::vector<VideoThreadConfig> ThreadBench::DefaultSweep(int affinity)
+{
+    std::vector<VideoThreadConfig> configs;
+    int cpus = (int)std::thread::hardware_concurrency();
+    if(cpus <= 0)
+        cpus = 1;
+    for(int threads = 1; ; threads *= 2) {
+        if(threads > cpus)
+            threads = cpus;
+        for(int type = FF_THREAD_FRAME; type <= FF_THREAD_SLICE; type++) {
+            VideoThreadConfig config;
+            config.thread_count = threads;
+            config.thread_type = type;
+            if(affinity) {
+                config.cpu_first = 0;
+                config.cpu_count = threads;
+            }
+            configs.push_back(config);
+            // 帧级并行时lookahead容易成为瓶颈, 多测一组加大lookahead线程
+            if(type == FF_THREAD_FRAME && threads >= 8) {
+                config.lookahead_threads = threads / 4;
+                configs.push_back(config);
+            }
+        }
+        if(threads == cpus)
+            break;
+    }
+    return configs;
+}
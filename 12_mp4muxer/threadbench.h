@@ -0,0 +1,37 @@
+#ifndef THREADBENCH_H
+#define THREADBENCH_H
+#include <vector>
+#include "videoencoder.h"
+#include "yuvmmapreader.h"
+
+// 在同一个yuv文件上遍历不同的编码线程配置, 统计编码速度和单帧延迟(送入编码器到输出packet)
+class ThreadBench
+{
+public:
+    struct Result
+    {
+        VideoThreadConfig config;
+        int frames;
+        double fps;
+        double avg_latency_ms;
+        double max_latency_ms;
+    };
+    ThreadBench();
+    ~ThreadBench();
+    // max_frames <= 0 时编码整个文件
+    int Init(const char *in_yuv_name, int width, int height, int fps, int bit_rate, int max_frames);
+    int Run(const VideoThreadConfig &config, Result &result);
+    void DeInit();
+    // 默认遍历: 线程数1,2,4...直到cpu核数, 每个线程数分别测试帧级/片级并行,
+    // affinity不为0时编码线程绑定到前thread_count个核
+    static std::vector<VideoThreadConfig> DefaultSweep(int affinity);
+private:
+    YuvMmapReader yuv_reader_;
+    int width_ = 0;
+    int height_ = 0;
+    int fps_ = 25;
+    int bit_rate_ = 0;
+    int max_frames_ = 0;
+};
+
+#endif // THREADBENCH_H
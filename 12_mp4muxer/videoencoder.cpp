@@ -1,7 +1,14 @@
 #include "videoencoder.h"
+#include "logger.h"
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 extern "C"
 {
 #include "libavutil/imgutils.h"
+#include "libavutil/time.h"
 }
 VideoEncoder::VideoEncoder()
 {
@@ -15,6 +22,25 @@ VideoEncoder::~VideoEncoder()
     }
 }
 
+void VideoEncoder::SetThreadConfig(const VideoThreadConfig &config)
+{
+    thread_config_ = config;
+}
+
+void VideoEncoder::SetLiveMode(int vbv_buffer_ms)
+{
+    live_ = 1;
+    vbv_buffer_ms_ = vbv_buffer_ms;
+    SetLatencyTracking(1);
+}
+
+void VideoEncoder::SetLatencyTracking(int enable)
+{
+    latency_tracking_ = enable;
+    if(enable)
+        latencies_.reserve(LATENCY_WINDOW);
+}
+
 int VideoEncoder::InitH264(int width, int height, int fps, int bit_rate)
 {
     width_ = width;
@@ -22,12 +48,63 @@ int VideoEncoder::InitH264(int width, int height, int fps, int bit_rate)
     fps_ = fps;
     bit_rate_ = bit_rate;
 
-    AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    if(!codec) {
+    codec_ = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if(!codec_) {
         printf("avcodec_find_encoder AV_CODEC_ID_H264 failed\n");
         return -1;
     }
-    codec_ctx_ = avcodec_alloc_context3(codec);
+    if(CreateContext() < 0) {
+        return -1;
+    }
+
+    frame_ = av_frame_alloc();
+    if(!frame_) {
+        printf("av_frame_alloc failed\n");
+        return -1;
+    }
+    frame_->width = width_;
+    frame_->height = height_;
+    frame_->format = codec_ctx_->pix_fmt;
+
+    printf("Inith264 success\n");
+    return 0;
+}
+
+int VideoEncoder::Reset()
+{
+    if(!codec_ctx_) {
+        printf("codec_ctx_ null\n");
+        return -1;
+    }
+    ResetLatency();
+#ifdef AV_CODEC_CAP_ENCODER_FLUSH
+    // 支持冲刷的编码器直接回到初始状态, 不需要重新打开
+    if(codec_ctx_->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH) {
+        avcodec_flush_buffers(codec_ctx_);
+        // 下一个输出不能参考上一个输出的帧
+        force_idr_ = 1;
+        return 0;
+    }
+#endif
+    return Reopen() < 0 ? -1 : 1;
+}
+
+int VideoEncoder::Reopen()
+{
+    if(!codec_) {
+        printf("encoder not init\n");
+        return -1;
+    }
+    ResetLatency();
+    force_idr_ = 0;
+    avcodec_free_context(&codec_ctx_);
+    av_dict_free(&dict_);   // avcodec_open2会取走用到的选项, 需要重新设置
+    return CreateContext();
+}
+
+int VideoEncoder::CreateContext()
+{
+    codec_ctx_ = avcodec_alloc_context3(codec_);
     if(!codec_ctx_) {
         printf("avcodec_alloc_context3 AV_CODEC_ID_H264 failed\n");
         return -1;
@@ -44,27 +121,30 @@ int VideoEncoder::InitH264(int width, int height, int fps, int bit_rate)
     codec_ctx_->gop_size = fps_;
     codec_ctx_->max_b_frames = 0;
     codec_ctx_->pix_fmt = AV_PIX_FMT_YUV420P;
-//    av_dict_set(&dict_, "tune", "zerolatency", 0);
-
-    int ret = avcodec_open2(codec_ctx_, NULL, &dict_);
-    if(ret != 0) {
-        char errbuf[1024] = {0};
-        av_strerror(ret, errbuf, sizeof(errbuf) - 1);
-        printf("avcodec_open2 failed:%s\n", errbuf);
-        return -1;
+    // 强制的I帧编码成IDR, Reset之后的第一帧需要
+    av_dict_set(&dict_, "forced-idr", "1", 0);
+    if(live_) {
+        av_dict_set(&dict_, "tune", "zerolatency", 0);
+        av_dict_set(&dict_, "rc-lookahead", "0", 0);
+        // 只有第一帧是IDR, 之后每gop_size帧用一列帧内宏块滚动刷新完整画面
+        av_dict_set(&dict_, "intra-refresh", "1", 0);
+        if(vbv_buffer_ms_ > 0) {
+            codec_ctx_->rc_max_rate = bit_rate_;
+            codec_ctx_->rc_buffer_size = (int)((int64_t)bit_rate_ * vbv_buffer_ms_ / 1000);
+        }
     }
-
-    frame_ = av_frame_alloc();
-    if(!frame_) {
-        printf("av_frame_alloc failed\n");
-        return -1;
+    if(thread_config_.thread_count > 0)
+        codec_ctx_->thread_count = thread_config_.thread_count;
+    if(thread_config_.thread_type != 0)
+        codec_ctx_->thread_type = thread_config_.thread_type;  // libx264: slice对应sliced-threads
+    if(thread_config_.lookahead_threads > 0) {
+        char x264_params[64] = {0};
+        snprintf(x264_params, sizeof(x264_params) - 1, "lookahead-threads=%d",
+                 thread_config_.lookahead_threads);
+        av_dict_set(&dict_, "x264-params", x264_params, 0);
     }
-    frame_->width = width_;
-    frame_->height = height_;
-    frame_->format = codec_ctx_->pix_fmt;
 
-    printf("Inith264 success\n");
-    return 0;
+    return OpenCodec();
 }
 
 void VideoEncoder::DeInit()
@@ -78,6 +158,8 @@ void VideoEncoder::DeInit()
     if(dict_) {
         av_dict_free(&dict_);
     }
+    codec_ = NULL;
+    ResetLatency();
 }
 
 AVPacket *VideoEncoder::Encode(uint8_t *yuv_data, int yuv_size, int stream_index, int64_t pts, int64_t time_base)
@@ -88,7 +170,7 @@ AVPacket *VideoEncoder::Encode(uint8_t *yuv_data, int yuv_size, int stream_index
     }
     int ret = 0;
 
-    pts = av_rescale_q(pts, AVRational{1, (int)time_base}, codec_ctx_->time_base);
+    pts = RescalePts(pts, time_base);
     frame_->pts = pts;
     if(yuv_data) {
         int ret_size = av_image_fill_arrays(frame_->data, frame_->linesize,
@@ -98,7 +180,11 @@ AVPacket *VideoEncoder::Encode(uint8_t *yuv_data, int yuv_size, int stream_index
             printf("ret_size:%d != yuv_size:%d -> failed\n", ret_size, yuv_size);
             return NULL;
         }
+        frame_->pict_type = force_idr_ ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
         ret = avcodec_send_frame(codec_ctx_, frame_);
+        frame_->pict_type = AV_PICTURE_TYPE_NONE;
+        if(ret == 0)
+            force_idr_ = 0;
     } else {
         ret = avcodec_send_frame(codec_ctx_, NULL);
     }
@@ -109,13 +195,13 @@ AVPacket *VideoEncoder::Encode(uint8_t *yuv_data, int yuv_size, int stream_index
         printf("avcodec_send_frame failed:%s\n", errbuf);
         return NULL;
     }
-    AVPacket *packet = av_packet_alloc();
+    AVPacket *packet = AllocPacket(packet_pool_);
     ret = avcodec_receive_packet(codec_ctx_, packet);
     if(ret != 0) {
         char errbuf[1024] = {0};
         av_strerror(ret, errbuf, sizeof(errbuf) - 1);
         printf("h264 avcodec_receive_packet failed:%s\n", errbuf);
-        av_packet_free(&packet);
+        FreePacket(packet_pool_, &packet);
         return NULL;
     }
     packet->stream_index = stream_index;
@@ -125,6 +211,26 @@ AVPacket *VideoEncoder::Encode(uint8_t *yuv_data, int yuv_size, int stream_index
 int VideoEncoder::Encode(uint8_t *yuv_data, int yuv_size,
                          int stream_index, int64_t pts, int64_t time_base,
                          std::vector<AVPacket *> &packets)
+{
+    if(!codec_ctx_) {
+        printf("codec_ctx_ null\n");
+        return -1;
+    }
+    if(!yuv_data) {
+        return Encode((AVFrame *)NULL, stream_index, pts, time_base, packets);
+    }
+    int ret_size = av_image_fill_arrays(frame_->data, frame_->linesize,
+                                        yuv_data, (AVPixelFormat)frame_->format,
+                                        frame_->width, frame_->height, 1);
+    if(ret_size != yuv_size) {
+        printf("ret_size:%d != yuv_size:%d -> failed\n", ret_size, yuv_size);
+        return -1;
+    }
+    return Encode(frame_, stream_index, pts, time_base, packets);
+}
+
+int VideoEncoder::Encode(AVFrame *frame, int stream_index, int64_t pts, int64_t time_base,
+                         std::vector<AVPacket *> &packets)
 {
     if(!codec_ctx_) {
         printf("codec_ctx_ null\n");
@@ -132,21 +238,32 @@ int VideoEncoder::Encode(uint8_t *yuv_data, int yuv_size,
     }
     int ret = 0;
 
-    pts = av_rescale_q(pts, AVRational{1, (int)time_base}, codec_ctx_->time_base);
-    frame_->pts = pts;
-    if(yuv_data) {
-        int ret_size = av_image_fill_arrays(frame_->data, frame_->linesize,
-                                            yuv_data, (AVPixelFormat)frame_->format,
-                                            frame_->width, frame_->height, 1);
-        if(ret_size != yuv_size) {
-            printf("ret_size:%d != yuv_size:%d -> failed\n", ret_size, yuv_size);
+    if(frame) {
+        if(frame->width != width_ || frame->height != height_
+                || frame->format != codec_ctx_->pix_fmt) {
+            printf("frame %dx%d format:%d mismatch encoder\n",
+                   frame->width, frame->height, frame->format);
             return -1;
         }
-        ret = avcodec_send_frame(codec_ctx_, frame_);
-    } else {
-        ret = avcodec_send_frame(codec_ctx_, NULL);
+        frame->pts = RescalePts(pts, time_base);
+        if(force_idr_)
+            frame->pict_type = AV_PICTURE_TYPE_I;
+    }
+    int64_t send_time = frame && latency_tracking_ ? av_gettime_relative() : 0;
+    ret = avcodec_send_frame(codec_ctx_, frame);
+    if(frame && force_idr_) {
+        // frame可能被调用者重复使用(比如frame_), 恢复成由编码器决定帧类型
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+        if(ret == 0)
+            force_idr_ = 0;
+    }
+    if(ret == 0 && send_time > 0) {
+        // 送入成功才记录, 失败的帧不会有packet
+        int slot = (int)(send_count_ % SEND_RING_SIZE);
+        send_pts_[slot] = frame->pts;
+        send_times_[slot] = send_time;
+        send_count_++;
     }
-
     if(ret != 0) {
         char errbuf[1024] = {0};
         av_strerror(ret, errbuf, sizeof(errbuf) - 1);
@@ -155,21 +272,24 @@ int VideoEncoder::Encode(uint8_t *yuv_data, int yuv_size,
     }
     while(1)
     {
-        AVPacket *packet = av_packet_alloc();
+        AVPacket *packet = AllocPacket(packet_pool_);
         ret = avcodec_receive_packet(codec_ctx_, packet);
         packet->stream_index = stream_index;
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
             ret = 0;
-            av_packet_free(&packet);
+            FreePacket(packet_pool_, &packet);
             break;
         } else if (ret < 0) {
             char errbuf[1024] = {0};
             av_strerror(ret, errbuf, sizeof(errbuf) - 1);
             printf("h264 avcodec_receive_packet failed:%s\n", errbuf);
-            av_packet_free(&packet);
+            FreePacket(packet_pool_, &packet);
             ret = -1;
+            break;
         }
-        printf("h264 pts:%lld\n", packet->pts);
+        LogDebug("h264 pts:%" PRId64 "\n", packet->pts);
+        if(latency_tracking_)
+            RecordLatency(packet->pts);
         packets.push_back(packet);
     }
     return ret;
@@ -179,3 +299,102 @@ AVCodecContext *VideoEncoder::GetCodecContext()
 {
     return codec_ctx_;
 }
+
+void VideoEncoder::SetPacketPool(PacketPool *pool)
+{
+    packet_pool_ = pool;
+}
+
+double VideoEncoder::GetLatencyPercentile(double percent)
+{
+    if(latencies_.empty())
+        return 0;
+    std::vector<int64_t> sorted(latencies_);
+    size_t index = (size_t)(percent / 100.0 * (sorted.size() - 1) + 0.5);
+    if(index >= sorted.size())
+        index = sorted.size() - 1;
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index] / 1000.0;
+}
+
+void VideoEncoder::ResetLatency()
+{
+    send_count_ = 0;
+    recv_count_ = 0;
+    latencies_.clear();
+    latency_pos_ = 0;
+}
+
+void VideoEncoder::RecordLatency(int64_t pts)
+{
+    // 按送入顺序向后找, 跳过编码器丢弃的帧; 超出环形缓冲的记录已经被覆盖
+    if(send_count_ - recv_count_ > SEND_RING_SIZE)
+        recv_count_ = send_count_ - SEND_RING_SIZE;
+    for(int64_t i = recv_count_; i < send_count_; i++) {
+        int slot = (int)(i % SEND_RING_SIZE);
+        if(send_pts_[slot] != pts)
+            continue;
+        int64_t latency = av_gettime_relative() - send_times_[slot];
+        if(latencies_.size() < LATENCY_WINDOW) {
+            latencies_.push_back(latency);
+        } else {
+            latencies_[latency_pos_] = latency;
+            latency_pos_ = (latency_pos_ + 1) % LATENCY_WINDOW;
+        }
+        recv_count_ = i + 1;
+        return;
+    }
+}
+
+int64_t VideoEncoder::RescalePts(int64_t pts, int64_t time_base)
+{
+    // 调用者已经按编码器的time_base计算好pts时不需要再转换
+    if(codec_ctx_->time_base.num == 1 && codec_ctx_->time_base.den == time_base)
+        return pts;
+    return av_rescale_q(pts, AVRational{1, (int)time_base}, codec_ctx_->time_base);
+}
+
+int VideoEncoder::OpenCodec()
+{
+#ifdef __linux__
+    cpu_set_t old_cpus;
+    int restore_cpus = 0;
+    if(thread_config_.cpu_first >= 0) {
+        int cpu_end = CPU_SETSIZE;
+        if(thread_config_.cpu_count > 0 && thread_config_.cpu_first + thread_config_.cpu_count < cpu_end)
+            cpu_end = thread_config_.cpu_first + thread_config_.cpu_count;
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for(int i = thread_config_.cpu_first; i < cpu_end; i++)
+            CPU_SET(i, &cpus);
+        if(pthread_getaffinity_np(pthread_self(), sizeof(old_cpus), &old_cpus) == 0
+                && pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0) {
+            restore_cpus = 1;
+        } else {
+            printf("set cpu affinity %d-%d failed, ignore\n", thread_config_.cpu_first, cpu_end - 1);
+        }
+    }
+#endif
+    int ret = avcodec_open2(codec_ctx_, NULL, &dict_);
+#ifdef __linux__
+    // 只影响编码器内部线程, 调用线程恢复原来的亲和性
+    if(restore_cpus)
+        pthread_setaffinity_np(pthread_self(), sizeof(old_cpus), &old_cpus);
+#endif
+    if(ret != 0) {
+        char errbuf[1024] = {0};
+        av_strerror(ret, errbuf, sizeof(errbuf) - 1);
+        printf("avcodec_open2 failed:%s\n", errbuf);
+        return -1;
+    }
+    // libx264自己管理线程(AV_CODEC_CAP_OTHER_THREADS), active_thread_type不会被设置,
+    // 这里输出传给x264的配置: thread_type只有FF_THREAD_SLICE时用sliced-threads, 否则帧级并行
+    char thread_count[16] = {0};
+    if(codec_ctx_->thread_count > 0)
+        snprintf(thread_count, sizeof(thread_count) - 1, "%d", codec_ctx_->thread_count);
+    else
+        snprintf(thread_count, sizeof(thread_count) - 1, "auto");
+    printf("h264 threads:%s type:%s\n", thread_count,
+           codec_ctx_->thread_type == FF_THREAD_SLICE ? "slice" : "frame");
+    return 0;
+}
@@ -6,26 +6,84 @@ extern "C"
 #include "libavcodec/avcodec.h"
 }
 #include <vector>
+#include "packetpool.h"
+
+// 编码线程配置, 各项为0(或-1)时保持编码器默认值
+struct VideoThreadConfig
+{
+    int thread_count = 0;       // 0: 编码器按cpu核数自动选择
+    int thread_type = 0;        // FF_THREAD_FRAME帧级并行, FF_THREAD_SLICE片级并行(延迟低)
+    int lookahead_threads = 0;  // libx264 lookahead线程数
+    int cpu_first = -1;         // >=0: 编码线程绑定到[cpu_first, cpu_first + cpu_count)的核上
+    int cpu_count = 0;          // 0: 从cpu_first到最后一个核
+};
 
 class VideoEncoder
 {
 public:
     VideoEncoder();
     ~VideoEncoder();
+    // 需要在InitH264之前调用
+    void SetThreadConfig(const VideoThreadConfig &config);
+    // 直播低延迟模式, 需要在InitH264之前调用: zerolatency, 不做lookahead,
+    // 用帧内刷新代替周期IDR避免码率尖峰, vbv缓冲为vbv_buffer_ms毫秒的码率
+    void SetLiveMode(int vbv_buffer_ms = 500);
+    // 统计编码延迟(GetLatencyPercentile), 直播模式默认打开; 不打开时编码路径不记录时间
+    void SetLatencyTracking(int enable);
     int InitH264(int width, int height, int fps, int bit_rate);
     void DeInit();
+    // 冲刷后用相同的参数开始新的输出, pts重新从0开始
+    // 编码器支持AV_CODEC_CAP_ENCODER_FLUSH时只清空内部状态, 返回0; 否则Reopen, 返回1; 失败返回<0
+    // 冲刷不会重置GOP和参考帧, 所以原地冲刷后的第一帧强制编码成IDR
+    int Reset();
+    // 用InitH264时找到的编码器重新创建并打开codec context, 不重新查找编码器和分配frame
+    // 之后需要重新GetCodecContext
+    int Reopen();
     AVPacket *Encode(uint8_t *yuv_data, int yuv_size,
                      int stream_index, int64_t pts, int64_t time_base);
     // 小于0没有packet
     int Encode(uint8_t *yuv_data, int yuv_size, int stream_index, int64_t pts, int64_t time_base,
                std::vector<AVPacket *> &packets);
+    // frame可以是引用计数的(比如mmap读取的), 编码器只增加引用不再拷贝; NULL冲刷编码器
+    int Encode(AVFrame *frame, int stream_index, int64_t pts, int64_t time_base,
+               std::vector<AVPacket *> &packets);
     AVCodecContext *GetCodecContext();
+    // 设置后packet从对象池分配/回收, 不设置则直接av_packet_alloc/av_packet_free
+    void SetPacketPool(PacketPool *pool);
+    // 最近LATENCY_WINDOW帧从送入编码器到输出packet的延迟百分位, 单位毫秒, 没有数据返回0
+    double GetLatencyPercentile(double percent);
+    void ResetLatency();
 private:
+    enum { LATENCY_WINDOW = 1024 };
+    // 送入时间的环形缓冲, 大于编码器最多缓存的帧数(lookahead + 帧级线程)
+    enum { SEND_RING_SIZE = 256 };
+    // pts从{1, time_base}转换到编码器的time_base
+    int64_t RescalePts(int64_t pts, int64_t time_base);
+    // 找到pts对应的送入时间, 记录一次延迟
+    void RecordLatency(int64_t pts);
+    // 按保存的参数分配codec context并打开
+    int CreateContext();
+    // 编码线程在avcodec_open2里创建并继承调用线程的亲和性
+    int OpenCodec();
+    VideoThreadConfig thread_config_;
+    int live_ = 0;
+    int vbv_buffer_ms_ = 0;
+    int latency_tracking_ = 0;
+    // 按帧计数取余做下标, 没有B帧时packet的输出顺序和送入顺序一致
+    int64_t send_pts_[SEND_RING_SIZE];
+    int64_t send_times_[SEND_RING_SIZE];      // 送入编码器的时间(us)
+    int64_t send_count_ = 0;
+    int64_t recv_count_ = 0;
+    std::vector<int64_t> latencies_;          // 环形窗口, 单位us
+    size_t latency_pos_ = 0;
+    PacketPool *packet_pool_ = NULL;
     int width_ = 0;
     int height_ = 0;
     int fps_ = 25;
     int bit_rate_ = 500*1024;
     int64_t pts_ = 0;
+    int force_idr_ = 0;     // Reset后下一帧编码成IDR
+    AVCodec *codec_ = NULL;
     AVCodecContext * codec_ctx_ = NULL;
     AVFrame *frame_ = NULL;
     AVDictionary *dict_ = NULL;
@@ -0,0 +1,75 @@
+#include "videoscaler.h"
+#include <stdio.h>
+
+VideoScaler::VideoScaler()
+{
+
+}
+
+VideoScaler::~VideoScaler()
+{
+    DeInit();
+}
+
+int VideoScaler::Init(int src_width, int src_height, int dst_width, int dst_height)
+{
+    src_width_ = src_width;
+    src_height_ = src_height;
+    dst_width_ = dst_width;
+    dst_height_ = dst_height;
+
+    sws_ctx_ = sws_getContext(src_width_, src_height_, AV_PIX_FMT_YUV420P,
+                              dst_width_, dst_height_, AV_PIX_FMT_YUV420P,
+                              SWS_BILINEAR, NULL, NULL, NULL);
+    if(!sws_ctx_) {
+        printf("sws_getContext %dx%d -> %dx%d failed\n",
+               src_width_, src_height_, dst_width_, dst_height_);
+        return -1;
+    }
+    frame_ = av_frame_alloc();
+    if(!frame_) {
+        printf("av_frame_alloc failed\n");
+        return -1;
+    }
+    frame_->format = AV_PIX_FMT_YUV420P;
+    frame_->width = dst_width_;
+    frame_->height = dst_height_;
+    int ret = av_frame_get_buffer(frame_, 0);
+    if(ret < 0) {
+        char errbuf[1024] = {0};
+        av_strerror(ret, errbuf, sizeof(errbuf) - 1);
+        printf("av_frame_get_buffer failed:%s\n", errbuf);
+        return -1;
+    }
+    return 0;
+}
+
+void VideoScaler::DeInit()
+{
+    if(sws_ctx_) {
+        sws_freeContext(sws_ctx_);
+        sws_ctx_ = NULL;
+    }
+    if(frame_) {
+        av_frame_free(&frame_);
+    }
+}
+
+AVFrame *VideoScaler::Scale(const AVFrame *src_frame)
+{
+    if(!sws_ctx_ || !src_frame) {
+        return NULL;
+    }
+    // 编码器还持有上一帧的引用时才会重新分配
+    if(av_frame_make_writable(frame_) < 0) {
+        printf("av_frame_make_writable failed\n");
+        return NULL;
+    }
+    int ret = sws_scale(sws_ctx_, src_frame->data, src_frame->linesize, 0, src_height_,
+                        frame_->data, frame_->linesize);
+    if(ret != dst_height_) {
+        printf("sws_scale failed, ret:%d\n", ret);
+        return NULL;
+    }
+    return frame_;
+}
@@ -0,0 +1,28 @@
+#ifndef VIDEOSCALER_H
+#define VIDEOSCALER_H
+extern "C"
+{
+#include "libavutil/frame.h"
+#include "libswscale/swscale.h"
+}
+
+// yuv420p缩放, 输出frame由scaler持有并复用
+class VideoScaler
+{
+public:
+    VideoScaler();
+    ~VideoScaler();
+    int Init(int src_width, int src_height, int dst_width, int dst_height);
+    void DeInit();
+    // 返回缩放后的frame, 不要释放; 下一次Scale会覆盖其内容
+    AVFrame *Scale(const AVFrame *src_frame);
+private:
+    int src_width_ = 0;
+    int src_height_ = 0;
+    int dst_width_ = 0;
+    int dst_height_ = 0;
+    struct SwsContext *sws_ctx_ = NULL;
+    AVFrame *frame_ = NULL;
+};
+
+#endif // VIDEOSCALER_H
@@ -0,0 +1,135 @@
+#include "yuvmmapreader.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+extern "C"
+{
+#include "libavutil/imgutils.h"
+#include "libavutil/buffer.h"
+}
+
+YuvMmapReader::YuvMmapReader()
+{
+
+}
+
+YuvMmapReader::~YuvMmapReader()
+{
+    Close();
+}
+
+int YuvMmapReader::Open(const char *file_name, int width, int height)
+{
+    width_ = width;
+    height_ = height;
+    frame_size_ = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width_, height_, 1);
+    if(frame_size_ <= 0) {
+        printf("invalid yuv size %dx%d\n", width_, height_);
+        return -1;
+    }
+
+    int fd = open(file_name, O_RDONLY);
+    if(fd < 0) {
+        printf("open %s failed\n", file_name);
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < frame_size_) {
+        printf("%s is smaller than one frame\n", file_name);
+        close(fd);
+        return -1;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // 映射建立后fd可以关闭
+    if(addr == MAP_FAILED) {
+        printf("mmap %s failed\n", file_name);
+        return -1;
+    }
+    // 顺序读取, 让内核加大预读
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+    mapping_ = new Mapping;
+    mapping_->addr = (uint8_t *)addr;
+    mapping_->length = st.st_size;
+    mapping_->frame_size = frame_size_;
+    mapping_->page_size = sysconf(_SC_PAGESIZE);
+    mapping_->refs = 1;     // reader自身持有一个引用
+    frame_count_ = st.st_size / frame_size_;
+    frame_index_ = 0;
+    return 0;
+}
+
+void YuvMmapReader::Close()
+{
+    if(mapping_) {
+        UnrefMapping(mapping_);
+        mapping_ = NULL;
+    }
+    frame_count_ = 0;
+    frame_index_ = 0;
+}
+
+int YuvMmapReader::ReadFrame(AVFrame *frame)
+{
+    if(!mapping_ || !frame) {
+        return -1;
+    }
+    if(frame_index_ >= frame_count_) {
+        return -1;  // 读完
+    }
+    uint8_t *data = mapping_->addr + frame_index_ * frame_size_;
+    mapping_->refs++;
+    frame->buf[0] = av_buffer_create(data, frame_size_, ReleaseFrameBuffer,
+                                     mapping_, AV_BUFFER_FLAG_READONLY);
+    if(!frame->buf[0]) {
+        UnrefMapping(mapping_);
+        printf("av_buffer_create failed\n");
+        return -1;
+    }
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = width_;
+    frame->height = height_;
+    av_image_fill_arrays(frame->data, frame->linesize, data,
+                         AV_PIX_FMT_YUV420P, width_, height_, 1);
+    frame_index_++;
+    return 0;
+}
+
+void YuvMmapReader::Rewind()
+{
+    frame_index_ = 0;
+}
+
+int YuvMmapReader::GetFrameSize()
+{
+    return frame_size_;
+}
+
+int64_t YuvMmapReader::GetFrameCount()
+{
+    return frame_count_;
+}
+
+void YuvMmapReader::ReleaseFrameBuffer(void *opaque, uint8_t *data)
+{
+    Mapping *mapping = (Mapping *)opaque;
+    // 这一帧已经被编码器消费, 把它占用的页从进程中释放, 大文件时常驻内存不会一直增长
+    // 只读的私有映射, 即使别的帧还要访问这些页, 也只是重新从page cache映射进来
+    uintptr_t page_mask = (uintptr_t)mapping->page_size - 1;
+    uintptr_t begin = (uintptr_t)data & ~page_mask;
+    uintptr_t end = ((uintptr_t)data + mapping->frame_size) & ~page_mask;
+    if(end > begin) {
+        madvise((void *)begin, end - begin, MADV_DONTNEED);
+    }
+    UnrefMapping(mapping);
+}
+
+void YuvMmapReader::UnrefMapping(Mapping *mapping)
+{
+    if(--mapping->refs == 0) {
+        munmap(mapping->addr, mapping->length);
+        delete mapping;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef YUVMMAPREADER_H
+#define YUVMMAPREADER_H
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+extern "C"
+{
+#include "libavutil/frame.h"
+}
+
+// 以mmap方式读取yuv420p文件, 输出的frame直接指向映射的内存, 不再fread拷贝
+// 每个frame通过av_buffer_create持有映射的引用, 所有frame释放后才munmap
+class YuvMmapReader
+{
+public:
+    YuvMmapReader();
+    ~YuvMmapReader();
+    int Open(const char *file_name, int width, int height);
+    void Close();
+    // 成功返回0, 读完或失败返回<0; 用完后调用av_frame_unref
+    int ReadFrame(AVFrame *frame);
+    // 回到第一帧重新读取
+    void Rewind();
+    int GetFrameSize();
+    int64_t GetFrameCount();
+private:
+    struct Mapping
+    {
+        uint8_t *addr;
+        size_t length;
+        size_t frame_size;
+        long page_size;
+        std::atomic<int> refs;
+    };
+    static void ReleaseFrameBuffer(void *opaque, uint8_t *data);
+    static void UnrefMapping(Mapping *mapping);
+
+    Mapping *mapping_ = NULL;
+    int width_ = 0;
+    int height_ = 0;
+    int frame_size_ = 0;
+    int64_t frame_count_ = 0;
+    int64_t frame_index_ = 0;
+};
+
+#endif // YUVMMAPREADER_H
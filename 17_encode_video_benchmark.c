@@ -0,0 +1,599 @@
+/**
+* @projectName   17_encode_video_benchmark
+* @brief         CPU视频编码基准测试, 在15_encode_video_libx264_nvenc.c的基础上:
+*               （1）遍历libx264/libx265的preset、tune、crf/码率、线程数，对一组yuv文件逐一编码；
+*               （2）统计编码速度fps、单帧延迟(送入编码器到输出packet)的百分位、输出码率；
+*               （3）编码的同时解码, 和输入yuv对比计算PSNR/SSIM；
+*               （4）结果输出为csv或json, 方便对比不同版本之间的性能回退
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/time.h>
+#include <libavutil/opt.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/avutil.h>
+
+#define MAX_LIST_ITEMS 16
+#define MAX_INPUT_FILES 64
+
+// 逗号分隔的参数列表, 比如 -p ultrafast,fast,medium
+typedef struct StringList
+{
+    char *items[MAX_LIST_ITEMS];
+    int count;
+} StringList;
+
+// 一次编码的配置
+typedef struct BenchCase
+{
+    const char *in_yuv_file;
+    int width;
+    int height;
+    int fps;
+    int max_frames;         // <=0 编码整个文件
+    const char *codec_name;
+    const char *preset;
+    const char *tune;       // "none"不设置
+    const char *rc;         // crf:23 或 br:1000(kbps)
+    int threads;            // 0: 编码器自动
+} BenchCase;
+
+typedef struct BenchResult
+{
+    int frames;             // 编码输出的帧数
+    int decoded_frames;     // 参与PSNR/SSIM计算的帧数
+    double fps;             // 只统计编码耗时, 不包括读文件和解码对比
+    double latency_p50;     // ms
+    double latency_p90;
+    double latency_p99;
+    double latency_max;
+    double kbps;
+    double psnr_y;
+    double psnr_avg;        // yuv按4:1:1加权
+    double ssim_y;
+} BenchResult;
+
+static int split_list(char *str, StringList *list)
+{
+    list->count = 0;
+    char *save = NULL;
+    for(char *token = strtok_r(str, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+        if(list->count >= MAX_LIST_ITEMS) {
+            fprintf(stderr, "too many items, max %d\n", MAX_LIST_ITEMS);
+            return -1;
+        }
+        list->items[list->count++] = token;
+    }
+    return list->count > 0 ? 0 : -1;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// 已排序数组的百分位, 最近秩法
+static double percentile(const double *sorted, int count, double p)
+{
+    if(count <= 0)
+        return 0;
+    int index = (int)ceil(p / 100.0 * count) - 1;
+    if(index < 0)
+        index = 0;
+    if(index >= count)
+        index = count - 1;
+    return sorted[index];
+}
+
+static uint64_t plane_sse(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+                          int width, int height)
+{
+    uint64_t sse = 0;
+    for(int y = 0; y < height; y++) {
+        const uint8_t *pa = a + y * a_stride;
+        const uint8_t *pb = b + y * b_stride;
+        for(int x = 0; x < width; x++) {
+            int d = pa[x] - pb[x];
+            sse += d * d;
+        }
+    }
+    return sse;
+}
+
+static double sse_to_psnr(double sse, double samples)
+{
+    if(sse <= 0)
+        return 100.0;   // 完全一致时给一个上限
+    return 10.0 * log10(255.0 * 255.0 * samples / sse);
+}
+
+// 亮度SSIM, 8x8不重叠块取平均, 比ffmpeg ssim滤镜的重叠窗口快, 用来看趋势足够
+static double plane_ssim(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+                         int width, int height)
+{
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    double ssim_sum = 0;
+    int blocks = 0;
+    for(int by = 0; by + 8 <= height; by += 8) {
+        for(int bx = 0; bx + 8 <= width; bx += 8) {
+            int64_t sum_a = 0, sum_b = 0, sum_aa = 0, sum_bb = 0, sum_ab = 0;
+            for(int y = 0; y < 8; y++) {
+                const uint8_t *pa = a + (by + y) * a_stride + bx;
+                const uint8_t *pb = b + (by + y) * b_stride + bx;
+                for(int x = 0; x < 8; x++) {
+                    sum_a += pa[x];
+                    sum_b += pb[x];
+                    sum_aa += pa[x] * pa[x];
+                    sum_bb += pb[x] * pb[x];
+                    sum_ab += pa[x] * pb[x];
+                }
+            }
+            double mean_a = sum_a / 64.0;
+            double mean_b = sum_b / 64.0;
+            double var_a = sum_aa / 64.0 - mean_a * mean_a;
+            double var_b = sum_bb / 64.0 - mean_b * mean_b;
+            double cov = sum_ab / 64.0 - mean_a * mean_b;
+            ssim_sum += ((2 * mean_a * mean_b + c1) * (2 * cov + c2))
+                    / ((mean_a * mean_a + mean_b * mean_b + c1) * (var_a + var_b + c2));
+            blocks++;
+        }
+    }
+    return blocks > 0 ? ssim_sum / blocks : 1.0;
+}
+
+// 质量统计的中间状态
+typedef struct QualityState
+{
+    FILE *ref_file;         // 独立的句柄顺序读取参考帧, 解码输出是显示顺序
+    uint8_t *ref_buf;
+    int frame_bytes;
+    uint64_t sse[3];
+    double ssim_sum;
+    int frames;
+} QualityState;
+
+static int compare_frame(QualityState *qs, const AVFrame *decoded)
+{
+    if(fread(qs->ref_buf, 1, qs->frame_bytes, qs->ref_file) != (size_t)qs->frame_bytes) {
+        return -1;
+    }
+    uint8_t *ref_data[4];
+    int ref_linesize[4];
+    av_image_fill_arrays(ref_data, ref_linesize, qs->ref_buf, AV_PIX_FMT_YUV420P,
+                         decoded->width, decoded->height, 1);
+    for(int i = 0; i < 3; i++) {
+        int w = i == 0 ? decoded->width : (decoded->width + 1) / 2;
+        int h = i == 0 ? decoded->height : (decoded->height + 1) / 2;
+        qs->sse[i] += plane_sse(ref_data[i], ref_linesize[i],
+                                decoded->data[i], decoded->linesize[i], w, h);
+    }
+    qs->ssim_sum += plane_ssim(ref_data[0], ref_linesize[0], decoded->data[0], decoded->linesize[0],
+                               decoded->width, decoded->height);
+    qs->frames++;
+    return 0;
+}
+
+static int decode_packet(AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame, QualityState *qs)
+{
+    int ret = avcodec_send_packet(dec_ctx, pkt);
+    if(ret < 0) {
+        fprintf(stderr, "avcodec_send_packet failed:%s\n", av_err2str(ret));
+        return -1;
+    }
+    while(1) {
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        if(ret < 0) {
+            fprintf(stderr, "avcodec_receive_frame failed:%s\n", av_err2str(ret));
+            return -1;
+        }
+        compare_frame(qs, frame);
+        av_frame_unref(frame);
+    }
+}
+
+// 编码一帧(frame为NULL时冲刷), 输出的packet计算延迟后送去解码
+static int encode_frame(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt,
+                        const int64_t *send_times, int send_count, double *latencies, int *latency_count,
+                        int64_t *encode_us, int64_t *bytes_count,
+                        AVCodecContext *dec_ctx, AVFrame *dec_frame, QualityState *qs)
+{
+    int64_t begin = av_gettime_relative();
+    int ret = avcodec_send_frame(enc_ctx, frame);
+    if(ret < 0) {
+        fprintf(stderr, "avcodec_send_frame failed:%s\n", av_err2str(ret));
+        return -1;
+    }
+    while(1) {
+        ret = avcodec_receive_packet(enc_ctx, pkt);
+        int64_t now = av_gettime_relative();
+        *encode_us += now - begin;
+        if(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return 0;
+        } else if(ret < 0) {
+            fprintf(stderr, "avcodec_receive_packet failed:%s\n", av_err2str(ret));
+            return -1;
+        }
+        // time_base为1/fps, pts就是帧序号
+        if(pkt->pts >= 0 && pkt->pts < send_count && send_times[pkt->pts] > 0)
+            latencies[(*latency_count)++] = (now - send_times[pkt->pts]) / 1000.0;
+        *bytes_count += pkt->size;
+        if(dec_ctx)
+            decode_packet(dec_ctx, pkt, dec_frame, qs);
+        av_packet_unref(pkt);
+        begin = av_gettime_relative();  // 解码对比的时间不算在编码里
+    }
+}
+
+static int open_encoder(const BenchCase *bc, AVCodecContext **out_ctx)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(bc->codec_name);
+    if(!codec) {
+        fprintf(stderr, "Codec '%s' not found\n", bc->codec_name);
+        return -1;
+    }
+    AVCodecContext *enc_ctx = avcodec_alloc_context3(codec);
+    if(!enc_ctx) {
+        fprintf(stderr, "Could not allocate video codec context\n");
+        return -1;
+    }
+    enc_ctx->width = bc->width;
+    enc_ctx->height = bc->height;
+    enc_ctx->time_base = (AVRational){1, bc->fps};
+    enc_ctx->framerate = (AVRational){bc->fps, 1};
+    enc_ctx->gop_size = bc->fps * 2;
+    enc_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc_ctx->thread_count = bc->threads;
+
+    AVDictionary *opts = NULL;
+    av_dict_set(&opts, "preset", bc->preset, 0);
+    if(strcmp(bc->tune, "none") != 0)
+        av_dict_set(&opts, "tune", bc->tune, 0);
+    if(strncmp(bc->rc, "crf:", 4) == 0) {
+        av_dict_set(&opts, "crf", bc->rc + 4, 0);
+    } else if(strncmp(bc->rc, "br:", 3) == 0) {
+        enc_ctx->bit_rate = atoi(bc->rc + 3) * 1000LL;   // kbps -> bps
+    } else {
+        fprintf(stderr, "invalid rate control '%s', use crf:N or br:kbps\n", bc->rc);
+        av_dict_free(&opts);
+        avcodec_free_context(&enc_ctx);
+        return -1;
+    }
+    if(strcmp(bc->codec_name, "libx265") == 0)
+        av_dict_set(&opts, "x265-params", "log-level=error", 0);
+
+    int ret = avcodec_open2(enc_ctx, codec, &opts);
+    av_dict_free(&opts);
+    if(ret < 0) {
+        fprintf(stderr, "Could not open codec %s: %s\n", bc->codec_name, av_err2str(ret));
+        avcodec_free_context(&enc_ctx);
+        return -1;
+    }
+    *out_ctx = enc_ctx;
+    return 0;
+}
+
+static int open_decoder(enum AVCodecID codec_id, AVCodecContext **out_ctx)
+{
+    const AVCodec *codec = avcodec_find_decoder(codec_id);
+    if(!codec) {
+        fprintf(stderr, "decoder not found\n");
+        return -1;
+    }
+    AVCodecContext *dec_ctx = avcodec_alloc_context3(codec);
+    if(!dec_ctx) {
+        fprintf(stderr, "Could not allocate decoder context\n");
+        return -1;
+    }
+    int ret = avcodec_open2(dec_ctx, codec, NULL);
+    if(ret < 0) {
+        fprintf(stderr, "Could not open decoder: %s\n", av_err2str(ret));
+        avcodec_free_context(&dec_ctx);
+        return -1;
+    }
+    *out_ctx = dec_ctx;
+    return 0;
+}
+
+static int run_case(const BenchCase *bc, int quality_enable, BenchResult *result)
+{
+    FILE *infile = NULL;
+    AVCodecContext *enc_ctx = NULL;
+    AVCodecContext *dec_ctx = NULL;
+    AVFrame *frame = NULL;
+    AVFrame *dec_frame = NULL;
+    AVPacket *pkt = NULL;
+    uint8_t *yuv_buf = NULL;
+    int64_t *send_times = NULL;
+    double *latencies = NULL;
+    QualityState qs;
+    int ret = -1;
+
+    memset(result, 0, sizeof(BenchResult));
+    memset(&qs, 0, sizeof(qs));
+    int frame_bytes = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, bc->width, bc->height, 1);
+
+    infile = fopen(bc->in_yuv_file, "rb");
+    if(!infile) {
+        fprintf(stderr, "Could not open %s\n", bc->in_yuv_file);
+        goto end;
+    }
+    fseek(infile, 0, SEEK_END);
+    int total_frames = (int)(ftell(infile) / frame_bytes);
+    fseek(infile, 0, SEEK_SET);
+    if(bc->max_frames > 0 && bc->max_frames < total_frames)
+        total_frames = bc->max_frames;
+    if(total_frames <= 0) {
+        fprintf(stderr, "%s has no complete frame\n", bc->in_yuv_file);
+        goto end;
+    }
+
+    if(open_encoder(bc, &enc_ctx) < 0)
+        goto end;
+    if(quality_enable) {
+        if(open_decoder(enc_ctx->codec_id, &dec_ctx) < 0)
+            goto end;
+        qs.ref_file = fopen(bc->in_yuv_file, "rb");
+        qs.ref_buf = malloc(frame_bytes);
+        qs.frame_bytes = frame_bytes;
+        dec_frame = av_frame_alloc();
+        if(!qs.ref_file || !qs.ref_buf || !dec_frame) {
+            fprintf(stderr, "Could not init quality check\n");
+            goto end;
+        }
+    }
+
+    pkt = av_packet_alloc();
+    frame = av_frame_alloc();
+    yuv_buf = malloc(frame_bytes);
+    send_times = calloc(total_frames, sizeof(int64_t));
+    latencies = calloc(total_frames, sizeof(double));
+    if(!pkt || !frame || !yuv_buf || !send_times || !latencies) {
+        fprintf(stderr, "Could not allocate buffers\n");
+        goto end;
+    }
+    frame->format = enc_ctx->pix_fmt;
+    frame->width  = enc_ctx->width;
+    frame->height = enc_ctx->height;
+    if(av_frame_get_buffer(frame, 0) < 0) {
+        fprintf(stderr, "Could not allocate the video frame data\n");
+        goto end;
+    }
+
+    int latency_count = 0;
+    int64_t encode_us = 0;
+    int64_t bytes_count = 0;
+    uint8_t *src_data[4];
+    int src_linesize[4];
+    av_image_fill_arrays(src_data, src_linesize, yuv_buf, AV_PIX_FMT_YUV420P,
+                         bc->width, bc->height, 1);
+    for(int i = 0; i < total_frames; i++) {
+        if(fread(yuv_buf, 1, frame_bytes, infile) != (size_t)frame_bytes)
+            break;
+        if(av_frame_make_writable(frame) != 0) {
+            fprintf(stderr, "av_frame_make_writable failed\n");
+            goto end;
+        }
+        av_image_copy(frame->data, frame->linesize, (const uint8_t **)src_data, src_linesize,
+                      AV_PIX_FMT_YUV420P, bc->width, bc->height);
+        frame->pts = i;
+        send_times[i] = av_gettime_relative();
+        if(encode_frame(enc_ctx, frame, pkt, send_times, total_frames, latencies, &latency_count,
+                        &encode_us, &bytes_count, dec_ctx, dec_frame, &qs) < 0)
+            goto end;
+    }
+    if(encode_frame(enc_ctx, NULL, pkt, send_times, total_frames, latencies, &latency_count,
+                    &encode_us, &bytes_count, dec_ctx, dec_frame, &qs) < 0)
+        goto end;
+    if(dec_ctx)
+        decode_packet(dec_ctx, NULL, dec_frame, &qs);  // 冲刷解码器
+
+    qsort(latencies, latency_count, sizeof(double), compare_double);
+    result->frames = latency_count;
+    result->fps = encode_us > 0 ? latency_count * 1000000.0 / encode_us : 0;
+    result->latency_p50 = percentile(latencies, latency_count, 50);
+    result->latency_p90 = percentile(latencies, latency_count, 90);
+    result->latency_p99 = percentile(latencies, latency_count, 99);
+    result->latency_max = latency_count > 0 ? latencies[latency_count - 1] : 0;
+    result->kbps = latency_count > 0 ? bytes_count * 8.0 / (latency_count / (double)bc->fps) / 1000 : 0;
+    if(qs.frames > 0) {
+        double luma = (double)bc->width * bc->height * qs.frames;
+        double chroma = (double)((bc->width + 1) / 2) * ((bc->height + 1) / 2) * qs.frames;
+        result->decoded_frames = qs.frames;
+        result->psnr_y = sse_to_psnr(qs.sse[0], luma);
+        result->psnr_avg = sse_to_psnr(qs.sse[0] + qs.sse[1] + qs.sse[2], luma + 2 * chroma);
+        result->ssim_y = qs.ssim_sum / qs.frames;
+    }
+    ret = 0;
+end:
+    if(infile)
+        fclose(infile);
+    if(qs.ref_file)
+        fclose(qs.ref_file);
+    free(qs.ref_buf);
+    free(yuv_buf);
+    free(send_times);
+    free(latencies);
+    av_frame_free(&frame);
+    av_frame_free(&dec_frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&enc_ctx);
+    avcodec_free_context(&dec_ctx);
+    return ret;
+}
+
+static void print_csv_header(FILE *out)
+{
+    fprintf(out, "file,codec,preset,tune,rc,threads,frames,fps,latency_p50_ms,latency_p90_ms,"
+                 "latency_p99_ms,latency_max_ms,kbps,psnr_y,psnr_avg,ssim_y\n");
+}
+
+static void print_csv_row(FILE *out, const BenchCase *bc, const BenchResult *r)
+{
+    fprintf(out, "%s,%s,%s,%s,%s,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,%.3f,%.3f,%.5f\n",
+            bc->in_yuv_file, bc->codec_name, bc->preset, bc->tune, bc->rc, bc->threads,
+            r->frames, r->fps, r->latency_p50, r->latency_p90, r->latency_p99, r->latency_max,
+            r->kbps, r->psnr_y, r->psnr_avg, r->ssim_y);
+}
+
+static void print_json_row(FILE *out, const BenchCase *bc, const BenchResult *r, int first)
+{
+    fprintf(out, "%s    {\"file\": \"%s\", \"codec\": \"%s\", \"preset\": \"%s\", \"tune\": \"%s\", "
+                 "\"rc\": \"%s\", \"threads\": %d, \"frames\": %d, \"fps\": %.2f, "
+                 "\"latency_ms\": {\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f}, "
+                 "\"kbps\": %.1f, \"psnr_y\": %.3f, \"psnr_avg\": %.3f, \"ssim_y\": %.5f}",
+            first ? "" : ",\n", bc->in_yuv_file, bc->codec_name, bc->preset, bc->tune, bc->rc,
+            bc->threads, r->frames, r->fps, r->latency_p50, r->latency_p90, r->latency_p99,
+            r->latency_max, r->kbps, r->psnr_y, r->psnr_avg, r->ssim_y);
+}
+
+static void usage(const char *exe)
+{
+    fprintf(stderr,
+            "Usage: %s [options] in1.yuv [in2.yuv ...]\n"
+            "  -s WxH        input size, default 1280x720\n"
+            "  -r fps        input frame rate, default 25\n"
+            "  -n frames     max frames per file, default all\n"
+            "  -c codecs     default libx264,libx265\n"
+            "  -p presets    default ultrafast,veryfast,medium\n"
+            "  -t tunes      default none\n"
+            "  -q rcs        crf:N or br:kbps, default crf:23\n"
+            "  -j threads    0 = auto, default 0\n"
+            "  -f csv|json   report format, default csv\n"
+            "  -o file       report file, default stdout\n"
+            "  -Q            skip PSNR/SSIM\n"
+            "e.g. %s -s 1280x720 -p fast,medium -q crf:23,br:2000 -j 1,4,0 -f json 1280x720_25fps_10s.yuv\n",
+            exe, exe);
+}
+
+/**
+ * @brief 提取测试文件：ffmpeg -i big_buck_bunny_720p_10mb.mp4 -t 10 -r 25 -pix_fmt yuv420p 1280x720_25fps_10s.yuv
+ *        每个组合(文件 x 编码器 x preset x tune x 码控 x 线程数)编码一次, 每完成一次输出一行结果
+ */
+int main(int argc, char **argv)
+{
+    char codecs_arg[] = "libx264,libx265";
+    char presets_arg[] = "ultrafast,veryfast,medium";
+    char tunes_arg[] = "none";
+    char rcs_arg[] = "crf:23";
+    char threads_arg[] = "0";
+    StringList codecs, presets, tunes, rcs, threads;
+    split_list(codecs_arg, &codecs);
+    split_list(presets_arg, &presets);
+    split_list(tunes_arg, &tunes);
+    split_list(rcs_arg, &rcs);
+    split_list(threads_arg, &threads);
+
+    int width = 1280;
+    int height = 720;
+    int fps = 25;
+    int max_frames = 0;
+    int json = 0;
+    int quality_enable = 1;
+    const char *out_file = NULL;
+    const char *inputs[MAX_INPUT_FILES];
+    int input_count = 0;
+
+    for(int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if(opt[0] == '-' && opt[1] && !opt[2]) {
+            if(opt[1] == 'Q') {
+                quality_enable = 0;
+                continue;
+            }
+            if(i + 1 >= argc) {
+                usage(argv[0]);
+                return -1;
+            }
+            char *value = argv[++i];
+            int ret = 0;
+            switch(opt[1]) {
+            case 's': ret = sscanf(value, "%dx%d", &width, &height) == 2 ? 0 : -1; break;
+            case 'r': fps = atoi(value); break;
+            case 'n': max_frames = atoi(value); break;
+            case 'c': ret = split_list(value, &codecs); break;
+            case 'p': ret = split_list(value, &presets); break;
+            case 't': ret = split_list(value, &tunes); break;
+            case 'q': ret = split_list(value, &rcs); break;
+            case 'j': ret = split_list(value, &threads); break;
+            case 'f': json = strcmp(value, "json") == 0; break;
+            case 'o': out_file = value; break;
+            default: ret = -1; break;
+            }
+            if(ret < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if(input_count < MAX_INPUT_FILES) {
+            inputs[input_count++] = opt;
+        }
+    }
+    if(input_count == 0 || width <= 0 || height <= 0 || fps <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    FILE *out = stdout;
+    if(out_file) {
+        out = fopen(out_file, "w");
+        if(!out) {
+            fprintf(stderr, "Could not open %s\n", out_file);
+            return -1;
+        }
+    }
+    // 不同版本之间对比时需要知道用的哪个ffmpeg
+    if(json)
+        fprintf(out, "{\n  \"ffmpeg\": \"%s\",\n  \"results\": [\n", av_version_info());
+    else
+        print_csv_header(out);
+
+    int first = 1;
+    int failed = 0;
+    for(int f = 0; f < input_count; f++)
+    for(int c = 0; c < codecs.count; c++)
+    for(int p = 0; p < presets.count; p++)
+    for(int t = 0; t < tunes.count; t++)
+    for(int q = 0; q < rcs.count; q++)
+    for(int j = 0; j < threads.count; j++) {
+        BenchCase bc;
+        BenchResult result;
+        bc.in_yuv_file = inputs[f];
+        bc.width = width;
+        bc.height = height;
+        bc.fps = fps;
+        bc.max_frames = max_frames;
+        bc.codec_name = codecs.items[c];
+        bc.preset = presets.items[p];
+        bc.tune = tunes.items[t];
+        bc.rc = rcs.items[q];
+        bc.threads = atoi(threads.items[j]);
+        fprintf(stderr, "run %s %s %s %s %s threads:%d\n", bc.in_yuv_file, bc.codec_name,
+                bc.preset, bc.tune, bc.rc, bc.threads);
+        if(run_case(&bc, quality_enable, &result) < 0) {
+            failed++;
+            continue;
+        }
+        if(json) {
+            print_json_row(out, &bc, &result, first);
+        } else {
+            print_csv_row(out, &bc, &result);
+        }
+        first = 0;
+        fflush(out);
+    }
+    if(json)
+        fprintf(out, "\n  ]\n}\n");
+    if(out != stdout)
+        fclose(out);
+    if(failed)
+        fprintf(stderr, "%d cases failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,408 @@
+/**
+* @projectName   18_demux_thread
+* @brief         多线程解复用, 在01_demux.c的基础上:
+*               （1）独立的读线程调用av_read_frame, 按stream_index把packet放入每个流各自的队列；
+*               （2）队列按字节数和时长限制大小, 满了读线程等待, 内存有上限；
+*               （3）解码/提取等消费者各自从自己的队列取packet, 音频和视频处理慢不会互相拖累,
+*                    读线程提前读取也可以掩盖磁盘/网络的延迟
+*               用法: 18_demux_thread in_file [max_mb] [max_ms] [video_delay_us] [audio_delay_us]
+*               video_delay_us/audio_delay_us模拟消费者每个packet的处理耗时
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/fifo.h>
+#include <libavutil/time.h>
+
+#define DEFAULT_QUEUE_MAX_BYTES (16 * 1024 * 1024)
+#define DEFAULT_QUEUE_MAX_DURATION_MS 5000
+
+// 每个流一个packet队列, 读线程写入, 消费者线程读取
+typedef struct StreamQueue
+{
+    AVFifo *packets;            // AVPacket *
+    int nb_packets;
+    int64_t bytes;              // 队列里packet的总字节数
+    int64_t duration;           // 队列里packet的总时长, 单位为流的time_base
+    int64_t max_bytes;
+    int64_t max_duration;       // 单位为流的time_base, <=0不限制
+    int finished;               // 读线程不再写入
+    int abort;
+    int64_t peak_bytes;
+    int64_t peak_duration;
+    int64_t full_waits;         // 读线程因为队列满等待的次数
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} StreamQueue;
+
+// 解复用组件, 打开文件后对需要的流调用demux_thread_enable_stream, 然后start
+typedef struct DemuxThread
+{
+    AVFormatContext *ifmt_ctx;
+    StreamQueue *queues;        // nb_streams个
+    int *enabled;
+    int nb_streams;
+    pthread_t thread;
+    int thread_started;
+    int abort;
+    int read_ret;               // 读线程结束的原因, AVERROR_EOF表示正常读完
+    int64_t read_packets;
+    int64_t read_bytes;
+} DemuxThread;
+
+static int stream_queue_init(StreamQueue *q, int64_t max_bytes, int64_t max_duration)
+{
+    memset(q, 0, sizeof(*q));
+    q->packets = av_fifo_alloc2(1, sizeof(AVPacket *), AV_FIFO_FLAG_AUTO_GROW);
+    if (!q->packets)
+        return AVERROR(ENOMEM);
+    q->max_bytes = max_bytes;
+    q->max_duration = max_duration;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    return 0;
+}
+
+static void stream_queue_clear(StreamQueue *q)
+{
+    AVPacket *pkt = NULL;
+    pthread_mutex_lock(&q->mutex);
+    while (av_fifo_read(q->packets, &pkt, 1) >= 0)
+        av_packet_free(&pkt);
+    q->nb_packets = 0;
+    q->bytes = 0;
+    q->duration = 0;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static void stream_queue_destroy(StreamQueue *q)
+{
+    if (!q->packets)
+        return;
+    stream_queue_clear(q);
+    av_fifo_freep2(&q->packets);
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+// 超过字节数或者时长限制为满, 空队列总是可以写入一个packet, 避免单个大packet卡住
+static int stream_queue_is_full(StreamQueue *q)
+{
+    if (q->nb_packets == 0)
+        return 0;
+    if (q->max_bytes > 0 && q->bytes >= q->max_bytes)
+        return 1;
+    if (q->max_duration > 0 && q->duration >= q->max_duration)
+        return 1;
+    return 0;
+}
+
+// 取走pkt的数据引用, 队列满时等待; 返回<0表示已经中止
+static int stream_queue_put(StreamQueue *q, AVPacket *pkt)
+{
+    AVPacket *node = av_packet_alloc();
+    if (!node)
+        return AVERROR(ENOMEM);
+    av_packet_move_ref(node, pkt);
+
+    pthread_mutex_lock(&q->mutex);
+    if (stream_queue_is_full(q) && !q->abort)
+        q->full_waits++;
+    while (stream_queue_is_full(q) && !q->abort)
+        pthread_cond_wait(&q->not_full, &q->mutex);
+    if (q->abort) {
+        pthread_mutex_unlock(&q->mutex);
+        av_packet_free(&node);
+        return AVERROR_EXIT;
+    }
+    av_fifo_write(q->packets, &node, 1);
+    q->nb_packets++;
+    q->bytes += node->size;
+    q->duration += node->duration;
+    if (q->bytes > q->peak_bytes)
+        q->peak_bytes = q->bytes;
+    if (q->duration > q->peak_duration)
+        q->peak_duration = q->duration;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+// 1: 取到packet, 0: 已经读完, <0: 已经中止
+static int stream_queue_get(StreamQueue *q, AVPacket *pkt)
+{
+    AVPacket *node = NULL;
+    int ret = 0;
+    pthread_mutex_lock(&q->mutex);
+    while (q->nb_packets == 0 && !q->finished && !q->abort)
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    if (q->abort) {
+        ret = AVERROR_EXIT;
+    } else if (q->nb_packets > 0) {
+        av_fifo_read(q->packets, &node, 1);
+        q->nb_packets--;
+        q->bytes -= node->size;
+        q->duration -= node->duration;
+        pthread_cond_signal(&q->not_full);
+        ret = 1;
+    }
+    pthread_mutex_unlock(&q->mutex);
+    if (node) {
+        av_packet_move_ref(pkt, node);
+        av_packet_free(&node);
+    }
+    return ret;
+}
+
+static void stream_queue_finish(StreamQueue *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->finished = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static void stream_queue_abort(StreamQueue *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->abort = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+// 打开文件并为每个流创建队列, max_bytes/max_duration_us为每个队列的限制
+static int demux_thread_open(DemuxThread *d, const char *url, int64_t max_bytes, int64_t max_duration_us)
+{
+    char errbuf[1024] = {0};
+    memset(d, 0, sizeof(*d));
+    int ret = avformat_open_input(&d->ifmt_ctx, url, NULL, NULL);
+    if (ret < 0) {
+        av_strerror(ret, errbuf, sizeof(errbuf) - 1);
+        printf("open %s failed:%s\n", url, errbuf);
+        return ret;
+    }
+    ret = avformat_find_stream_info(d->ifmt_ctx, NULL);
+    if (ret < 0) {
+        av_strerror(ret, errbuf, sizeof(errbuf) - 1);
+        printf("avformat_find_stream_info %s failed:%s\n", url, errbuf);
+        return ret;
+    }
+    d->nb_streams = d->ifmt_ctx->nb_streams;
+    d->queues = av_calloc(d->nb_streams, sizeof(*d->queues));
+    d->enabled = av_calloc(d->nb_streams, sizeof(*d->enabled));
+    if (!d->queues || !d->enabled)
+        return AVERROR(ENOMEM);
+    for (int i = 0; i < d->nb_streams; i++) {
+        AVStream *st = d->ifmt_ctx->streams[i];
+        int64_t max_duration = max_duration_us > 0
+                ? av_rescale_q(max_duration_us, AV_TIME_BASE_Q, st->time_base) : 0;
+        ret = stream_queue_init(&d->queues[i], max_bytes, max_duration);
+        if (ret < 0)
+            return ret;
+        // 默认丢弃所有流, 只读取enable的流
+        st->discard = AVDISCARD_ALL;
+    }
+    return 0;
+}
+
+static int demux_thread_enable_stream(DemuxThread *d, int stream_index)
+{
+    if (stream_index < 0 || stream_index >= d->nb_streams)
+        return AVERROR(EINVAL);
+    d->enabled[stream_index] = 1;
+    d->ifmt_ctx->streams[stream_index]->discard = AVDISCARD_DEFAULT;
+    return 0;
+}
+
+static void *demux_thread_loop(void *arg)
+{
+    DemuxThread *d = (DemuxThread *)arg;
+    AVPacket *pkt = av_packet_alloc();
+    int ret = pkt ? 0 : AVERROR(ENOMEM);
+    while (pkt && !d->abort) {
+        ret = av_read_frame(d->ifmt_ctx, pkt);
+        if (ret < 0)
+            break;
+        if (pkt->stream_index >= d->nb_streams || !d->enabled[pkt->stream_index]) {
+            av_packet_unref(pkt);
+            continue;
+        }
+        d->read_packets++;
+        d->read_bytes += pkt->size;
+        ret = stream_queue_put(&d->queues[pkt->stream_index], pkt);
+        if (ret < 0) {
+            av_packet_unref(pkt);
+            break;
+        }
+    }
+    d->read_ret = ret;
+    av_packet_free(&pkt);
+    for (int i = 0; i < d->nb_streams; i++)
+        stream_queue_finish(&d->queues[i]);
+    return NULL;
+}
+
+static int demux_thread_start(DemuxThread *d)
+{
+    int ret = pthread_create(&d->thread, NULL, demux_thread_loop, d);
+    if (ret != 0) {
+        printf("pthread_create demux thread failed:%d\n", ret);
+        return AVERROR(ret);
+    }
+    d->thread_started = 1;
+    return 0;
+}
+
+// 消费者调用, 每个流只能由一个消费者读取; 1: 取到packet, 0: 已经读完, <0: 已经中止
+static int demux_thread_get_packet(DemuxThread *d, int stream_index, AVPacket *pkt)
+{
+    if (stream_index < 0 || stream_index >= d->nb_streams || !d->enabled[stream_index])
+        return AVERROR(EINVAL);
+    return stream_queue_get(&d->queues[stream_index], pkt);
+}
+
+// 中止读线程和所有等待的消费者
+static void demux_thread_abort(DemuxThread *d)
+{
+    d->abort = 1;
+    for (int i = 0; i < d->nb_streams; i++)
+        stream_queue_abort(&d->queues[i]);
+}
+
+static void demux_thread_close(DemuxThread *d)
+{
+    if (d->thread_started) {
+        demux_thread_abort(d);
+        pthread_join(d->thread, NULL);
+        d->thread_started = 0;
+    }
+    for (int i = 0; d->queues && i < d->nb_streams; i++)
+        stream_queue_destroy(&d->queues[i]);
+    av_freep(&d->queues);
+    av_freep(&d->enabled);
+    if (d->ifmt_ctx)
+        avformat_close_input(&d->ifmt_ctx);
+}
+
+// 示例消费者, 统计packet数量, delay_us模拟解码等处理耗时
+typedef struct Consumer
+{
+    DemuxThread *demux;
+    int stream_index;
+    int delay_us;
+    const char *name;
+    int64_t packets;
+    int64_t bytes;
+    int64_t elapsed_us;
+} Consumer;
+
+static void *consumer_loop(void *arg)
+{
+    Consumer *c = (Consumer *)arg;
+    AVPacket *pkt = av_packet_alloc();
+    int64_t start = av_gettime_relative();
+    while (pkt && demux_thread_get_packet(c->demux, c->stream_index, pkt) > 0) {
+        c->packets++;
+        c->bytes += pkt->size;
+        if (c->delay_us > 0)
+            av_usleep(c->delay_us);
+        av_packet_unref(pkt);
+    }
+    c->elapsed_us = av_gettime_relative() - start;
+    av_packet_free(&pkt);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        printf("usage: %s in_file [max_mb] [max_ms] [video_delay_us] [audio_delay_us]\n", argv[0]);
+        return -1;
+    }
+    const char *in_filename = argv[1];
+    int64_t max_bytes = argc > 2 ? (int64_t)atoi(argv[2]) * 1024 * 1024 : DEFAULT_QUEUE_MAX_BYTES;
+    int64_t max_duration_us = (argc > 3 ? atoi(argv[3]) : DEFAULT_QUEUE_MAX_DURATION_MS) * (int64_t)1000;
+
+    DemuxThread demux;
+    Consumer consumers[2];
+    pthread_t threads[2];
+    int nb_consumers = 0;
+    int ret = demux_thread_open(&demux, in_filename, max_bytes, max_duration_us);
+    if (ret < 0)
+        goto failed;
+    av_dump_format(demux.ifmt_ctx, 0, in_filename, 0);
+
+    int videoindex = av_find_best_stream(demux.ifmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    int audioindex = av_find_best_stream(demux.ifmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    memset(consumers, 0, sizeof(consumers));
+    if (videoindex >= 0) {
+        consumers[nb_consumers].stream_index = videoindex;
+        consumers[nb_consumers].delay_us = argc > 4 ? atoi(argv[4]) : 0;
+        consumers[nb_consumers].name = "video";
+        nb_consumers++;
+    }
+    if (audioindex >= 0) {
+        consumers[nb_consumers].stream_index = audioindex;
+        consumers[nb_consumers].delay_us = argc > 5 ? atoi(argv[5]) : 0;
+        consumers[nb_consumers].name = "audio";
+        nb_consumers++;
+    }
+    if (nb_consumers == 0) {
+        printf("no audio or video stream in %s\n", in_filename);
+        ret = -1;
+        goto failed;
+    }
+    for (int i = 0; i < nb_consumers; i++) {
+        consumers[i].demux = &demux;
+        demux_thread_enable_stream(&demux, consumers[i].stream_index);
+    }
+
+    int64_t start = av_gettime_relative();
+    ret = demux_thread_start(&demux);
+    if (ret < 0)
+        goto failed;
+    for (int i = 0; i < nb_consumers; i++) {
+        if (pthread_create(&threads[i], NULL, consumer_loop, &consumers[i]) != 0) {
+            printf("pthread_create %s consumer failed\n", consumers[i].name);
+            demux_thread_abort(&demux);
+            nb_consumers = i;
+            ret = -1;
+            break;
+        }
+    }
+    for (int i = 0; i < nb_consumers; i++)
+        pthread_join(threads[i], NULL);
+    pthread_join(demux.thread, NULL);
+    demux.thread_started = 0;
+    int64_t elapsed_us = av_gettime_relative() - start;
+
+    if (demux.read_ret < 0 && demux.read_ret != AVERROR_EOF) {
+        char errbuf[1024] = {0};
+        av_strerror(demux.read_ret, errbuf, sizeof(errbuf) - 1);
+        printf("av_read_frame failed:%s\n", errbuf);
+    }
+    printf("read packets:%" PRId64 " bytes:%" PRId64 " elapsed:%.1fms %.1fMB/s\n",
+           demux.read_packets, demux.read_bytes, elapsed_us / 1000.0,
+           elapsed_us > 0 ? demux.read_bytes / (double)elapsed_us : 0);
+    for (int i = 0; i < nb_consumers; i++) {
+        Consumer *c = &consumers[i];
+        StreamQueue *q = &demux.queues[c->stream_index];
+        AVRational tb = demux.ifmt_ctx->streams[c->stream_index]->time_base;
+        printf("%s stream:%d packets:%" PRId64 " bytes:%" PRId64 " elapsed:%.1fms "
+               "queue peak bytes:%" PRId64 " peak duration:%.1fms full waits:%" PRId64 "\n",
+               c->name, c->stream_index, c->packets, c->bytes, c->elapsed_us / 1000.0,
+               q->peak_bytes, q->peak_duration * av_q2d(tb) * 1000, q->full_waits);
+    }
+
+failed:
+    demux_thread_close(&demux);
+    return ret < 0 ? -1 : 0;
+}
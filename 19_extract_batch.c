@@ -0,0 +1,356 @@
+/**
+* @projectName   19_extract_batch
+* @brief         多文件并行提取, 在03_extract-aac.c和04_extract-h264.c的基础上:
+*               （1）输入是目录、文件列表(@list.txt, 每行一个文件)或者多个媒体文件；
+*               （2）N个工作线程从共享的任务列表取文件, 每个文件的解复用 + BSF + 写文件完全独立；
+*               （3）同时处理的文件数就是工作线程数, 每个文件的输出缓存也有上限(eswriter.h), 内存不会随文件数增长；
+*               （4）统计输入MB/s和files/s
+*               用法: 19_extract_batch out_dir workers input...
+*               视频输出为out_dir/序号_文件名.h264(.h265), 音频为out_dir/序号_文件名.aac,
+*               序号是文件在输入中的位置, 不同目录下的同名文件(或者只有扩展名不同)不会互相覆盖
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <libavcodec/bsf.h>
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+
+#include "eswriter.h"
+
+#define MAX_PATH_LEN 1024
+
+// 一个输入文件
+typedef struct FileJob
+{
+    char *in_name;
+    int ret;
+    int64_t in_bytes;
+    int64_t out_bytes;
+    int64_t video_packets;
+    int64_t audio_packets;
+    int64_t elapsed_us;
+} FileJob;
+
+typedef struct BatchContext
+{
+    const char *out_dir;
+    FileJob *jobs;
+    int nb_jobs;
+    int capacity;
+    int next_job;               // 下一个待处理的文件
+    pthread_mutex_t mutex;
+} BatchContext;
+
+static int add_job(BatchContext *ctx, const char *name)
+{
+    if (ctx->nb_jobs == ctx->capacity) {
+        int capacity = ctx->capacity ? ctx->capacity * 2 : 256;
+        FileJob *jobs = av_realloc(ctx->jobs, capacity * sizeof(*jobs));
+        if (!jobs)
+            return AVERROR(ENOMEM);
+        ctx->jobs = jobs;
+        ctx->capacity = capacity;
+    }
+    FileJob *job = &ctx->jobs[ctx->nb_jobs];
+    memset(job, 0, sizeof(*job));
+    job->in_name = av_strdup(name);
+    if (!job->in_name)
+        return AVERROR(ENOMEM);
+    ctx->nb_jobs++;
+    return 0;
+}
+
+// 目录下的普通文件全部加入, 不递归
+static int add_dir(BatchContext *ctx, const char *dir_name)
+{
+    DIR *dir = opendir(dir_name);
+    if (!dir) {
+        printf("opendir %s failed\n", dir_name);
+        return -1;
+    }
+    struct dirent *entry;
+    char path[MAX_PATH_LEN];
+    int ret = 0;
+    while (ret >= 0 && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir_name, entry->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            ret = add_job(ctx, path);
+    }
+    closedir(dir);
+    return ret;
+}
+
+// 文件列表, 每行一个路径, 忽略空行和#开头的行
+static int add_list(BatchContext *ctx, const char *list_name)
+{
+    FILE *fp = fopen(list_name, "r");
+    if (!fp) {
+        printf("fopen %s failed\n", list_name);
+        return -1;
+    }
+    char line[MAX_PATH_LEN];
+    int ret = 0;
+    while (ret >= 0 && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+        ret = add_job(ctx, line);
+    }
+    fclose(fp);
+    return ret;
+}
+
+// 输出文件名: out_dir/序号_输入文件名去掉扩展名 + ext, 序号保证多个工作线程不会打开同一个输出文件
+static void make_out_name(char *out, int size, const char *out_dir, int index,
+                          const char *in_name, const char *ext)
+{
+    const char *base = strrchr(in_name, '/');
+    base = base ? base + 1 : in_name;
+    const char *dot = strrchr(base, '.');
+    int len = dot ? (int)(dot - base) : (int)strlen(base);
+    snprintf(out, size, "%s/%05d_%.*s%s", out_dir, index, len, base, ext);
+}
+
+// video packet经过bsf后写入, pkt为NULL时冲刷bsf
+static int write_video_packet(AVBSFContext *bsf_ctx, EsWriter *writer, AVPacket *pkt)
+{
+    AVPacket *out = pkt;
+    int ret = av_bsf_send_packet(bsf_ctx, pkt);
+    if (ret < 0) {
+        if (pkt)
+            av_packet_unref(pkt);
+        return ret;
+    }
+    if (!out && !(out = av_packet_alloc()))
+        return AVERROR(ENOMEM);
+    while ((ret = av_bsf_receive_packet(bsf_ctx, out)) == 0) {
+        if (es_writer_write_packet(writer, NULL, 0, out) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    if (out != pkt)
+        av_packet_free(&out);
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+// 处理一个文件, 和其他文件不共享任何状态
+static int extract_file(BatchContext *ctx, FileJob *job)
+{
+    AVFormatContext *ifmt_ctx = NULL;
+    AVBSFContext *bsf_ctx = NULL;
+    AVPacket *pkt = NULL;
+    EsWriter video_writer = {.fd = -1};
+    EsWriter audio_writer = {.fd = -1};
+    AdtsContext adts;
+    char out_name[MAX_PATH_LEN];
+    char errbuf[1024] = {0};
+    int video_index = -1;
+    int audio_index = -1;
+    int job_index = (int)(job - ctx->jobs);
+
+    int ret = avformat_open_input(&ifmt_ctx, job->in_name, NULL, NULL);
+    if (ret < 0)
+        goto end;
+    ret = avformat_find_stream_info(ifmt_ctx, NULL);
+    if (ret < 0)
+        goto end;
+    if (ifmt_ctx->pb)
+        job->in_bytes = avio_size(ifmt_ctx->pb);
+
+    video_index = av_find_best_stream(ifmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (video_index >= 0) {
+        AVCodecParameters *codecpar = ifmt_ctx->streams[video_index]->codecpar;
+        const char *bsf_name = NULL;
+        if (codecpar->codec_id == AV_CODEC_ID_H264)
+            bsf_name = "h264_mp4toannexb";
+        else if (codecpar->codec_id == AV_CODEC_ID_HEVC)
+            bsf_name = "hevc_mp4toannexb";
+        if (bsf_name) {
+            // Annex-B输入时mp4toannexb会直接透传
+            if ((ret = av_bsf_alloc(av_bsf_get_by_name(bsf_name), &bsf_ctx)) < 0
+                    || (ret = avcodec_parameters_copy(bsf_ctx->par_in, codecpar)) < 0
+                    || (ret = av_bsf_init(bsf_ctx)) < 0)
+                goto end;
+            make_out_name(out_name, sizeof(out_name), ctx->out_dir, job_index, job->in_name,
+                          codecpar->codec_id == AV_CODEC_ID_H264 ? ".h264" : ".h265");
+            if ((ret = es_writer_open(&video_writer, out_name)) < 0)
+                goto end;
+        } else {
+            video_index = -1;
+        }
+    }
+    audio_index = av_find_best_stream(ifmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (audio_index >= 0) {
+        AVCodecParameters *codecpar = ifmt_ctx->streams[audio_index]->codecpar;
+        if (codecpar->codec_id == AV_CODEC_ID_AAC
+                && adts_context_init(&adts, codecpar->profile, codecpar->sample_rate,
+                                     codecpar->ch_layout.nb_channels) == 0) {
+            make_out_name(out_name, sizeof(out_name), ctx->out_dir, job_index, job->in_name, ".aac");
+            if ((ret = es_writer_open(&audio_writer, out_name)) < 0)
+                goto end;
+        } else {
+            audio_index = -1;
+        }
+    }
+    if (video_index < 0 && audio_index < 0) {
+        ret = AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+    // 只读取需要的流
+    for (unsigned int i = 0; i < ifmt_ctx->nb_streams; i++) {
+        if ((int)i != video_index && (int)i != audio_index)
+            ifmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    pkt = av_packet_alloc();
+    if (!pkt) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    while ((ret = av_read_frame(ifmt_ctx, pkt)) >= 0) {
+        if (pkt->stream_index == video_index) {
+            job->video_packets++;
+            ret = write_video_packet(bsf_ctx, &video_writer, pkt);
+        } else if (pkt->stream_index == audio_index) {
+            job->audio_packets++;
+            // ts流分离出来的packet已经带了adts header
+            if (pkt->size >= 2 && pkt->data[0] == 0xff && (pkt->data[1] & 0xf6) == 0xf0)
+                ret = es_writer_write_packet(&audio_writer, NULL, 0, pkt);
+            else
+                ret = es_writer_write_adts(&audio_writer, &adts, pkt);
+        } else {
+            av_packet_unref(pkt);
+        }
+        if (ret < 0)
+            goto end;
+    }
+    if (ret != AVERROR_EOF)
+        goto end;
+    // 冲刷bsf
+    ret = video_index >= 0 ? write_video_packet(bsf_ctx, &video_writer, NULL) : 0;
+
+end:
+    if (ret < 0 && ret != AVERROR_EOF) {
+        av_strerror(ret, errbuf, sizeof(errbuf) - 1);
+        printf("extract %s failed:%s\n", job->in_name, errbuf);
+    }
+    if (es_writer_close(&video_writer) < 0)
+        ret = -1;
+    if (es_writer_close(&audio_writer) < 0)
+        ret = -1;
+    job->out_bytes = video_writer.total_bytes + audio_writer.total_bytes;
+    av_packet_free(&pkt);
+    av_bsf_free(&bsf_ctx);
+    avformat_close_input(&ifmt_ctx);
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+static void *worker_loop(void *arg)
+{
+    BatchContext *ctx = (BatchContext *)arg;
+    while (1) {
+        // 每个线程同步处理一个文件, 处理完再取下一个
+        pthread_mutex_lock(&ctx->mutex);
+        if (ctx->next_job >= ctx->nb_jobs) {
+            pthread_mutex_unlock(&ctx->mutex);
+            break;
+        }
+        FileJob *job = &ctx->jobs[ctx->next_job++];
+        pthread_mutex_unlock(&ctx->mutex);
+
+        int64_t start = av_gettime_relative();
+        job->ret = extract_file(ctx, job);
+        job->elapsed_us = av_gettime_relative() - start;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4) {
+        printf("usage: %s out_dir workers input...\n"
+               "input: directory, @list.txt or media file\n", argv[0]);
+        return -1;
+    }
+    av_log_set_level(AV_LOG_ERROR);
+    BatchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.out_dir = argv[1];
+    int workers = atoi(argv[2]);
+    if (workers <= 0)
+        workers = 1;
+    mkdir(ctx.out_dir, 0755);
+
+    int ret = 0;
+    for (int i = 3; i < argc && ret >= 0; i++) {
+        struct stat st;
+        if (argv[i][0] == '@')
+            ret = add_list(&ctx, argv[i] + 1);
+        else if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+            ret = add_dir(&ctx, argv[i]);
+        else
+            ret = add_job(&ctx, argv[i]);
+    }
+    if (ret < 0 || ctx.nb_jobs == 0) {
+        printf("no input file\n");
+        return -1;
+    }
+    if (workers > ctx.nb_jobs)
+        workers = ctx.nb_jobs;
+    printf("files:%d workers:%d\n", ctx.nb_jobs, workers);
+
+    pthread_mutex_init(&ctx.mutex, NULL);
+    pthread_t *threads = av_calloc(workers, sizeof(*threads));
+    int nb_threads = 0;
+    int64_t start = av_gettime_relative();
+    for (int i = 0; threads && i < workers; i++) {
+        if (pthread_create(&threads[i], NULL, worker_loop, &ctx) != 0) {
+            printf("pthread_create worker %d failed\n", i);
+            break;
+        }
+        nb_threads++;
+    }
+    // 一个线程也没有创建成功时在当前线程处理
+    if (nb_threads == 0)
+        worker_loop(&ctx);
+    for (int i = 0; i < nb_threads; i++)
+        pthread_join(threads[i], NULL);
+    int64_t elapsed_us = av_gettime_relative() - start;
+
+    int failed = 0;
+    int64_t in_bytes = 0;
+    int64_t out_bytes = 0;
+    printf("file,ret,in_bytes,out_bytes,video_packets,audio_packets,ms\n");
+    for (int i = 0; i < ctx.nb_jobs; i++) {
+        FileJob *job = &ctx.jobs[i];
+        printf("%s,%d,%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%.1f\n",
+               job->in_name, job->ret, job->in_bytes, job->out_bytes,
+               job->video_packets, job->audio_packets, job->elapsed_us / 1000.0);
+        if (job->ret < 0)
+            failed++;
+        if (job->in_bytes > 0)
+            in_bytes += job->in_bytes;
+        out_bytes += job->out_bytes;
+    }
+    double seconds = elapsed_us / 1000000.0;
+    printf("files:%d failed:%d in:%.1fMB out:%.1fMB elapsed:%.2fs %.1fMB/s %.1ffiles/s\n",
+           ctx.nb_jobs, failed, in_bytes / 1048576.0, out_bytes / 1048576.0, seconds,
+           seconds > 0 ? in_bytes / 1048576.0 / seconds : 0,
+           seconds > 0 ? ctx.nb_jobs / seconds : 0);
+
+    for (int i = 0; i < ctx.nb_jobs; i++)
+        av_free(ctx.jobs[i].in_name);
+    av_free(ctx.jobs);
+    av_free(threads);
+    pthread_mutex_destroy(&ctx.mutex);
+    return failed ? -1 : 0;
+}
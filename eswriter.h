@@ -0,0 +1,267 @@
+/**
+* @projectName   eswriter
+* @brief         裸流(ES)写文件, 02_demux-mp4.c、03_extract-aac.c、04_extract-h264.c共用:
+*               （1）ADTS头的固定字段每个流只计算一次, 每个packet只修改frame length;
+*               （2）头和packet数据不拷贝, 用iovec记录, 攒够一批后一次writev写入;
+*               （3）统计writev调用次数和字节数, 方便和每个packet两次fwrite对比
+*               每个.c编译成单独的可执行文件, 这里的函数都是static inline
+*/
+#ifndef ESWRITER_H
+#define ESWRITER_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "libavcodec/packet.h"
+#include "libavutil/time.h"
+
+#define ADTS_HEADER_SIZE 7
+// ADTS frame length只有13bit
+#define ADTS_MAX_FRAME_LENGTH 0x1fff
+
+// 一次writev最多的iovec数量, 不超过IOV_MAX(1024)
+#define ES_WRITER_MAX_IOV 1024
+// 攒够这么多字节就写一次
+#define ES_WRITER_BATCH_BYTES (1024 * 1024)
+
+static const int adts_sampling_frequencies[] = {
+    96000, // 0x0
+    88200, // 0x1
+    64000, // 0x2
+    48000, // 0x3
+    44100, // 0x4
+    32000, // 0x5
+    24000, // 0x6
+    22050, // 0x7
+    16000, // 0x8
+    12000, // 0x9
+    11025, // 0xa
+    8000   // 0xb
+           // 0xc d e f是保留的
+};
+
+// 一个流的ADTS头模板, frame length之外的字段都是固定的
+typedef struct AdtsContext {
+  uint8_t header[ADTS_HEADER_SIZE];
+} AdtsContext;
+
+static inline int adts_context_init(AdtsContext *adts, const int profile,
+                                    const int samplerate, const int channels) {
+  int sampling_frequency_index = -1;
+  int frequencies_size =
+      sizeof(adts_sampling_frequencies) / sizeof(adts_sampling_frequencies[0]);
+  for (int i = 0; i < frequencies_size; i++) {
+    if (adts_sampling_frequencies[i] == samplerate) {
+      sampling_frequency_index = i;
+      break;
+    }
+  }
+  if (sampling_frequency_index < 0) {
+    printf("unsupport samplerate:%d\n", samplerate);
+    return -1;
+  }
+
+  uint8_t *p = adts->header;
+  p[0] = 0xff; // syncword:0xfff                          高8bits
+  p[1] = 0xf0; // syncword:0xfff                          低4bits
+  p[1] |= (0 << 3); // MPEG Version:0 for MPEG-4,1 for MPEG-2  1bit
+  p[1] |= (0 << 1); // Layer:0                                 2bits
+  p[1] |= 1;        // protection absent:1                     1bit
+
+  p[2] = (profile) << 6; // profile:profile               2bits
+  p[2] |= (sampling_frequency_index & 0x0f)
+          << 2;          // sampling frequency index       4bits
+  p[2] |= (0 << 1);      // private bit:0                   1bit
+  p[2] |= (channels & 0x04) >> 2; // channel configuration  高1bit
+
+  p[3] = (channels & 0x03) << 6; // channel configuration 低2bits
+  // original、home、copyright id bit、copyright id start都是0
+  // 低2bits是frame length的高2bits, 写packet时填
+  p[4] = 0;    // frame length 中间8bits, 写packet时填
+  p[5] = 0x1f; // 高3bits是frame length的低3bits, 低5bits buffer fullness:0x7ff 高5bits
+  p[6] = 0xfc; // buffer fullness:0x7ff 低6bits, number_of_raw_data_blocks_in_frame:0
+  return 0;
+}
+
+// 从模板复制7字节, 只填frame length(包含头的长度)
+static inline int adts_write_header(const AdtsContext *adts, uint8_t *dst,
+                                    const int data_length) {
+  int adts_len = data_length + ADTS_HEADER_SIZE;
+  if (adts_len > ADTS_MAX_FRAME_LENGTH) {
+    printf("adts frame length %d too large\n", adts_len);
+    return -1;
+  }
+  memcpy(dst, adts->header, ADTS_HEADER_SIZE);
+  dst[3] |= (adts_len & 0x1800) >> 11;
+  dst[4] = (uint8_t)((adts_len & 0x7f8) >> 3);
+  dst[5] |= (uint8_t)((adts_len & 0x7) << 5);
+  return 0;
+}
+
+// 聚合写: 头放在headers里, packet数据引用放在packets里, writev之后才释放
+typedef struct EsWriter {
+  int fd;
+  struct iovec iov[ES_WRITER_MAX_IOV];
+  int iov_count;
+  size_t pending_bytes;
+  uint8_t headers[ES_WRITER_MAX_IOV * ADTS_HEADER_SIZE];
+  int headers_used;
+  AVPacket *packets[ES_WRITER_MAX_IOV];
+  int packet_count;
+  // 统计
+  int64_t total_packets;
+  int64_t total_bytes;
+  int64_t total_pieces;   // 头和数据分开写时需要的write次数
+  int64_t writev_calls;
+  int64_t writev_us;
+} EsWriter;
+
+static inline int es_writer_open(EsWriter *w, const char *filename) {
+  memset(w, 0, sizeof(*w));
+  w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (w->fd < 0) {
+    printf("open %s failed:%s\n", filename, strerror(errno));
+    return -1;
+  }
+  for (int i = 0; i < ES_WRITER_MAX_IOV; i++) {
+    w->packets[i] = av_packet_alloc();
+    if (!w->packets[i]) {
+      printf("av_packet_alloc failed\n");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// 把攒下的iovec全部写入, 处理writev只写了一部分的情况
+static inline int es_writer_flush(EsWriter *w) {
+  int ret = 0;
+  struct iovec *iov = w->iov;
+  int count = w->iov_count;
+  int64_t start = av_gettime_relative();
+  while (count > 0) {
+    ssize_t written = writev(w->fd, iov, count);
+    w->writev_calls++;
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      printf("writev failed:%s\n", strerror(errno));
+      ret = -1;
+      break;
+    }
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  w->writev_us += av_gettime_relative() - start;
+  for (int i = 0; i < w->packet_count; i++)
+    av_packet_unref(w->packets[i]);
+  w->packet_count = 0;
+  w->iov_count = 0;
+  w->headers_used = 0;
+  w->pending_bytes = 0;
+  return ret;
+}
+
+// header可以为NULL(header_len为0), pkt的数据引用转移给writer, 调用后pkt为空
+static inline int es_writer_write_packet(EsWriter *w, const uint8_t *header,
+                                         int header_len, AVPacket *pkt) {
+  if (w->iov_count + 2 > ES_WRITER_MAX_IOV ||
+      w->headers_used + header_len > (int)sizeof(w->headers)) {
+    if (es_writer_flush(w) < 0) {
+      av_packet_unref(pkt);
+      return -1;
+    }
+  }
+  int payload_len = pkt->size;
+  if (header_len > 0) {
+    uint8_t *dst = w->headers + w->headers_used;
+    memcpy(dst, header, header_len);
+    w->headers_used += header_len;
+    w->total_pieces++;
+    // 和上一个头在headers里连续时合并成一个iovec
+    struct iovec *last = w->iov_count > 0 ? &w->iov[w->iov_count - 1] : NULL;
+    if (last && (uint8_t *)last->iov_base + last->iov_len == dst) {
+      last->iov_len += header_len;
+    } else {
+      w->iov[w->iov_count].iov_base = dst;
+      w->iov[w->iov_count].iov_len = header_len;
+      w->iov_count++;
+    }
+  }
+  if (payload_len > 0) {
+    AVPacket *ref = w->packets[w->packet_count++];
+    av_packet_move_ref(ref, pkt);
+    w->iov[w->iov_count].iov_base = ref->data;
+    w->iov[w->iov_count].iov_len = payload_len;
+    w->iov_count++;
+    w->total_pieces++;
+  } else {
+    av_packet_unref(pkt);
+  }
+  w->pending_bytes += header_len + payload_len;
+  w->total_packets++;
+  w->total_bytes += header_len + payload_len;
+  return w->pending_bytes >= ES_WRITER_BATCH_BYTES ? es_writer_flush(w) : 0;
+}
+
+// 写调用者持有的数据, 不拷贝, data在下一次flush之前必须有效(比如缓存的SPS/PPS)
+static inline int es_writer_write_static(EsWriter *w, const uint8_t *data,
+                                         int size) {
+  if (size <= 0)
+    return 0;
+  if (w->iov_count + 1 > ES_WRITER_MAX_IOV && es_writer_flush(w) < 0)
+    return -1;
+  w->iov[w->iov_count].iov_base = (void *)data;
+  w->iov[w->iov_count].iov_len = size;
+  w->iov_count++;
+  w->total_pieces++;
+  w->pending_bytes += size;
+  w->total_bytes += size;
+  return w->pending_bytes >= ES_WRITER_BATCH_BYTES ? es_writer_flush(w) : 0;
+}
+
+// 写ADTS头 + AAC packet
+static inline int es_writer_write_adts(EsWriter *w, const AdtsContext *adts,
+                                       AVPacket *pkt) {
+  uint8_t header[ADTS_HEADER_SIZE];
+  if (adts_write_header(adts, header, pkt->size) < 0) {
+    av_packet_unref(pkt);
+    return -1;
+  }
+  return es_writer_write_packet(w, header, ADTS_HEADER_SIZE, pkt);
+}
+
+static inline void es_writer_dump_stats(EsWriter *w, const char *name) {
+  printf("%s: packets:%" PRId64 " bytes:%" PRId64 " writev calls:%" PRId64
+         " (%.1f packets/call, %.1fKB/call) writev time:%.2fms,"
+         " one write per header/payload would be %" PRId64 " calls\n",
+         name, w->total_packets, w->total_bytes, w->writev_calls,
+         w->writev_calls ? (double)w->total_packets / w->writev_calls : 0,
+         w->writev_calls ? w->total_bytes / 1024.0 / w->writev_calls : 0,
+         w->writev_us / 1000.0, w->total_pieces);
+}
+
+static inline int es_writer_close(EsWriter *w) {
+  int ret = 0;
+  if (w->fd >= 0) {
+    ret = es_writer_flush(w);
+    close(w->fd);
+    w->fd = -1;
+  }
+  for (int i = 0; i < ES_WRITER_MAX_IOV; i++)
+    av_packet_free(&w->packets[i]);
+  return ret;
+}
+
+#endif // ESWRITER_H